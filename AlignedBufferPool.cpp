@@ -0,0 +1,115 @@
+﻿#include "AlignedBufferPool.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Constructor
+AlignedBufferPool::AlignedBufferPool(size_t alignment, size_t maxCachedBytes)
+    : align(alignment ? alignment : 1), maxCached(maxCachedBytes) {
+}
+
+// Destructor (outstanding leases must be gone by now)
+AlignedBufferPool::~AlignedBufferPool() {
+    for (auto& kv : idle) {
+        for (char* ptr : kv.second) deallocate(ptr);
+    }
+}
+
+// Lease a buffer of at least bytes, aligned to the pool alignment
+AlignedBufferPool::Buffer AlignedBufferPool::acquire(size_t bytes) {
+    size_t capacity = align;
+    while (capacity < bytes) capacity <<= 1;
+
+    Buffer buffer;
+    buffer.pool = this;
+    buffer.capacity = capacity;
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        auto it = idle.find(capacity);
+        if (it != idle.end() && !it->second.empty()) {
+            buffer.ptr = it->second.back();
+            it->second.pop_back();
+            cachedBytes -= capacity;
+            return buffer;
+        }
+    }
+
+    buffer.ptr = allocate(align, capacity);
+    return buffer;
+}
+
+// Keep a released buffer for reuse while under the idle budget
+void AlignedBufferPool::release(char* ptr, size_t capacity) {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (cachedBytes + capacity <= maxCached) {
+            idle[capacity].push_back(ptr);
+            cachedBytes += capacity;
+            return;
+        }
+    }
+    deallocate(ptr);
+}
+
+// Aligned allocation
+char* AlignedBufferPool::allocate(size_t alignment, size_t bytes) {
+#ifdef _WIN32
+    void* ptr = _aligned_malloc(bytes, alignment);
+    if (!ptr) throw std::bad_alloc();
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, alignment < sizeof(void*) ? sizeof(void*) : alignment, bytes) != 0) {
+        throw std::bad_alloc();
+    }
+#endif
+    return static_cast<char*>(ptr);
+}
+
+// Aligned free
+void AlignedBufferPool::deallocate(char* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// Return the buffer to its pool
+void AlignedBufferPool::Buffer::reset() {
+    if (pool && ptr) pool->release(ptr, capacity);
+    pool = nullptr;
+    ptr = nullptr;
+    capacity = 0;
+}
+
+// Destructor
+AlignedBufferPool::Buffer::~Buffer() {
+    reset();
+}
+
+// Move constructor
+AlignedBufferPool::Buffer::Buffer(Buffer&& other) noexcept
+    : pool(other.pool), ptr(other.ptr), capacity(other.capacity) {
+    other.pool = nullptr;
+    other.ptr = nullptr;
+    other.capacity = 0;
+}
+
+// Move assignment
+AlignedBufferPool::Buffer& AlignedBufferPool::Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        pool = other.pool;
+        ptr = other.ptr;
+        capacity = other.capacity;
+        other.pool = nullptr;
+        other.ptr = nullptr;
+        other.capacity = 0;
+    }
+    return *this;
+}
@@ -0,0 +1,59 @@
+﻿#ifndef ALIGNED_BUFFER_POOL_H
+#define ALIGNED_BUFFER_POOL_H
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+// Pool of aligned I/O buffers for unbuffered (O_DIRECT / FILE_FLAG_NO_BUFFERING) transfers.
+// Sizes are rounded up to a power of two so released buffers are reused by later requests;
+// at most maxCachedBytes of idle buffers are kept.
+class AlignedBufferPool {
+public:
+
+    // Lease on a pooled buffer, returned to the pool when destroyed
+    class Buffer {
+    public:
+        Buffer() = default;
+        ~Buffer();
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        char* data() const { return ptr; }
+        size_t size() const { return capacity; }
+
+    private:
+        friend class AlignedBufferPool;
+        AlignedBufferPool* pool = nullptr;
+        char* ptr = nullptr;
+        size_t capacity = 0;
+
+        void reset();
+    };
+
+    AlignedBufferPool(size_t alignment, size_t maxCachedBytes);
+    ~AlignedBufferPool();
+
+    AlignedBufferPool(const AlignedBufferPool&) = delete;
+    AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+    Buffer acquire(size_t bytes);
+    size_t alignment() const { return align; }
+
+private:
+    size_t align;
+    size_t maxCached;
+    size_t cachedBytes = 0;
+
+    std::mutex poolMutex;
+    std::map<size_t, std::vector<char*>> idle; // capacity -> idle buffers
+
+    void release(char* ptr, size_t capacity);
+    static char* allocate(size_t alignment, size_t bytes);
+    static void deallocate(char* ptr);
+};
+
+#endif // ALIGNED_BUFFER_POOL_H
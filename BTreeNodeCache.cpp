@@ -0,0 +1,308 @@
+﻿#include "BTreeNodeCache.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Node with its own storage
+BTreeNode::BTreeNode(int btree_order, bool leaf)
+    : isLeaf(leaf), keyCount(0), keys(nullptr), children(nullptr), nextLeaf(-1), order(btree_order),
+    storage(slabInts(btree_order)) {
+    bind(storage.data());
+    reset(leaf);
+}
+
+// View over a cache slot
+BTreeNode::BTreeNode(int btree_order, int* slab)
+    : isLeaf(true), keyCount(0), keys(nullptr), children(nullptr), nextLeaf(-1), order(btree_order) {
+    bind(slab);
+}
+
+// Copies own their arrays
+BTreeNode::BTreeNode(const BTreeNode& other)
+    : isLeaf(other.isLeaf), keyCount(other.keyCount), keys(nullptr), children(nullptr),
+    nextLeaf(other.nextLeaf), order(other.order), storage(slabInts(other.order)) {
+    bind(storage.data());
+    std::copy(other.keys, other.keys + order - 1, keys);
+    std::copy(other.children, other.children + order, children);
+}
+
+// Copy the contents; a view keeps pointing at its slot
+BTreeNode& BTreeNode::operator=(const BTreeNode& other) {
+    if (this == &other) return *this;
+
+    if (order != other.order) {
+        if (storage.empty()) {
+            throw std::logic_error("BTreeNode: cannot assign a node of another order to a cached node");
+        }
+        order = other.order;
+        storage.assign(slabInts(order), 0);
+        bind(storage.data());
+    }
+
+    isLeaf = other.isLeaf;
+    keyCount = other.keyCount;
+    nextLeaf = other.nextLeaf;
+    std::copy(other.keys, other.keys + order - 1, keys);
+    std::copy(other.children, other.children + order, children);
+    return *this;
+}
+
+// Empty leaf or internal node
+void BTreeNode::reset(bool leaf) {
+    isLeaf = leaf;
+    keyCount = 0;
+    nextLeaf = -1;
+    std::fill(keys, keys + order - 1, -1);
+    std::fill(children, children + order, 0);
+}
+
+// Keys first, then children/values
+void BTreeNode::bind(int* slab) {
+    keys = slab;
+    children = slab + (order - 1);
+}
+
+// Constructor
+BTreeNodeCache::BTreeNodeCache(Loader loader, WriteBack writeBack)
+    : loader(std::move(loader)), writeBack(std::move(writeBack)) {
+}
+
+BTreeNodeCache::Ref::Ref(Ref&& other) noexcept
+    : cache(other.cache), slot(other.slot), nodeIndex(other.nodeIndex), node(other.node) {
+    other.cache = nullptr;
+    other.node = nullptr;
+}
+
+BTreeNodeCache::Ref& BTreeNodeCache::Ref::operator=(Ref&& other) noexcept {
+    if (this != &other) {
+        release();
+        cache = other.cache;
+        slot = other.slot;
+        nodeIndex = other.nodeIndex;
+        node = other.node;
+        other.cache = nullptr;
+        other.node = nullptr;
+    }
+    return *this;
+}
+
+// Unpin the slot
+void BTreeNodeCache::Ref::release() {
+    if (cache) cache->unpin(slot);
+    cache = nullptr;
+    node = nullptr;
+}
+
+// Lay out the slab
+void BTreeNodeCache::configure(int nodeOrder, size_t capacity, size_t indexLimit) {
+    for (const Slot& slot : slots) {
+        if (slot.pins > 0) throw std::logic_error("BTreeNodeCache: configure while nodes are pinned");
+    }
+
+    order = nodeOrder;
+    const size_t ints = BTreeNode::slabInts(order);
+
+    nodes.clear();
+    slab.clear();
+    slab.shrink_to_fit();
+    slab.assign(capacity * ints, 0);
+    nodes.reserve(capacity);
+    for (size_t slot = 0; slot < capacity; ++slot) {
+        nodes.emplace_back(order, slab.data() + slot * ints);
+    }
+
+    slots.assign(capacity, Slot{});
+    slotOf.assign(indexLimit, -1);
+    freeSlots.clear();
+    for (size_t slot = capacity; slot > 0; --slot) {
+        freeSlots.push_back(slot - 1);
+    }
+    hand = 0;
+    dirtyNodes = 0;
+}
+
+// Pin a node, reading it on a miss
+BTreeNodeCache::Ref BTreeNodeCache::get(int index) {
+    checkIndex(index);
+
+    int cached = slotOf[index];
+    if (cached != -1) {
+        hits++;
+        Slot& slot = slots[cached];
+        slot.pins++;
+        slot.referenced = true;
+        return Ref(this, static_cast<size_t>(cached), index, &nodes[cached]);
+    }
+
+    misses++;
+    size_t slot = claimSlot();
+    try {
+        loader(index, nodes[slot]);
+    }
+    catch (...) {
+        freeSlots.push_back(slot);
+        throw;
+    }
+
+    bindSlot(slot, index);
+    return Ref(this, slot, index, &nodes[slot]);
+}
+
+// Pin a fresh node without reading
+BTreeNodeCache::Ref BTreeNodeCache::create(int index, bool leaf) {
+    checkIndex(index);
+
+    int cached = slotOf[index];
+    size_t slot;
+    if (cached != -1) {
+        slot = static_cast<size_t>(cached);
+        slots[slot].pins++;
+        slots[slot].referenced = true;
+    }
+    else {
+        slot = claimSlot();
+        bindSlot(slot, index);
+    }
+
+    nodes[slot].reset(leaf);
+    return Ref(this, slot, index, &nodes[slot]);
+}
+
+// The node differs from disk
+void BTreeNodeCache::markDirty(const Ref& ref) {
+    Slot& slot = slots[ref.slot];
+    if (!slot.dirty) {
+        slot.dirty = true;
+        dirtyNodes++;
+    }
+}
+
+// The node matches disk
+void BTreeNodeCache::markClean(const Ref& ref) {
+    Slot& slot = slots[ref.slot];
+    if (slot.dirty) {
+        slot.dirty = false;
+        dirtyNodes--;
+    }
+}
+
+bool BTreeNodeCache::contains(int index) const {
+    return index >= 0 && static_cast<size_t>(index) < slotOf.size() && slotOf[index] != -1;
+}
+
+// Forget a freed node
+void BTreeNodeCache::discard(int index) {
+    if (!contains(index)) return;
+
+    size_t slot = static_cast<size_t>(slotOf[index]);
+    if (slots[slot].pins > 0) throw std::logic_error("BTreeNodeCache: discarding a pinned node");
+    if (slots[slot].dirty) dirtyNodes--;
+
+    slots[slot] = Slot{};
+    slotOf[index] = -1;
+    freeSlots.push_back(slot);
+}
+
+// Write back dirty nodes; a failure leaves the rest dirty
+void BTreeNodeCache::flush() {
+    if (dirtyNodes == 0) return;
+
+    std::vector<size_t> dirty;
+    for (size_t slot = 0; slot < slots.size(); ++slot) {
+        if (slots[slot].dirty) dirty.push_back(slot);
+    }
+    std::sort(dirty.begin(), dirty.end(), [&](size_t a, size_t b) { return slots[a].index < slots[b].index; });
+
+    for (size_t slot : dirty) {
+        writeBack(slots[slot].index, nodes[slot]);
+        slots[slot].dirty = false;
+        dirtyNodes--;
+        writeBacks++;
+    }
+}
+
+// Forget everything
+void BTreeNodeCache::clear() {
+    for (const Slot& slot : slots) {
+        if (slot.pins > 0) throw std::logic_error("BTreeNodeCache: clear while nodes are pinned");
+    }
+
+    std::fill(slots.begin(), slots.end(), Slot{});
+    std::fill(slotOf.begin(), slotOf.end(), -1);
+    freeSlots.clear();
+    for (size_t slot = slots.size(); slot > 0; --slot) {
+        freeSlots.push_back(slot - 1);
+    }
+    hand = 0;
+    dirtyNodes = 0;
+}
+
+BTreeNodeCache::Stats BTreeNodeCache::stats() const {
+    Stats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    s.writeBacks = writeBacks;
+    s.dirtyNodes = dirtyNodes;
+    s.capacityNodes = slots.size();
+    for (const Slot& slot : slots) {
+        if (slot.index != -1) s.cachedNodes++;
+        if (slot.pins > 0) s.pinnedNodes++;
+    }
+    return s;
+}
+
+// A free slot, or one taken from the CLOCK victim (written back first if dirty)
+size_t BTreeNodeCache::claimSlot() {
+    if (!freeSlots.empty()) {
+        size_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    // Two sweeps clear every reference bit; a third finding nothing means all are pinned
+    for (size_t step = 0; step < 3 * slots.size(); ++step) {
+        size_t slot = hand;
+        hand = (hand + 1) % slots.size();
+
+        Slot& victim = slots[slot];
+        if (victim.pins > 0) continue;
+        if (victim.referenced) {
+            victim.referenced = false;
+            continue;
+        }
+
+        if (victim.dirty) {
+            writeBack(victim.index, nodes[slot]);
+            victim.dirty = false;
+            dirtyNodes--;
+            writeBacks++;
+        }
+        slotOf[victim.index] = -1;
+        victim = Slot{};
+        evictions++;
+        return slot;
+    }
+
+    throw std::runtime_error("B-tree node cache exhausted: every node is pinned");
+}
+
+// Hand a claimed slot to a node, pinned once
+void BTreeNodeCache::bindSlot(size_t slot, int index) {
+    Slot& entry = slots[slot];
+    entry.index = index;
+    entry.pins = 1;
+    entry.dirty = false;
+    entry.referenced = true;
+    slotOf[index] = static_cast<int>(slot);
+}
+
+void BTreeNodeCache::unpin(size_t slot) {
+    if (slot < slots.size() && slots[slot].pins > 0) slots[slot].pins--;
+}
+
+void BTreeNodeCache::checkIndex(int index) const {
+    if (index < 0 || static_cast<size_t>(index) >= slotOf.size()) {
+        throw std::out_of_range("Invalid B-tree node index");
+    }
+}
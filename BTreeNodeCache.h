@@ -0,0 +1,154 @@
+﻿#ifndef BTREE_NODE_CACHE_H
+#define BTREE_NODE_CACHE_H
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// One node of the free-extent B-tree. keys holds order - 1 entries and children
+// (values in a leaf) order; both point either into the node's own storage or,
+// for nodes held by BTreeNodeCache, into the cache's slab.
+struct BTreeNode {
+    bool isLeaf;
+    int keyCount;
+    int* keys;
+    union {
+        int* children;
+        int* values;
+    };
+    int nextLeaf;
+    int order; //We need to store btreeOrder in each node
+
+    explicit BTreeNode(int btree_order = 4, bool leaf = true);
+    BTreeNode(int btree_order, int* slab);          // view over slabInts(order) ints owned elsewhere
+    BTreeNode(const BTreeNode& other);              // always owns its copy
+    BTreeNode& operator=(const BTreeNode& other);   // copies contents; a view stays a view
+
+    void reset(bool leaf);  // empty node of the same order
+    static size_t slabInts(int order) { return 2 * static_cast<size_t>(order) - 1; }
+
+private:
+    std::vector<int> storage;  // empty for views
+    void bind(int* slab);
+};
+
+// Fixed-capacity cache of B-tree nodes:
+//  - nodes sit inline in one slab, so loading a node allocates nothing and callers
+//    work on the cached node itself instead of a copy
+//  - get() and create() return a Ref that pins the slot until it is released or
+//    goes out of scope; pinned slots are never evicted
+//  - CLOCK replacement: a hit sets the slot's reference bit and the hand clears bits
+//    until it meets an unpinned, unreferenced slot; a dirty victim is written back first
+// There is no internal lock: MiniHSFS holds fsMutex around every B-tree operation.
+class BTreeNodeCache {
+public:
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t writeBacks = 0;
+        size_t cachedNodes = 0;
+        size_t dirtyNodes = 0;
+        size_t pinnedNodes = 0;
+        size_t capacityNodes = 0;
+    };
+
+    // Fills a node from disk / persists one; both throw on failure
+    using Loader = std::function<void(int index, BTreeNode& node)>;
+    using WriteBack = std::function<void(int index, const BTreeNode& node)>;
+
+    class Ref {
+    public:
+        Ref() = default;
+        Ref(Ref&& other) noexcept;
+        Ref& operator=(Ref&& other) noexcept;
+        ~Ref() { release(); }
+
+        Ref(const Ref&) = delete;
+        Ref& operator=(const Ref&) = delete;
+
+        BTreeNode* operator->() const { return node; }
+        BTreeNode& operator*() const { return *node; }
+        int index() const { return nodeIndex; }
+        explicit operator bool() const { return node != nullptr; }
+
+        void release();  // unpin early
+
+    private:
+        friend class BTreeNodeCache;
+        Ref(BTreeNodeCache* cache, size_t slot, int nodeIndex, BTreeNode* node)
+            : cache(cache), slot(slot), nodeIndex(nodeIndex), node(node) {}
+
+        BTreeNodeCache* cache = nullptr;
+        size_t slot = 0;
+        int nodeIndex = -1;
+        BTreeNode* node = nullptr;
+    };
+
+    BTreeNodeCache(Loader loader, WriteBack writeBack);
+    ~BTreeNodeCache() = default;
+
+    BTreeNodeCache(const BTreeNodeCache&) = delete;
+    BTreeNodeCache& operator=(const BTreeNodeCache&) = delete;
+
+    // Lay out capacity slots for nodes of one order with indexes below indexLimit.
+    // Everything cached is dropped without writing; nothing may be pinned.
+    void configure(int order, size_t capacity, size_t indexLimit);
+    size_t capacityNodes() const { return slots.size(); }
+
+    // Pinned node; read through the loader on a miss
+    Ref get(int index);
+
+    // Pinned empty node for an index that is not in use on disk; nothing is read
+    Ref create(int index, bool leaf);
+
+    void markDirty(const Ref& ref);
+    void markClean(const Ref& ref);   // the node was just written through
+    bool contains(int index) const;
+
+    // Drop a node without writing it back (it was freed); it must not be pinned
+    void discard(int index);
+
+    // Write back every dirty node, in index order
+    void flush();
+
+    // Drop everything without writing it back (the layout changed); nothing may be pinned
+    void clear();
+
+    size_t dirtyCount() const { return dirtyNodes; }
+    Stats stats() const;
+
+private:
+    struct Slot {
+        int index = -1;       // node held, -1 if the slot is free
+        int pins = 0;
+        bool dirty = false;
+        bool referenced = false;
+    };
+
+    Loader loader;
+    WriteBack writeBack;
+
+    int order = 0;
+    std::vector<int> slab;            // capacity * BTreeNode::slabInts(order) ints
+    std::vector<BTreeNode> nodes;     // one view per slot
+    std::vector<Slot> slots;
+    std::vector<int> slotOf;          // node index -> slot, -1 if not cached
+    std::vector<size_t> freeSlots;
+    size_t hand = 0;
+    size_t dirtyNodes = 0;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t writeBacks = 0;
+
+    size_t claimSlot();
+    void bindSlot(size_t slot, int index);
+    void unpin(size_t slot);
+    void checkIndex(int index) const;
+};
+
+#endif // BTREE_NODE_CACHE_H
@@ -0,0 +1,304 @@
+﻿#include "BlockBitmap.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__AVX2__) || defined(__BMI__)
+#include <immintrin.h>
+#endif
+
+namespace {
+    constexpr uint64_t allUsed = ~0ULL;
+
+    // Index of the lowest set bit (x != 0)
+    inline unsigned countTrailingZeros(uint64_t x) {
+#if defined(__BMI__)
+        return static_cast<unsigned>(_tzcnt_u64(x));
+#elif defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, x);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctzll(x));
+#endif
+    }
+
+    inline unsigned popCount(uint64_t x) {
+#if defined(_MSC_VER)
+        return static_cast<unsigned>(__popcnt64(x));
+#else
+        return static_cast<unsigned>(__builtin_popcountll(x));
+#endif
+    }
+
+    // Bits [lo, hi) of a word, hi <= 64
+    inline uint64_t rangeMask(unsigned lo, unsigned hi) {
+        uint64_t upper = (hi == 64) ? allUsed : ((1ULL << hi) - 1);
+        return upper & (allUsed << lo);
+    }
+}
+
+// Resize and fill every block with one state
+void BlockBitmap::assign(size_t bits, bool used) {
+    bitCount = bits;
+    words.assign((bits + 63) / 64, used ? allUsed : 0);
+    if (bits & 63) {
+        words.back() |= allUsed << (bits & 63);
+    }
+    freeBits = used ? 0 : bits;
+    resizeDirty();
+}
+
+// Extend to bits blocks; the added blocks start free
+void BlockBitmap::grow(size_t bits) {
+    if (bits <= bitCount) return;
+
+    const size_t oldBits = bitCount;
+    words.resize((bits + 63) / 64, 0);
+    if (oldBits & 63) {
+        // The old tail padding now covers real blocks
+        words[oldBits >> 6] &= ~(allUsed << (oldBits & 63));
+    }
+    if (bits & 63) {
+        words.back() |= allUsed << (bits & 63);
+    }
+    bitCount = bits;
+    freeBits += bits - oldBits;
+
+    size_t chunks = chunkSize ? (byteSize() + chunkSize - 1) / chunkSize : 1;
+    if (chunks > dirty.size()) dirty.resize(chunks, 0);
+    markDirty(oldBits, bits);
+}
+
+// Mark one block
+void BlockBitmap::set(size_t index, bool used) {
+    if (index >= bitCount) return;
+
+    uint64_t& word = words[index >> 6];
+    uint64_t bit = 1ULL << (index & 63);
+    if (((word & bit) != 0) == used) return;
+
+    if (used) {
+        word |= bit;
+        freeBits--;
+    }
+    else {
+        word &= ~bit;
+        freeBits++;
+    }
+    markDirty(index, index + 1);
+}
+
+// Mark a run of blocks, a word at a time
+void BlockBitmap::setRange(size_t start, size_t count, bool used) {
+    if (start >= bitCount || count == 0) return;
+    size_t end = (std::min)(bitCount, start + count);
+    markDirty(start, end);
+
+    for (size_t w = start >> 6; w <= (end - 1) >> 6; ++w) {
+        size_t wordStart = w << 6;
+        unsigned lo = static_cast<unsigned>((std::max)(start, wordStart) - wordStart);
+        unsigned hi = static_cast<unsigned>((std::min)(end, wordStart + 64) - wordStart);
+        uint64_t mask = rangeMask(lo, hi);
+
+        unsigned before = popCount(words[w] & mask);
+        if (used) {
+            words[w] |= mask;
+            freeBits -= (hi - lo) - before;
+        }
+        else {
+            words[w] &= ~mask;
+            freeBits += before;
+        }
+    }
+}
+
+// First free block at or after from
+size_t BlockBitmap::nextFree(size_t from) const {
+    if (from >= bitCount) return npos;
+
+    size_t w = from >> 6;
+    const size_t n = words.size();
+    uint64_t bits = ~words[w] & (allUsed << (from & 63));
+
+    while (!bits) {
+        ++w;
+#if defined(__AVX2__)
+        // Skip four fully used words per step
+        const __m256i full = _mm256_set1_epi64x(-1);
+        while (w + 4 <= n) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&words[w]));
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(v, full)) != -1) break;
+            w += 4;
+        }
+#endif
+        if (w >= n) return npos;
+        bits = ~words[w];
+    }
+
+    size_t index = (w << 6) + countTrailingZeros(bits);
+    return index < bitCount ? index : npos;
+}
+
+// First used block in [from, limit), or limit
+size_t BlockBitmap::nextUsed(size_t from, size_t limit) const {
+    limit = (std::min)(limit, bitCount);
+    if (from >= limit) return limit;
+
+    size_t w = from >> 6;
+    const size_t lastWord = (limit - 1) >> 6;
+    uint64_t bits = words[w] & (allUsed << (from & 63));
+
+    while (!bits) {
+        ++w;
+#if defined(__AVX2__)
+        // Skip four fully free words per step
+        while (w + 4 <= lastWord + 1) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&words[w]));
+            if (!_mm256_testz_si256(v, v)) break;
+            w += 4;
+        }
+#endif
+        if (w > lastWord) return limit;
+        bits = words[w];
+    }
+
+    return (std::min)(limit, (w << 6) + countTrailingZeros(bits));
+}
+
+// First-fit search for count consecutive free blocks
+size_t BlockBitmap::findFreeRun(size_t count, size_t from) const {
+    if (count == 0 || count > freeBits) return npos;
+
+    size_t index = from;
+    while (true) {
+        size_t start = nextFree(index);
+        if (start == npos || bitCount - start < count) return npos;
+
+        size_t end = nextUsed(start, start + count);
+        if (end - start >= count) return start;
+        index = end;
+    }
+}
+
+// Serialize to the on-disk byte layout
+void BlockBitmap::toBytes(char* out) const {
+    toBytes(out, 0, byteSize());
+}
+
+// Serialize part of the on-disk image; bytes past the end of the bitmap are zero
+void BlockBitmap::toBytes(char* out, size_t byteOffset, size_t length) const {
+    size_t bytes = byteSize();
+    size_t available = byteOffset < bytes ? (std::min)(length, bytes - byteOffset) : 0;
+    std::memset(out + available, 0, length - available);
+    if (available == 0) return;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < available; ++i) {
+        size_t b = byteOffset + i;
+        out[i] = static_cast<char>(words[b >> 3] >> ((b & 7) * 8));
+    }
+#else
+    // Little-endian words already have the on-disk layout
+    std::memcpy(out, reinterpret_cast<const char*>(words.data()) + byteOffset, available);
+#endif
+
+    // Bits past the end are stored as zero
+    if ((bitCount & 7) && byteOffset + available == bytes) {
+        out[available - 1] &= static_cast<char>((1u << (bitCount & 7)) - 1);
+    }
+}
+
+// Load from the on-disk byte layout (size() is kept)
+void BlockBitmap::fromBytes(const char* in, size_t bytes) {
+    std::fill(words.begin(), words.end(), 0);
+    bytes = (std::min)(bytes, byteSize());
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < bytes; ++i) {
+        words[i >> 3] |= static_cast<uint64_t>(static_cast<uint8_t>(in[i])) << ((i & 7) * 8);
+    }
+#else
+    std::memcpy(words.data(), in, bytes);
+#endif
+
+    recount();
+    clearDirty();
+}
+
+// Expanded copy for callers that want one bool per block
+std::vector<bool> BlockBitmap::toVector() const {
+    std::vector<bool> result(bitCount);
+    for (size_t i = 0; i < bitCount; ++i) {
+        result[i] = test(i);
+    }
+    return result;
+}
+
+// Restore the tail padding and recompute the free count
+void BlockBitmap::recount() {
+    if (bitCount & 63) {
+        words.back() |= allUsed << (bitCount & 63);
+    }
+
+    size_t used = 0;
+    for (uint64_t word : words) {
+        used += popCount(word);
+    }
+    used -= words.size() * 64 - bitCount;
+    freeBits = bitCount - used;
+}
+
+// Set the dirty-tracking granularity
+void BlockBitmap::setChunkSize(size_t chunkBytes) {
+    chunkSize = chunkBytes;
+    resizeDirty();
+}
+
+// One flag per chunk, all dirty
+void BlockBitmap::resizeDirty() {
+    size_t chunks = chunkSize ? (byteSize() + chunkSize - 1) / chunkSize : 1;
+    dirty.assign(chunks, 1);
+    dirtyChunks = chunks;
+}
+
+// Everything must be written again
+void BlockBitmap::markAllDirty() {
+    std::fill(dirty.begin(), dirty.end(), 1);
+    dirtyChunks = dirty.size();
+}
+
+// Everything is on disk
+void BlockBitmap::clearDirty() {
+    std::fill(dirty.begin(), dirty.end(), 0);
+    dirtyChunks = 0;
+}
+
+// A run of chunks is on disk
+void BlockBitmap::clearDirty(size_t firstChunk, size_t count) {
+    size_t end = (std::min)(dirty.size(), firstChunk + count);
+    for (size_t c = firstChunk; c < end; ++c) {
+        if (dirty[c]) {
+            dirty[c] = 0;
+            dirtyChunks--;
+        }
+    }
+}
+
+// Flag the chunks holding bits [firstBit, endBit)
+void BlockBitmap::markDirty(size_t firstBit, size_t endBit) {
+    if (dirty.empty() || firstBit >= endBit) return;
+
+    size_t chunkBits = chunkSize ? chunkSize * 8 : bitCount;
+    size_t first = firstBit / chunkBits;
+    size_t last = (std::min)((endBit - 1) / chunkBits, dirty.size() - 1);
+    for (size_t c = first; c <= last; ++c) {
+        if (!dirty[c]) {
+            dirty[c] = 1;
+            dirtyChunks++;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+﻿#ifndef BLOCK_BITMAP_H
+#define BLOCK_BITMAP_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Free-space bitmap packed into 64-bit words (bit set = block in use).
+// The free count is maintained on every change, and free-run searches
+// skip whole words at a time (four per step with AVX2).
+// Bits past size() are kept set so searches never return them.
+// Changes are tracked per chunk of on-disk bytes so saves can skip clean chunks.
+class BlockBitmap {
+public:
+    static constexpr size_t npos = SIZE_MAX;
+
+    void assign(size_t bits, bool used);
+    void grow(size_t bits);  // keeps existing state; new blocks are free and dirty
+    size_t size() const { return bitCount; }
+
+    bool test(size_t index) const { return (words[index >> 6] >> (index & 63)) & 1; }
+    bool operator[](size_t index) const { return test(index); }
+
+    void set(size_t index, bool used);
+    void setRange(size_t start, size_t count, bool used);
+
+    size_t freeCount() const { return freeBits; }
+    size_t usedCount() const { return bitCount - freeBits; }
+
+    // First free run of at least count blocks starting at or after from; npos if none
+    size_t findFreeRun(size_t count, size_t from = 0) const;
+
+    // First clear bit at or after from (npos if none); first set bit in [from, limit) or limit
+    size_t nextFree(size_t from) const;
+    size_t nextUsed(size_t from, size_t limit) const;
+
+    // On-disk format: bit i is bit (i % 8) of byte (i / 8)
+    size_t byteSize() const { return (bitCount + 7) / 8; }
+    void toBytes(char* out) const;
+    void toBytes(char* out, size_t byteOffset, size_t length) const;
+    void fromBytes(const char* in, size_t bytes);
+
+    // Dirty tracking; chunkBytes is normally the disk block size (everything starts dirty)
+    void setChunkSize(size_t chunkBytes);
+    size_t chunkBytes() const { return chunkSize; }
+    size_t chunkCount() const { return dirty.size(); }
+    bool isDirty(size_t chunk) const { return dirty[chunk] != 0; }
+    bool anyDirty() const { return dirtyChunks > 0; }
+    void markAllDirty();
+    void clearDirty();
+    void clearDirty(size_t firstChunk, size_t count);
+
+    std::vector<bool> toVector() const;
+
+private:
+    std::vector<uint64_t> words;
+    size_t bitCount = 0;
+    size_t freeBits = 0;
+
+    size_t chunkSize = 0;          // bytes per dirty chunk, 0 = whole bitmap
+    std::vector<uint8_t> dirty;
+    size_t dirtyChunks = 0;
+
+    void recount();
+    void resizeDirty();
+    void markDirty(size_t firstBit, size_t endBit);
+};
+
+#endif // BLOCK_BITMAP_H
@@ -0,0 +1,308 @@
+﻿#include "BlockCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Constructor
+BlockCache::BlockCache(uint32_t blockSize, size_t budgetBytes, WriteBack writeBack)
+    : blockSize(blockSize), writeBack(std::move(writeBack)) {
+    allocate_nl(budgetBytes);
+}
+
+// Resize the cache (pins are dropped, dirty data is written back first)
+void BlockCache::setBudget(size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    std::vector<uint64_t> cached;
+    cached.reserve(entries.size());
+    for (auto& kv : entries) cached.push_back(kv.first);
+    std::sort(cached.begin(), cached.end());
+    for (uint64_t block : cached) {
+        Entry& entry = entries.at(block);
+        if (entry.dirty) writeBack_nl(block, entry);
+    }
+
+    entries.clear();
+    inQueue.clear();
+    mainQueue.clear();
+    ghostQueue.clear();
+    ghostIndex.clear();
+    allocate_nl(budgetBytes);
+}
+
+// Size the slot arena for the budget
+void BlockCache::allocate_nl(size_t budgetBytes) {
+    capacity = blockSize ? budgetBytes / blockSize : 0;
+    inCapacity = (std::max<size_t>)(1, capacity / 4);
+    ghostCapacity = (std::max<size_t>)(1, capacity / 2);
+
+    arena.clear();
+    arena.shrink_to_fit();
+    arena.resize(capacity * blockSize);
+
+    freeSlots.clear();
+    freeSlots.reserve(capacity);
+    for (size_t slot = capacity; slot > 0; --slot) {
+        freeSlots.push_back(slot - 1);
+    }
+}
+
+// Copy a cached block out
+bool BlockCache::lookup(uint64_t block, char* out) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    auto it = entries.find(block);
+    if (it == entries.end()) {
+        misses++;
+        return false;
+    }
+
+    hits++;
+    Entry& entry = it->second;
+    std::memcpy(out, slotData(entry.slot), blockSize);
+    if (entry.prefetched) {
+        entry.prefetched = false;
+        prefetchHits++;
+    }
+
+    // 2Q: hits in A1in do not reorder; hits in Am move to the front
+    if (entry.queue == Queue::Main) {
+        mainQueue.splice(mainQueue.begin(), mainQueue, entry.position);
+    }
+    return true;
+}
+
+// Store or refresh a block
+bool BlockCache::update(uint64_t block, const char* data, bool dirty, bool insertIfAbsent) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    auto it = entries.find(block);
+    if (it != entries.end()) {
+        // New contents supersede whatever was cached, dirty or not
+        Entry& entry = it->second;
+        std::memcpy(slotData(entry.slot), data, blockSize);
+        entry.dirty = dirty;
+        entry.prefetched = false;
+        if (entry.queue == Queue::Main) {
+            mainQueue.splice(mainQueue.begin(), mainQueue, entry.position);
+        }
+        return true;
+    }
+
+    if (!insertIfAbsent) return true;
+    if (capacity == 0) return false;
+    if (freeSlots.empty() && !reclaim_nl()) return false;
+
+    insert_nl(block, data, dirty, true);
+    return true;
+}
+
+// Read-ahead insert; never replaces an entry and never evicts from the main LRU
+bool BlockCache::prefetch(uint64_t block, const char* data) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    if (capacity == 0 || entries.count(block)) return false;
+    if (freeSlots.empty() && !evictFrom_nl(inQueue, true)) return false;
+
+    insert_nl(block, data, false, false).prefetched = true;
+    prefetched++;
+    return true;
+}
+
+// Is the block cached
+bool BlockCache::contains(uint64_t block) const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return entries.count(block) != 0;
+}
+
+// Prefetched blocks evicted unread so far
+uint64_t BlockCache::prefetchWasted() const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return wasted;
+}
+
+// Place a block in a free slot (one must be available)
+BlockCache::Entry& BlockCache::insert_nl(uint64_t block, const char* data, bool dirty, bool promoteGhost) {
+    size_t slot = freeSlots.back();
+    freeSlots.pop_back();
+    std::memcpy(slotData(slot), data, blockSize);
+
+    Entry entry;
+    entry.slot = slot;
+    entry.dirty = dirty;
+    entry.pins = 0;
+    entry.prefetched = false;
+
+    // Seen recently (still remembered in A1out) -> straight into the main LRU
+    auto ghost = ghostIndex.find(block);
+    if (promoteGhost && ghost != ghostIndex.end()) {
+        ghostQueue.erase(ghost->second);
+        ghostIndex.erase(ghost);
+        mainQueue.push_front(block);
+        entry.queue = Queue::Main;
+        entry.position = mainQueue.begin();
+    }
+    else {
+        if (ghost != ghostIndex.end()) {
+            ghostQueue.erase(ghost->second);
+            ghostIndex.erase(ghost);
+        }
+        inQueue.push_front(block);
+        entry.queue = Queue::In;
+        entry.position = inQueue.begin();
+    }
+
+    return entries.emplace(block, entry).first->second;
+}
+
+// Pin a cached block
+bool BlockCache::pin(uint64_t block) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = entries.find(block);
+    if (it == entries.end()) return false;
+    it->second.pins++;
+    return true;
+}
+
+// Unpin a cached block
+void BlockCache::unpin(uint64_t block) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = entries.find(block);
+    if (it != entries.end() && it->second.pins > 0) {
+        it->second.pins--;
+    }
+}
+
+// Drop a range without writing it back
+void BlockCache::invalidate(uint64_t start, uint64_t count) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    if (count > entries.size()) {
+        std::vector<uint64_t> victims;
+        for (auto& kv : entries) {
+            if (kv.first >= start && kv.first - start < count) victims.push_back(kv.first);
+        }
+        for (uint64_t block : victims) remove_nl(block);
+    }
+    else {
+        for (uint64_t block = start; block < start + count; ++block) {
+            if (entries.count(block)) remove_nl(block);
+        }
+    }
+}
+
+// Write back every dirty block in block order
+bool BlockCache::flush() {
+    return flushRange(0, UINT64_MAX);
+}
+
+// Write back dirty blocks within [start, start + count)
+bool BlockCache::flushRange(uint64_t start, uint64_t count) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    std::vector<uint64_t> dirtyBlocks;
+    for (auto& kv : entries) {
+        if (kv.second.dirty && kv.first >= start && kv.first - start < count) {
+            dirtyBlocks.push_back(kv.first);
+        }
+    }
+    std::sort(dirtyBlocks.begin(), dirtyBlocks.end());
+
+    bool ok = true;
+    for (uint64_t block : dirtyBlocks) {
+        ok = writeBack_nl(block, entries.at(block)) && ok;
+    }
+    return ok;
+}
+
+// Write back and drop everything
+void BlockCache::clear() {
+    flush();
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    entries.clear();
+    inQueue.clear();
+    mainQueue.clear();
+    ghostQueue.clear();
+    ghostIndex.clear();
+
+    freeSlots.clear();
+    for (size_t slot = capacity; slot > 0; --slot) {
+        freeSlots.push_back(slot - 1);
+    }
+}
+
+// Snapshot of the counters
+BlockCache::Stats BlockCache::stats() const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    Stats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    s.writeBacks = writeBacks;
+    s.prefetched = prefetched;
+    s.prefetchHits = prefetchHits;
+    s.prefetchWasted = wasted;
+    s.cachedBlocks = entries.size();
+    s.capacityBlocks = capacity;
+    for (const auto& kv : entries) {
+        if (kv.second.dirty) s.dirtyBlocks++;
+        if (kv.second.pins > 0) s.pinnedBlocks++;
+    }
+    return s;
+}
+
+// Free one slot: A1in first while it is over its share, otherwise Am
+bool BlockCache::reclaim_nl() {
+    if (inQueue.size() > inCapacity && evictFrom_nl(inQueue, true)) return true;
+    if (evictFrom_nl(mainQueue, false)) return true;
+    return evictFrom_nl(inQueue, true);
+}
+
+// Evict the oldest unpinned block of a queue
+bool BlockCache::evictFrom_nl(std::list<uint64_t>& queue, bool remember) {
+    for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+        uint64_t block = *it;
+        Entry& entry = entries.at(block);
+        if (entry.pins > 0) continue;
+        if (entry.dirty && !writeBack_nl(block, entry)) continue;
+        if (entry.prefetched) wasted++;
+
+        remove_nl(block);
+        if (remember) rememberGhost_nl(block);
+        evictions++;
+        return true;
+    }
+    return false;
+}
+
+// Remove an entry and release its slot
+void BlockCache::remove_nl(uint64_t block) {
+    auto it = entries.find(block);
+    if (it == entries.end()) return;
+
+    Entry& entry = it->second;
+    (entry.queue == Queue::In ? inQueue : mainQueue).erase(entry.position);
+    freeSlots.push_back(entry.slot);
+    entries.erase(it);
+}
+
+// Remember an evicted A1in block by key only
+void BlockCache::rememberGhost_nl(uint64_t block) {
+    ghostQueue.push_front(block);
+    ghostIndex[block] = ghostQueue.begin();
+
+    while (ghostQueue.size() > ghostCapacity) {
+        ghostIndex.erase(ghostQueue.back());
+        ghostQueue.pop_back();
+    }
+}
+
+// Persist a dirty block (runs under the cache mutex so readers never see a gap)
+bool BlockCache::writeBack_nl(uint64_t block, Entry& entry) {
+    if (!writeBack || !writeBack(block, slotData(entry.slot))) return false;
+    entry.dirty = false;
+    writeBacks++;
+    return true;
+}
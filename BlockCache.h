@@ -0,0 +1,126 @@
+﻿#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Shared block buffer cache with 2Q replacement:
+//  - first-touch blocks enter a small FIFO (A1in) and leave it quickly, so a
+//    large scan cannot push hot blocks out
+//  - blocks evicted from A1in are remembered (keys only) in A1out; a second
+//    touch while remembered promotes the block into the main LRU (Am)
+// Dirty blocks are written back through a callback when evicted or flushed.
+// Read-ahead inserts through prefetch(): such blocks only ever displace A1in
+// entries and do not count as a reference until they are actually read.
+class BlockCache {
+public:
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t writeBacks = 0;
+        uint64_t prefetched = 0;       // blocks inserted by read-ahead
+        uint64_t prefetchHits = 0;     // ...later read
+        uint64_t prefetchWasted = 0;   // ...evicted before anyone read them
+        size_t cachedBlocks = 0;
+        size_t dirtyBlocks = 0;
+        size_t pinnedBlocks = 0;
+        size_t capacityBlocks = 0;
+    };
+
+    // Persists one block; returns false if the write failed
+    using WriteBack = std::function<bool(uint64_t block, const char* data)>;
+
+    BlockCache(uint32_t blockSize, size_t budgetBytes, WriteBack writeBack);
+    ~BlockCache() = default;
+
+    BlockCache(const BlockCache&) = delete;
+    BlockCache& operator=(const BlockCache&) = delete;
+
+    // Resize the cache; dirty blocks are written back first
+    void setBudget(size_t budgetBytes);
+    size_t capacityBlocks() const { return capacity; }
+
+    // Copy a cached block into out; counts a hit or a miss
+    bool lookup(uint64_t block, char* out);
+
+    // Store block contents. insertIfAbsent=false only refreshes an existing entry.
+    // Returns false when the block could not be cached (everything pinned).
+    bool update(uint64_t block, const char* data, bool dirty, bool insertIfAbsent = true);
+
+    // Read-ahead: insert clean contents only if the block is absent and a probation
+    // (A1in) slot can be had. Returns false when nothing was inserted.
+    bool prefetch(uint64_t block, const char* data);
+    bool contains(uint64_t block) const;
+    uint64_t prefetchWasted() const;
+
+    // Pinned blocks are never evicted
+    bool pin(uint64_t block);
+    void unpin(uint64_t block);
+
+    // Drop cached blocks without writing them back (e.g. after the blocks are freed)
+    void invalidate(uint64_t start, uint64_t count);
+
+    // Write back dirty blocks (all, or those within a range)
+    bool flush();
+    bool flushRange(uint64_t start, uint64_t count);
+
+    // Write back and drop everything
+    void clear();
+
+    Stats stats() const;
+
+private:
+    enum class Queue { In, Main };
+
+    struct Entry {
+        size_t slot;
+        bool dirty;
+        int pins;
+        bool prefetched;   // inserted by read-ahead and not read since
+        Queue queue;
+        std::list<uint64_t>::iterator position;
+    };
+
+    uint32_t blockSize;
+    size_t capacity = 0;       // blocks
+    size_t inCapacity = 0;     // A1in target size
+    size_t ghostCapacity = 0;  // A1out size
+
+    std::vector<char> arena;           // capacity * blockSize bytes
+    std::vector<size_t> freeSlots;
+
+    std::unordered_map<uint64_t, Entry> entries;
+    std::list<uint64_t> inQueue;       // A1in, front = newest
+    std::list<uint64_t> mainQueue;     // Am, front = most recent
+    std::list<uint64_t> ghostQueue;    // A1out, front = newest
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> ghostIndex;
+
+    WriteBack writeBack;
+    mutable std::mutex cacheMutex;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t writeBacks = 0;
+    uint64_t prefetched = 0;
+    uint64_t prefetchHits = 0;
+    uint64_t wasted = 0;
+
+    void allocate_nl(size_t budgetBytes);
+    bool reclaim_nl();
+    Entry& insert_nl(uint64_t block, const char* data, bool dirty, bool promoteGhost);
+    bool evictFrom_nl(std::list<uint64_t>& queue, bool remember);
+    void remove_nl(uint64_t block);
+    void rememberGhost_nl(uint64_t block);
+    bool writeBack_nl(uint64_t block, Entry& entry);
+    char* slotData(size_t slot) { return arena.data() + slot * blockSize; }
+};
+
+#endif // BLOCK_CACHE_H
@@ -413,7 +413,7 @@ void Cloud::setupRoutes(httplib::Server& svr, Parser& parse, MiniHSFS& mini, Tok
             size_t length = end - start + 1;
 
             // قراءة الجزء المطلوب من الملف
-            std::vector<char> data = parse.readFile(path, mini, start, length, run::Password);
+            std::vector<char> data = parse.readFileRange(path, mini, start, length, run::Password);
 
             if (req.has_header("Range")) {
                 res.status = 206;
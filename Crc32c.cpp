@@ -0,0 +1,142 @@
+﻿#include "Crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <nmmintrin.h>
+#else
+#include <nmmintrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+#if defined(CRC32C_X86) && !defined(_MSC_VER)
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#else
+#define CRC32C_TARGET
+#endif
+
+namespace {
+    constexpr uint32_t polynomial = 0x82F63B78; // reflected Castagnoli
+
+    // table[k][b]: CRC of byte b followed by k zero bytes
+    struct SlicingTables {
+        uint32_t table[8][256];
+
+        SlicingTables() {
+            for (uint32_t b = 0; b < 256; ++b) {
+                uint32_t crc = b;
+                for (int bit = 0; bit < 8; ++bit) {
+                    crc = (crc >> 1) ^ (polynomial & (0u - (crc & 1)));
+                }
+                table[0][b] = crc;
+            }
+            for (uint32_t b = 0; b < 256; ++b) {
+                for (int k = 1; k < 8; ++k) {
+                    table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+                }
+            }
+        }
+    };
+
+    const SlicingTables& tables() {
+        static const SlicingTables instance;
+        return instance;
+    }
+
+    bool detectHardware() {
+#if defined(CRC32C_X86)
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#else
+        return __builtin_cpu_supports("sse4.2");
+#endif
+#elif defined(CRC32C_ARM)
+        return true;
+#else
+        return false;
+#endif
+    }
+}
+
+// Checksum with the fastest implementation this CPU supports
+uint32_t Crc32c::compute(const void* data, size_t length, uint32_t crc) {
+    static const bool hardware = detectHardware();
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    if (data == nullptr || length == 0) return crc;
+    return hardware ? computeHardware(bytes, length, crc) : computeSoftware(bytes, length, crc);
+}
+
+// Whether compute() uses a CRC instruction
+bool Crc32c::hardwareAccelerated() {
+    static const bool hardware = detectHardware();
+    return hardware;
+}
+
+// Slicing-by-8: eight table lookups per 64-bit word
+uint32_t Crc32c::computeSoftware(const uint8_t* data, size_t length, uint32_t crc) {
+    const auto& t = tables().table;
+    crc = ~crc;
+
+    while (length >= 8) {
+        uint32_t low;
+        uint32_t high;
+        std::memcpy(&low, data, 4);
+        std::memcpy(&high, data + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        low = __builtin_bswap32(low);
+        high = __builtin_bswap32(high);
+#endif
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+            t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        data += 8;
+        length -= 8;
+    }
+
+    while (length--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    }
+    return ~crc;
+}
+
+// crc32 instruction, eight bytes per step
+CRC32C_TARGET uint32_t Crc32c::computeHardware(const uint8_t* data, size_t length, uint32_t crc) {
+#if defined(CRC32C_X86)
+    uint64_t state = ~crc;
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        state = _mm_crc32_u64(state, word);
+        data += 8;
+        length -= 8;
+    }
+    uint32_t tail = static_cast<uint32_t>(state);
+    while (length--) {
+        tail = _mm_crc32_u8(tail, *data++);
+    }
+    return ~tail;
+#elif defined(CRC32C_ARM)
+    uint32_t state = ~crc;
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        state = __crc32cd(state, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        state = __crc32cb(state, *data++);
+    }
+    return ~state;
+#else
+    return computeSoftware(data, length, crc);
+#endif
+}
@@ -0,0 +1,21 @@
+﻿#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstdint>
+#include <cstddef>
+
+// CRC32C (Castagnoli polynomial, the iSCSI/ext4 checksum). Uses the SSE4.2 crc32 instruction
+// (or the ARMv8 CRC extension) when the CPU has it, otherwise a slicing-by-8 table walk.
+class Crc32c {
+public:
+    // Checksum of length bytes; pass a previous result as crc to continue it over more data
+    static uint32_t compute(const void* data, size_t length, uint32_t crc = 0);
+
+    static bool hardwareAccelerated();
+
+private:
+    static uint32_t computeSoftware(const uint8_t* data, size_t length, uint32_t crc);
+    static uint32_t computeHardware(const uint8_t* data, size_t length, uint32_t crc);
+};
+
+#endif // CRC32C_H
@@ -0,0 +1,215 @@
+﻿#include "FreeExtentIndex.h"
+
+#include <algorithm>
+
+// Constructor
+FreeExtentIndex::FreeExtentIndex() : seed(0x9E3779B9u) {
+}
+
+// Rebuild from the bitmap's free runs
+void FreeExtentIndex::rebuild(const BlockBitmap& bitmap, uint64_t from) {
+    clear();
+    base = from;
+
+    size_t position = static_cast<size_t>(from);
+    while (true) {
+        size_t start = bitmap.nextFree(position);
+        if (start == BlockBitmap::npos) break;
+
+        size_t end = bitmap.nextUsed(start, bitmap.size());
+        insertRun(start, end - start);
+        position = end;
+    }
+}
+
+// Drop every run
+void FreeExtentIndex::clear() {
+    nodes.clear();
+    spareNodes.clear();
+    root = -1;
+    bySize.clear();
+    freeTotal = 0;
+    cursor = 0;
+}
+
+// Blocks [start, start + count) are free; merged with any run they touch
+void FreeExtentIndex::release(uint64_t start, uint64_t count) {
+    uint64_t end = start + count;
+    start = (std::max)(start, base);
+    if (start >= end) return;
+
+    int previous = floorRun(start);
+    if (previous >= 0 && nodes[previous].start + nodes[previous].length >= start) {
+        uint64_t runStart = nodes[previous].start;
+        uint64_t runEnd = runStart + nodes[previous].length;
+        if (runEnd >= end) return; // already free
+        start = runStart;
+        eraseRun(runStart, runEnd - runStart);
+    }
+
+    // Swallow every run that starts inside or right after the range
+    while (true) {
+        int next = floorRun(end);
+        if (next < 0 || nodes[next].start < start) break;
+        uint64_t runStart = nodes[next].start;
+        uint64_t runEnd = runStart + nodes[next].length;
+        end = (std::max)(end, runEnd);
+        eraseRun(runStart, runEnd - runStart);
+    }
+
+    insertRun(start, end - start);
+}
+
+// Blocks [start, start + count) are in use; runs overlapping them are split
+void FreeExtentIndex::reserve(uint64_t start, uint64_t count) {
+    const uint64_t end = start + count;
+    if (count == 0) return;
+    cursor = end;
+
+    while (true) {
+        int run = floorRun(end - 1);
+        if (run < 0) return;
+
+        uint64_t runStart = nodes[run].start;
+        uint64_t runEnd = runStart + nodes[run].length;
+        if (runEnd <= start) return; // nothing left that overlaps
+
+        eraseRun(runStart, runEnd - runStart);
+        if (runEnd > end) insertRun(end, runEnd - end);
+        if (runStart < start) {
+            insertRun(runStart, start - runStart);
+            return;
+        }
+    }
+}
+
+// Choose a run for count blocks
+uint64_t FreeExtentIndex::find(uint64_t count, Policy policy) const {
+    if (count == 0 || root < 0 || nodes[root].maxLength < count) return npos;
+
+    switch (policy) {
+    case Policy::BestFit: {
+        auto it = bySize.lower_bound({ count, 0 });
+        return it == bySize.end() ? npos : it->second;
+    }
+    case Policy::NextFit: {
+        int node = firstFit(root, count, cursor);
+        if (node < 0) node = firstFit(root, count, 0);
+        return node < 0 ? npos : nodes[node].start;
+    }
+    default: {
+        int node = firstFit(root, count, 0);
+        return node < 0 ? npos : nodes[node].start;
+    }
+    }
+}
+
+// Add a run that touches no other
+void FreeExtentIndex::insertRun(uint64_t start, uint64_t length) {
+    int left, right;
+    split(root, start, left, right);
+    root = merge(merge(left, newNode(start, length)), right);
+    bySize.insert({ length, start });
+    freeTotal += length;
+}
+
+// Remove the run that begins at start
+void FreeExtentIndex::eraseRun(uint64_t start, uint64_t length) {
+    int left, middle, right;
+    split(root, start, left, middle);
+    split(middle, start + 1, middle, right);
+    if (middle >= 0) spareNodes.push_back(middle);
+    root = merge(left, right);
+    bySize.erase({ length, start });
+    freeTotal -= length;
+}
+
+// Run with the greatest start <= position
+int FreeExtentIndex::floorRun(uint64_t position) const {
+    int node = root;
+    int best = -1;
+    while (node >= 0) {
+        if (nodes[node].start <= position) {
+            best = node;
+            node = nodes[node].right;
+        }
+        else {
+            node = nodes[node].left;
+        }
+    }
+    return best;
+}
+
+// Lowest-addressed run starting at or after from with at least count blocks; subtrees without
+// a long enough run are skipped using maxLength
+int FreeExtentIndex::firstFit(int node, uint64_t count, uint64_t from) const {
+    while (node >= 0 && nodes[node].maxLength >= count) {
+        const Node& n = nodes[node];
+        if (n.start < from) {
+            node = n.right;
+            continue;
+        }
+        int found = firstFit(n.left, count, from);
+        if (found >= 0) return found;
+        if (n.length >= count) return node;
+        node = n.right;
+    }
+    return -1;
+}
+
+// Allocate a node (reusing erased ones)
+int FreeExtentIndex::newNode(uint64_t start, uint64_t length) {
+    // xorshift32 priorities keep the treap balanced in expectation
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    Node node{ start, length, length, seed, -1, -1 };
+    if (!spareNodes.empty()) {
+        int index = spareNodes.back();
+        spareNodes.pop_back();
+        nodes[index] = node;
+        return index;
+    }
+    nodes.push_back(node);
+    return static_cast<int>(nodes.size() - 1);
+}
+
+// Recompute a node's subtree maximum
+void FreeExtentIndex::update(int node) {
+    Node& n = nodes[node];
+    n.maxLength = n.length;
+    if (n.left >= 0) n.maxLength = (std::max)(n.maxLength, nodes[n.left].maxLength);
+    if (n.right >= 0) n.maxLength = (std::max)(n.maxLength, nodes[n.right].maxLength);
+}
+
+// Split a subtree by start: left gets starts below key
+void FreeExtentIndex::split(int node, uint64_t key, int& left, int& right) {
+    if (node < 0) {
+        left = right = -1;
+        return;
+    }
+    if (nodes[node].start < key) {
+        split(nodes[node].right, key, nodes[node].right, right);
+        left = node;
+    }
+    else {
+        split(nodes[node].left, key, left, nodes[node].left);
+        right = node;
+    }
+    update(node);
+}
+
+// Join two subtrees where every start in left is below every start in right
+int FreeExtentIndex::merge(int left, int right) {
+    if (left < 0) return right;
+    if (right < 0) return left;
+    if (nodes[left].priority > nodes[right].priority) {
+        nodes[left].right = merge(nodes[left].right, right);
+        update(left);
+        return left;
+    }
+    nodes[right].left = merge(left, nodes[right].left);
+    update(right);
+    return right;
+}
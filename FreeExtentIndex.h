@@ -0,0 +1,74 @@
+﻿#ifndef FREE_EXTENT_INDEX_H
+#define FREE_EXTENT_INDEX_H
+
+#include <vector>
+#include <set>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+#include "BlockBitmap.h"
+
+// Index of the free runs of a block bitmap, kept exact as blocks are reserved and released.
+//  - an offset-ordered treap whose nodes also carry the longest run in their subtree, so the
+//    lowest-addressed run of at least n blocks (first-fit, next-fit) is found in O(log n)
+//  - a size-ordered set of (length, start) for best-fit
+// Releasing merges with neighbouring runs and reserving splits them; both are idempotent,
+// so callers may pass ranges that are already partly free or partly used.
+class FreeExtentIndex {
+public:
+    static constexpr uint64_t npos = UINT64_MAX;
+
+    enum class Policy {
+        FirstFit,  // lowest-addressed run that fits
+        BestFit,   // smallest run that fits (lowest address among equals)
+        NextFit    // first fit at or after the end of the previous reservation, wrapping around
+    };
+
+    FreeExtentIndex();
+
+    // Rebuild from the clear bits of bitmap at or after base; blocks below base are never indexed
+    void rebuild(const BlockBitmap& bitmap, uint64_t base);
+    void clear();
+
+    void release(uint64_t start, uint64_t count);
+    void reserve(uint64_t start, uint64_t count);
+
+    // Start of a free run of at least count blocks, npos if there is none
+    uint64_t find(uint64_t count, Policy policy) const;
+
+    uint64_t freeBlocks() const { return freeTotal; }
+    size_t runCount() const { return bySize.size(); }
+    uint64_t largestRun() const { return bySize.empty() ? 0 : bySize.rbegin()->first; }
+
+private:
+    struct Node {
+        uint64_t start;
+        uint64_t length;
+        uint64_t maxLength;  // longest run in this subtree
+        uint32_t priority;
+        int left;
+        int right;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> spareNodes;
+    int root = -1;
+    std::set<std::pair<uint64_t, uint64_t>> bySize;  // (length, start)
+    uint64_t base = 0;
+    uint64_t freeTotal = 0;
+    uint64_t cursor = 0;     // next-fit position
+    uint32_t seed;
+
+    void insertRun(uint64_t start, uint64_t length);
+    void eraseRun(uint64_t start, uint64_t length);
+    int floorRun(uint64_t position) const;   // run with the greatest start <= position, or -1
+    int firstFit(int node, uint64_t count, uint64_t from) const;
+
+    int newNode(uint64_t start, uint64_t length);
+    void update(int node);
+    void split(int node, uint64_t key, int& left, int& right);  // left: starts < key
+    int merge(int left, int right);
+};
+
+#endif // FREE_EXTENT_INDEX_H
@@ -0,0 +1,198 @@
+﻿#include "IOStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+    // Index of the highest set bit (x != 0)
+    inline unsigned highestBit(uint64_t x) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, x);
+        return static_cast<unsigned>(index);
+#else
+        return 63u - static_cast<unsigned>(__builtin_clzll(x));
+#endif
+    }
+
+    // Nanoseconds as microseconds with two decimals
+    inline double micros(uint64_t nanos) {
+        return static_cast<double>(nanos) / 1000.0;
+    }
+}
+
+// Constructor
+IOStats::IOStats() : since(clock()) {
+    reset();
+}
+
+// Record the call when the scope ends
+IOStats::Scope::~Scope() {
+    stats.record(op, clock() - started, transferred, ok, io, crypto);
+}
+
+// Monotonic clock in nanoseconds
+uint64_t IOStats::clock() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Display name of an operation
+const char* IOStats::name(Op op) {
+    switch (op) {
+    case Op::Read: return "read";
+    case Op::Write: return "write";
+    case Op::Batch: return "batch";
+    case Op::Allocate: return "allocate";
+    case Op::BitmapSave: return "bitmap-save";
+    case Op::Sync: return "sync";
+    case Op::Fsync: return "fsync";
+    default: return "?";
+    }
+}
+
+// Count one call
+void IOStats::record(Op op, uint64_t nanos, uint64_t bytes, bool ok, uint64_t ioNanos, uint64_t cryptoNanos) {
+    Counters& c = counters[static_cast<size_t>(op)];
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    if (!ok) c.errors.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    c.totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+    c.ioNanos.fetch_add(ioNanos, std::memory_order_relaxed);
+    c.cryptoNanos.fetch_add(cryptoNanos, std::memory_order_relaxed);
+    c.buckets[bucketIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t seen = c.maxNanos.load(std::memory_order_relaxed);
+    while (nanos > seen && !c.maxNanos.compare_exchange_weak(seen, nanos, std::memory_order_relaxed)) {}
+}
+
+// Copy of every counter with the usual percentiles
+IOStats::Snapshot IOStats::snapshot() const {
+    Snapshot result;
+    for (size_t i = 0; i < counters.size(); ++i) {
+        const Counters& c = counters[i];
+        OpStats& s = result.ops[i];
+        s.count = c.count.load(std::memory_order_relaxed);
+        s.errors = c.errors.load(std::memory_order_relaxed);
+        s.bytes = c.bytes.load(std::memory_order_relaxed);
+        s.totalNanos = c.totalNanos.load(std::memory_order_relaxed);
+        s.ioNanos = c.ioNanos.load(std::memory_order_relaxed);
+        s.cryptoNanos = c.cryptoNanos.load(std::memory_order_relaxed);
+        s.maxNanos = c.maxNanos.load(std::memory_order_relaxed);
+
+        const Op op = static_cast<Op>(i);
+        s.p50Nanos = percentile(op, 0.50);
+        s.p90Nanos = percentile(op, 0.90);
+        s.p99Nanos = percentile(op, 0.99);
+        s.p999Nanos = percentile(op, 0.999);
+    }
+    result.elapsedNanos = clock() - since.load(std::memory_order_relaxed);
+    return result;
+}
+
+// Smallest bucket bound covering the fraction of recorded calls (never above the maximum seen)
+uint64_t IOStats::percentile(Op op, double fraction) const {
+    const Counters& c = at(op);
+    uint64_t total = 0;
+    for (const auto& bucket : c.buckets) total += bucket.load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+
+    fraction = (std::min)(1.0, (std::max)(0.0, fraction));
+    uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(total) + 0.5);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucketCount; ++i) {
+        seen += c.buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return (std::min)(bucketUpperBound(i), c.maxNanos.load(std::memory_order_relaxed));
+        }
+    }
+    return c.maxNanos.load(std::memory_order_relaxed);
+}
+
+// Non-empty buckets as (upper bound in nanoseconds, count)
+std::vector<std::pair<uint64_t, uint64_t>> IOStats::histogram(Op op) const {
+    std::vector<std::pair<uint64_t, uint64_t>> result;
+    const Counters& c = at(op);
+    for (size_t i = 0; i < bucketCount; ++i) {
+        uint64_t n = c.buckets[i].load(std::memory_order_relaxed);
+        if (n) result.emplace_back(bucketUpperBound(i), n);
+    }
+    return result;
+}
+
+// Zero everything and restart the elapsed-time clock
+void IOStats::reset() {
+    for (Counters& c : counters) {
+        c.count.store(0, std::memory_order_relaxed);
+        c.errors.store(0, std::memory_order_relaxed);
+        c.bytes.store(0, std::memory_order_relaxed);
+        c.totalNanos.store(0, std::memory_order_relaxed);
+        c.ioNanos.store(0, std::memory_order_relaxed);
+        c.cryptoNanos.store(0, std::memory_order_relaxed);
+        c.maxNanos.store(0, std::memory_order_relaxed);
+        for (auto& bucket : c.buckets) bucket.store(0, std::memory_order_relaxed);
+    }
+    since.store(clock(), std::memory_order_relaxed);
+}
+
+// Table of every operation that has been seen; latencies in microseconds
+void IOStats::print(std::ostream& out) const {
+    const Snapshot s = snapshot();
+    const double seconds = static_cast<double>(s.elapsedNanos) / 1e9;
+
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+
+    out << "\n" << std::string(112, '=') << "\n";
+    out << "|                                         VIRTUAL DISK I/O STATISTICS                                          |\n";
+    out << std::string(112, '=') << "\n";
+    out << std::left << std::setw(12) << "Op"
+        << std::right << std::setw(9) << "Count" << std::setw(7) << "Errors" << std::setw(12) << "MB"
+        << std::setw(10) << "MB/s" << std::setw(10) << "Avg(us)" << std::setw(10) << "p50" << std::setw(10) << "p99"
+        << std::setw(10) << "p99.9" << std::setw(11) << "Max" << std::setw(10) << "I/O(ms)" << std::setw(11) << "Crypto(ms)" << "\n";
+    out << std::string(112, '-') << "\n";
+
+    out << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < s.ops.size(); ++i) {
+        const OpStats& op = s.ops[i];
+        if (op.count == 0) continue;
+
+        const double mb = static_cast<double>(op.bytes) / (1024.0 * 1024.0);
+        out << std::left << std::setw(12) << name(static_cast<Op>(i))
+            << std::right << std::setw(9) << op.count << std::setw(7) << op.errors << std::setw(12) << mb
+            << std::setw(10) << (seconds > 0 ? mb / seconds : 0.0)
+            << std::setw(10) << micros(op.totalNanos / op.count)
+            << std::setw(10) << micros(op.p50Nanos) << std::setw(10) << micros(op.p99Nanos)
+            << std::setw(10) << micros(op.p999Nanos) << std::setw(11) << micros(op.maxNanos)
+            << std::setw(10) << static_cast<double>(op.ioNanos) / 1e6
+            << std::setw(11) << static_cast<double>(op.cryptoNanos) / 1e6 << "\n";
+    }
+    out << std::string(112, '-') << "\n";
+    out << "Window: " << seconds << " s\n";
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+// Bucket of a latency: values below 16 ns map one-to-one, larger ones by exponent and top 4 mantissa bits
+size_t IOStats::bucketIndex(uint64_t nanos) {
+    if (nanos < subBuckets) return static_cast<size_t>(nanos);
+    const unsigned shift = highestBit(nanos) - subBucketBits;
+    return static_cast<size_t>(shift) * subBuckets + static_cast<size_t>(nanos >> shift);
+}
+
+// Largest latency that falls into a bucket
+uint64_t IOStats::bucketUpperBound(size_t index) {
+    if (index < subBuckets) return index;
+    const unsigned shift = static_cast<unsigned>(index / subBuckets - 1);
+    const uint64_t mantissa = index % subBuckets + subBuckets;
+    if (shift + subBucketBits + 1 >= 64 && mantissa == 2 * subBuckets - 1) return UINT64_MAX;
+    return ((mantissa + 1) << shift) - 1;
+}
@@ -0,0 +1,115 @@
+﻿#ifndef IO_STATS_H
+#define IO_STATS_H
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <utility>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+// Per-operation I/O counters and latency histograms.
+// Histograms are log-linear (HDR-style): every power-of-two range of nanoseconds is split into
+// 16 linear sub-buckets, so any recorded latency is reported within ~6% of its true value.
+// Recording is lock-free; snapshots are not atomic across counters.
+class IOStats {
+public:
+
+    enum class Op {
+        Read,        // readData / readInto
+        Write,       // writeData / writeFrom, including the operation's flush barrier
+        Batch,       // runBatch
+        Allocate,    // allocateBlocks
+        BitmapSave,  // saveBitmap_nl
+        Sync,        // syncToDisk
+        Fsync,       // each fsync / FlushFileBuffers / msync issued by the disk
+        Count
+    };
+
+    struct OpStats {
+        uint64_t count = 0;
+        uint64_t errors = 0;
+        uint64_t bytes = 0;
+        uint64_t totalNanos = 0;
+        uint64_t ioNanos = 0;       // spent in raw reads and writes
+        uint64_t cryptoNanos = 0;   // spent encrypting or decrypting
+        uint64_t maxNanos = 0;
+        uint64_t p50Nanos = 0;
+        uint64_t p90Nanos = 0;
+        uint64_t p99Nanos = 0;
+        uint64_t p999Nanos = 0;
+    };
+
+    struct Snapshot {
+        std::array<OpStats, static_cast<size_t>(Op::Count)> ops;
+        uint64_t elapsedNanos = 0;  // since construction or the last reset
+
+        const OpStats& operator[](Op op) const { return ops[static_cast<size_t>(op)]; }
+    };
+
+    // Times one call from construction to destruction; it counts as an error unless succeed() ran
+    class Scope {
+    public:
+        Scope(IOStats& stats, Op op) : stats(stats), op(op), started(clock()) {}
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        void succeed(uint64_t bytes) { ok = true; transferred = bytes; }
+        void addIo(uint64_t nanos) { io += nanos; }
+        void addCrypto(uint64_t nanos) { crypto += nanos; }
+
+    private:
+        IOStats& stats;
+        Op op;
+        uint64_t started;
+        uint64_t transferred = 0;
+        uint64_t io = 0;
+        uint64_t crypto = 0;
+        bool ok = false;
+    };
+
+    IOStats();
+
+    IOStats(const IOStats&) = delete;
+    IOStats& operator=(const IOStats&) = delete;
+
+    // Monotonic clock in nanoseconds
+    static uint64_t clock();
+    static const char* name(Op op);
+
+    void record(Op op, uint64_t nanos, uint64_t bytes, bool ok, uint64_t ioNanos = 0, uint64_t cryptoNanos = 0);
+
+    Snapshot snapshot() const;
+    uint64_t percentile(Op op, double fraction) const;  // latency in nanoseconds, fraction in [0, 1]
+    std::vector<std::pair<uint64_t, uint64_t>> histogram(Op op) const;  // (bucket upper bound, count), non-empty buckets
+    void reset();
+
+    void print(std::ostream& out) const;
+
+private:
+    static constexpr unsigned subBucketBits = 4;
+    static constexpr unsigned subBuckets = 1u << subBucketBits;
+    static constexpr size_t bucketCount = (64 - subBucketBits + 1) * subBuckets;
+
+    struct Counters {
+        std::atomic<uint64_t> count{ 0 };
+        std::atomic<uint64_t> errors{ 0 };
+        std::atomic<uint64_t> bytes{ 0 };
+        std::atomic<uint64_t> totalNanos{ 0 };
+        std::atomic<uint64_t> ioNanos{ 0 };
+        std::atomic<uint64_t> cryptoNanos{ 0 };
+        std::atomic<uint64_t> maxNanos{ 0 };
+        std::array<std::atomic<uint64_t>, bucketCount> buckets;
+    };
+
+    std::array<Counters, static_cast<size_t>(Op::Count)> counters;
+    std::atomic<uint64_t> since;
+
+    static size_t bucketIndex(uint64_t nanos);
+    static uint64_t bucketUpperBound(size_t index);
+    const Counters& at(Op op) const { return counters[static_cast<size_t>(op)]; }
+};
+
+#endif // IO_STATS_H
@@ -0,0 +1,226 @@
+﻿#include "IoUring.h"
+
+#include <deque>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#ifdef IO_URING_SUPPORTED
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+// Syscall numbers are shared by every architecture since Linux 5.1
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#endif
+
+// Constructor (sets up the ring, leaves it unavailable on failure)
+IoUring::IoUring(unsigned entries) {
+#ifdef IO_URING_SUPPORTED
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) return;
+
+    ringFd = fd;
+    ringEntries = params.sq_entries;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        sqRingSize = cqRingSize = (std::max)(sqRingSize, cqRingSize);
+    }
+
+    void* sq = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        release();
+        return;
+    }
+    sqRing = sq;
+
+    if (singleMap) {
+        cqRing = sqRing;
+    }
+    else {
+        void* cq = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            release();
+            return;
+        }
+        cqRing = cq;
+    }
+
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* entriesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (entriesMap == MAP_FAILED) {
+        release();
+        return;
+    }
+    sqes = static_cast<io_uring_sqe*>(entriesMap);
+
+    char* sqBase = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sqBase + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sqBase + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sqBase + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sqBase + params.sq_off.array);
+
+    char* cqBase = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cqBase + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cqBase + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cqBase + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cqBase + params.cq_off.cqes);
+#else
+    (void)entries;
+#endif
+}
+
+// Destructor
+IoUring::~IoUring() {
+    release();
+}
+
+// Unmap the rings and close the ring descriptor
+void IoUring::release() {
+#ifdef IO_URING_SUPPORTED
+    if (sqes) munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (sqRing) munmap(sqRing, sqRingSize);
+    sqes = nullptr;
+    cqRing = nullptr;
+    sqRing = nullptr;
+    if (ringFd >= 0) close(ringFd);
+#endif
+    ringFd = -1;
+}
+
+// Submit all operations, resubmitting short transfers, and wait for every completion
+bool IoUring::run(std::vector<Operation>& ops, const std::function<void(size_t)>& onComplete) {
+#ifdef IO_URING_SUPPORTED
+    if (!available()) return false;
+    if (ops.empty()) return true;
+
+    constexpr size_t maxChunk = 1u << 30; // sqe->len is 32-bit
+
+    std::deque<size_t> pending;
+    std::vector<size_t> transferred(ops.size(), 0);
+    for (size_t i = 0; i < ops.size(); ++i) {
+        ops[i].result = 0;
+        pending.push_back(i);
+    }
+
+    size_t inFlight = 0;
+    size_t finished = 0;
+    bool ok = true;
+
+    // Reap every completion posted so far
+    auto reap = [&]() {
+        unsigned head = *cqHead;
+        unsigned cqTailNow = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != cqTailNow) {
+            io_uring_cqe* cqe = &cqes[head & *cqMask];
+            size_t i = static_cast<size_t>(cqe->user_data);
+            int res = cqe->res;
+            ++head;
+            --inFlight;
+
+            if (res == -EAGAIN || res == -EINTR) {
+                pending.push_back(i);
+                continue;
+            }
+
+            if (res > 0) {
+                transferred[i] += static_cast<size_t>(res);
+                if (transferred[i] < ops[i].length && !ops[i].vectors) {
+                    pending.push_back(i); // short transfer, continue from where it stopped
+                    continue;
+                }
+            }
+
+            if (res < 0) {
+                ops[i].result = res;
+                ok = false;
+            }
+            else {
+                ops[i].result = static_cast<int64_t>(transferred[i]);
+                if (transferred[i] < ops[i].length) ok = false;
+            }
+
+            ++finished;
+            if (onComplete) onComplete(i);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        };
+
+    while (finished < ops.size()) {
+        // Fill the submission queue; never exceed the ring size so the CQ cannot overflow
+        unsigned tail = *sqTail;
+        while (!pending.empty() && inFlight < ringEntries) {
+            size_t i = pending.front();
+            pending.pop_front();
+
+            Operation& op = ops[i];
+            unsigned slot = tail & *sqMask;
+            io_uring_sqe* sqe = &sqes[slot];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->fd = op.fd;
+            sqe->off = op.offset + transferred[i];
+            if (op.vectors) {
+                sqe->opcode = op.write ? IORING_OP_WRITEV : IORING_OP_READV;
+                sqe->addr = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(op.vectors));
+                sqe->len = op.vectorCount;
+            }
+            else {
+                sqe->opcode = op.write ? IORING_OP_WRITE : IORING_OP_READ;
+                sqe->addr = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(op.buffer + transferred[i]));
+                sqe->len = static_cast<unsigned>((std::min)(op.length - transferred[i], maxChunk));
+            }
+            sqe->user_data = static_cast<uint64_t>(i);
+            sqArray[slot] = slot;
+
+            ++tail;
+            ++inFlight;
+        }
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+        unsigned toSubmit = tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        int rc = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+        if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // The ring is in an unknown state. Take back the entries the kernel has not consumed,
+            // then wait out the ones it has: they may still read into or write from caller buffers,
+            // and a plain I/O fallback must not race them. Only then drop the ring.
+            unsigned consumed = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+            inFlight -= tail - consumed;
+            __atomic_store_n(sqTail, consumed, __ATOMIC_RELEASE);
+
+            for (reap(); inFlight > 0; reap()) {
+                if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                    errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    // Completions still land in the mapped queue; poll it
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+            release();
+            return false;
+        }
+
+        reap();
+    }
+
+    return ok;
+#else
+    (void)ops;
+    (void)onComplete;
+    return false;
+#endif
+}
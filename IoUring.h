@@ -0,0 +1,79 @@
+﻿#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IO_URING_SUPPORTED 1
+#endif
+#endif
+
+#ifdef IO_URING_SUPPORTED
+#include <linux/io_uring.h>
+#endif
+
+struct iovec;
+
+// Minimal io_uring submission/completion ring driven through raw syscalls.
+// Used by VirtualDisk to push a whole batch of block reads/writes to the
+// kernel at once instead of one blocking round trip per block.
+class IoUring {
+public:
+
+    struct Operation {
+        bool write = false;
+        int fd = -1;
+        uint64_t offset = 0;
+        char* buffer = nullptr;
+        size_t length = 0;
+        int64_t result = 0;   // bytes transferred, or -errno
+
+        // Vectored form (READV/WRITEV) used instead of buffer when set; the array must
+        // stay alive until run() returns. Short vectored transfers are not resubmitted.
+        const struct iovec* vectors = nullptr;
+        unsigned vectorCount = 0;
+    };
+
+    explicit IoUring(unsigned entries = 64);
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // False when the kernel (or a sandbox) refuses io_uring_setup
+    bool available() const { return ringFd >= 0; }
+
+    // Submit every operation and wait for all of them; onComplete(i) fires as each one finishes.
+    // Even when it fails, no submitted operation is still in flight once it returns.
+    bool run(std::vector<Operation>& ops, const std::function<void(size_t)>& onComplete = nullptr);
+
+private:
+    int ringFd = -1;
+    unsigned ringEntries = 0;
+
+#ifdef IO_URING_SUPPORTED
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+#endif
+
+    void release();
+};
+
+#endif // IO_URING_H
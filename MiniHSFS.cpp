@@ -2,14 +2,20 @@
 
 ///////////////////////////////Start System
 
-MiniHSFS::MiniHSFS(const std::string& path, uint32_t sizeMB, uint32_t blockSize)
+MiniHSFS::MiniHSFS(const std::string& path, uint32_t sizeMB, uint32_t blockSize, VirtualDisk::IOMode ioMode,
+    const std::vector<std::string>& stripeMembers, uint32_t stripeUnitBytes)
     :disk(std::max<int>(1, static_cast<int>(std::ceil((double)sizeof(SuperblockInfo) / blockSize))), blockSize),
     mounted(false),
     initialized(false),
-     btreeBlocks(0), btreeStartIndex(0), dataStartIndex(0), inodeBlocks(0), inodeCount(0) {
+     btreeBlocks(0), btreeStartIndex(0), dataStartIndex(0), inodeBlocks(0), inodeCount(0),
+    nodeCache([this](int index, BTreeNode& node) { ReadBTreeNode(index, node); },
+        [this](int index, const BTreeNode& node) { WriteBTreeNode(index, node, false); }) {
 
-    // Format the virtual disk
-    disk.Initialize(path, sizeMB);
+    // Format the virtual disk (path is the first stripe member in Striped mode)
+    if (ioMode == VirtualDisk::IOMode::Striped) {
+        disk.setStriping(stripeMembers, stripeUnitBytes);
+    }
+    disk.Initialize(path, sizeMB, ioMode);
 
     btreeOrder = static_cast<int>(CalculateBTreeOrder());
 
@@ -30,6 +36,7 @@ MiniHSFS::~MiniHSFS()
 }
 
 void MiniHSFS::Initialize() {
+    VirtualDisk::FlushScope flush(disk);
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
     if (initialized) {
         throw std::runtime_error("Filesystem already initialized");
@@ -43,11 +50,22 @@ void MiniHSFS::Initialize() {
     inodeBlocks = CalculateInodeBlocks();
     btreeBlocks = static_cast<int>(CalculateBTreeBlocks());
     btreeStartIndex = static_cast<int>(inodeBlocks) + disk.getSystemBlocks() + superBlockBlocks;
-    dataStartIndex = btreeStartIndex + btreeBlocks;
+    checksumBlocks = dataChecksums ? static_cast<uint32_t>((disk.totalBlocks() * sizeof(uint32_t) + disk.blockSize - 1) / disk.blockSize) : 0;
+    dataStartIndex = btreeStartIndex + btreeBlocks + static_cast<int>(checksumBlocks);
+
+    // Node cache sized once: up to 5% of free memory, never more slots than the area has nodes
+    const size_t slotBytes = sizeof(BTreeNode) + BTreeNode::slabInts(btreeOrder) * sizeof(int);
+    const size_t budgetNodes = (std::max<size_t>)(1000, static_cast<size_t>(getAvailableMemory() * 0.05) / slotBytes);
+    nodeCache.configure(btreeOrder, (std::min)(budgetNodes, static_cast<size_t>(btreeBlocks)), static_cast<size_t>(btreeBlocks));
 
     try {
         if (disk.IsNew()) {
             InitializeSuperblock();
+            if (checksumBlocks) {
+                // The area follows the B-tree; a new image reads back as zero (nothing to verify yet)
+                disk.allocateBlocks(checksumBlocks);
+                disk.attachChecksums(VirtualDisk::Extent(static_cast<uint32_t>(btreeStartIndex + btreeBlocks), checksumBlocks));
+            }
 
             InitializeBTree();
             disk.allocateBlocks(static_cast<uint32_t>(btreeBlocks ? btreeBlocks : 1));
@@ -59,22 +77,30 @@ void MiniHSFS::Initialize() {
             SaveBTree();
         }
         initialized = true;
-        dataStartIndex = LoadSuperblock().dataStartIndex;
+
+        // The on-disk superblock decides the checksum formats of an existing volume
+        SuperblockInfo info = LoadSuperblock();
+        dataStartIndex = static_cast<int>(info.dataStartIndex);
+        legacyInodeChecksum = info.version < crc32cVersion;
+        dataChecksums = (info.features & featureDataChecksums) != 0;
+        checksumBlocks = dataChecksums ? info.checksumBlocks : 0;
+        if (dataChecksums && !disk.IsNew()) {
+            disk.attachChecksums(VirtualDisk::Extent(info.checksumStart, info.checksumBlocks));
+        }
     }
     catch (...) {
         //FlushDirtyInodes();
         SaveBTree();
         std::cerr << "!!Memory pressure during initialization. Flushing all caches.\n";
 
-        btreeCache.clear();
-        btreeLruMap.clear();
-        btreeLruList.clear();
+        nodeCache.clear();
         inodeTable.clear();
         throw;
     }
 }
 
 void MiniHSFS::Mount(size_t inodePercentage, size_t btreePercentage, size_t inodeSize) {
+    VirtualDisk::FlushScope flush(disk);
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
     this->inodeSize = inodeSize;
@@ -98,14 +124,23 @@ void MiniHSFS::Mount(size_t inodePercentage, size_t btreePercentage, size_t inod
     try {
 
         LoadInodeTable();
+        ClipBTreeArea();
         LoadBTree();
 
+        // Until a clean unmount the tree on disk may not match the bitmap on disk
+        SuperblockInfo info = LoadSuperblock();
+        info.features |= featureBTreeStale;
+        SaveSuperblock(info);
+
 
         //// Verify root directory
         if (!inodeTable[0].isUsed || !inodeTable[0].isDirectory) {
             throw std::runtime_error("Root directory corruption detected");
         }
 
+        // Superblock is read and rewritten by nearly every operation; keep it resident
+        disk.pinBlocks(VirtualDisk::Extent(static_cast<uint32_t>(superBlockIndex), static_cast<uint32_t>(superBlockBlocks)));
+
         mounted = true;
     }
     catch (const std::exception& e) {
@@ -118,7 +153,146 @@ void MiniHSFS::Mount(size_t inodePercentage, size_t btreePercentage, size_t inod
     }
 }
 
+void MiniHSFS::Grow(uint32_t newSizeMB) {
+    VirtualDisk::FlushScope flush(disk);
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+
+    if (!initialized) {
+        throw std::runtime_error("Filesystem not initialized");
+    }
+
+    const int oldTotal = static_cast<int>(disk.totalBlocks());
+
+    disk.grow(newSizeMB);
+    const int newTotal = static_cast<int>(disk.totalBlocks());
+
+    // The added space joins the map; the previous geometry label (if any) was released by the disk
+    RefreshBTree(oldTotal - 1, newTotal);
+
+    SuperblockInfo info = LoadSuperblock();
+    info.totalBlocks = static_cast<uint64_t>(newTotal);
+    info.freeBlocks = disk.freeBlocksCount();
+    info.lastWriteTime = time(nullptr);
+    SaveSuperblock(info);
+
+    freeBlocks = static_cast<size_t>(info.freeBlocks);
+    lastTimeWrite = info.lastWriteTime;
+}
+
+void MiniHSFS::StartFlusher(std::chrono::milliseconds maxAge, size_t maxDirty, std::chrono::milliseconds interval) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    if (!mounted) {
+        throw std::runtime_error("Filesystem not mounted");
+    }
+    if (interval.count() <= 0) {
+        throw std::invalid_argument("Flusher interval must be positive");
+    }
+
+    std::lock_guard<std::mutex> flusherLock(flusherMutex);
+    if (flusherThread.joinable()) {
+        throw std::runtime_error("Flusher already running");
+    }
+    flushMaxAge = maxAge;
+    flushMaxDirty = (std::max<size_t>)(1, maxDirty);
+    flushInterval = interval;
+    flusherStop = false;
+    writeBack = true;
+    flusherThread = std::thread(&MiniHSFS::FlusherLoop, this);
+}
+
+void MiniHSFS::StopFlusher() {
+    {
+        std::lock_guard<std::mutex> flusherLock(flusherMutex);
+        if (!flusherThread.joinable()) return;
+        flusherStop = true;
+    }
+    flusherWake.notify_all();
+    flusherThread.join();
+
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    writeBack = false;
+    if (mounted) FlushMetadata();
+}
+
+void MiniHSFS::FlushMetadata() {
+    std::vector<VirtualDisk::Extent> releasing;
+    {
+        std::lock_guard<std::recursive_mutex> lock(fsMutex);
+
+        WriteDirtyInodes();
+        nodeCache.flush();
+        releasing.swap(pendingFrees);
+    }
+
+    // Bitmap ranges and the writes above become durable without holding up file operations
+    try {
+        disk.syncToDisk();
+    }
+    catch (...) {
+        std::lock_guard<std::recursive_mutex> lock(fsMutex);
+        pendingFrees.insert(pendingFrees.end(), releasing.begin(), releasing.end());
+        throw;
+    }
+
+    // Only now may the blocks those inodes dropped become free (each release is its own flush point)
+    if (releasing.empty()) return;
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    for (const auto& extent : releasing) {
+        ReleaseBlocks(extent);
+    }
+}
+
+void MiniHSFS::FlusherLoop() {
+    std::unique_lock<std::mutex> flusherLock(flusherMutex);
+    while (!flusherStop) {
+        flusherWake.wait_for(flusherLock, flushInterval);
+        if (flusherStop) break;
+
+        flusherLock.unlock();
+        try {
+            bool due;
+            {
+                std::lock_guard<std::recursive_mutex> lock(fsMutex);
+                due = FlushDue();
+            }
+            if (due) FlushMetadata();
+        }
+        catch (const std::exception& e) {
+            // Dirty state is kept; the next round (or StopFlusher) tries again
+            std::cerr << "Background flush failed: " << e.what() << std::endl;
+        }
+        flusherLock.lock();
+    }
+}
+
+bool MiniHSFS::FlushDue() const {
+    size_t dirty = dirtyInodes.size() + nodeCache.dirtyCount() + pendingFrees.size();
+    if (dirty == 0) return false;
+    return dirty >= flushMaxDirty || std::chrono::steady_clock::now() - dirtySince >= flushMaxAge;
+}
+
+void MiniHSFS::NoteDirty() {
+    size_t dirty = dirtyInodes.size() + nodeCache.dirtyCount() + pendingFrees.size();
+    if (dirty == 1) {
+        dirtySince = std::chrono::steady_clock::now();
+    }
+    if (dirty >= flushMaxDirty) {
+        flusherWake.notify_one();
+    }
+}
+
+void MiniHSFS::SetDataChecksums(bool enabled) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    if (initialized) {
+        throw std::runtime_error("Data checksums must be chosen before the filesystem is initialized");
+    }
+    dataChecksums = enabled;
+}
+
 void MiniHSFS::Unmount() {
+    StopFlusher();
+
+    VirtualDisk::FlushScope flush(disk);
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
     if (!mounted) {
@@ -126,7 +300,11 @@ void MiniHSFS::Unmount() {
     }
 
     try {
+        // Before the superblock is read below, so the flags it records are current
+        ReconcileBTree();
+
         MiniHSFS::SuperblockInfo info = MiniHSFS::LoadSuperblock();
+        if (!btreeStale) info.features &= ~featureBTreeStale;
         info.freeBlocks = disk.freeBlocksCount();
         info.lastMountTime = time(nullptr);
         int count = 0;
@@ -146,11 +324,10 @@ void MiniHSFS::Unmount() {
 
         // Sync virtual disk
         disk.syncToDisk();
+        disk.unpinBlocks(VirtualDisk::Extent(static_cast<uint32_t>(superBlockIndex), static_cast<uint32_t>(superBlockBlocks)));
 
-        btreeCache.clear();
+        nodeCache.clear();
         inodeTable.clear();
-        btreeLruList.clear();
-        btreeLruMap.clear();
 
         mounted = false;
     }
@@ -169,7 +346,7 @@ void MiniHSFS::InitializeSuperblock() {
     const char* magicStr = "Tomas";
     std::memcpy(info.magic, magicStr, strlen(magicStr));
 
-    info.version = 0x00010000;
+    info.version = crc32cVersion;
     info.blockSize = disk.blockSize;
     info.inodeSize = inodeSize;
     info.systemSize = static_cast<uint32_t>(inodeBlocks) + btreeBlocks + superBlockBlocks + disk.getSystemBlocks();
@@ -182,6 +359,14 @@ void MiniHSFS::InitializeSuperblock() {
     info.lastMountTime = info.creationTime;
     info.lastWriteTime = info.creationTime;
     info.state = 1;
+    info.features = featureExtentFreeMap;
+    if (checksumBlocks) {
+        info.features |= featureDataChecksums;
+        info.checksumStart = static_cast<uint32_t>(btreeStartIndex + btreeBlocks);
+        info.checksumBlocks = checksumBlocks;
+    }
+    info.systemSize += checksumBlocks;
+    info.freeBlocks -= checksumBlocks;
 
     SaveSuperblock(info);
 }
@@ -236,313 +421,397 @@ int MiniHSFS::InitializeInode(int index, bool isDirectory) {
 void MiniHSFS::InitializeBTree() {
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
-    rootNodeIndex = AllocateBTreeNode();
-    if (rootNodeIndex == -1) {
-        throw std::runtime_error("Failed to allocate root B-tree node");
+    // One entry per free run of the data area: key = first block, value = run length
+    BulkLoadBTree(disk.getFreeRuns(static_cast<uint32_t>(dataStartIndex), static_cast<uint32_t>(disk.totalBlocks())));
+}
+
+void MiniHSFS::BulkLoadBTree(const std::vector<VirtualDisk::Extent>& runs) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+
+    // Nodes per level, leaves first; entries are spread evenly so no node is under half full
+    const size_t maxKeys = static_cast<size_t>(btreeOrder) - 1;
+    const size_t maxChildren = static_cast<size_t>(btreeOrder);
+    std::vector<size_t> levelNodes{ (std::max<size_t>)(1, (runs.size() + maxKeys - 1) / maxKeys) };
+    while (levelNodes.back() > 1) {
+        levelNodes.push_back((levelNodes.back() + maxChildren - 1) / maxChildren);
     }
 
-    BTreeNode rootNode(btreeOrder, true);
-    btreeCache[rootNodeIndex] = rootNode;
+    size_t totalNodes = 0;
+    for (size_t count : levelNodes) totalNodes += count;
+    if (totalNodes > static_cast<size_t>(btreeBlocks)) {
+        throw std::runtime_error("B-tree area too small for " + std::to_string(runs.size()) + " free extents");
+    }
 
-    int currentNode = rootNodeIndex;
-    int block = dataStartIndex;
+    // Start over; every node past the new tree is free
+    nodeCache.clear();
+    freeBTreeBlocksCache.clear();
+    for (int i = btreeBlocks - 1; i >= static_cast<int>(totalNodes); --i) {
+        freeBTreeBlocksCache.push_back(i);
+    }
 
-    while (block < disk.totalBlocks()) {
-        BTreeNode* node = &btreeCache[currentNode];
+    // Below the root, nodes are numbered level by level from 1 in build order,
+    // so they go out as sequential multi-block writes; the root (node 0) is written last
+    const size_t batchNodes = 64;
+    auto batch = disk.acquireBuffer(batchNodes * disk.blockSize, true);
+    int batchFirst = 1;
+    size_t batchCount = 0;
 
-        if (node->keyCount == btreeOrder - 1) {
-            int newNode = AllocateBTreeNode();
-            if (newNode == -1) {
-                throw std::runtime_error("No free B-tree nodes available");
-            }
+    auto flushBatch = [&]() {
+        if (batchCount == 0) return;
+        disk.writeFrom(VirtualDisk::Extent(static_cast<uint32_t>(btreeStartIndex + batchFirst), static_cast<uint32_t>(batchCount)),
+            batch.data(), false);
+        batchFirst += static_cast<int>(batchCount);
+        batchCount = 0;
+        };
+    auto emit = [&](int index, const BTreeNode& node) {
+        if (index == rootNodeIndex) {
+            flushBatch();
+            WriteBTreeNode(index, node);
+            return;
+        }
+        char* slot = batch.data() + batchCount * disk.blockSize;
+        std::memset(slot, 0, disk.blockSize);
+        SerializeBTreeNode(node, slot);
+        if (++batchCount == batchNodes) flushBatch();
+        };
 
-            BTreeNode newLeaf(btreeOrder, true);
-            newLeaf.nextLeaf = node->nextLeaf;
-            node->nextLeaf = newNode;
+    int nextIndex = 1;
+    auto placeNode = [&](size_t level) {
+        return level + 1 == levelNodes.size() ? rootNodeIndex : nextIndex++;
+        };
 
-            SaveBTreeNode(currentNode, *node);
-            currentNode = newNode;
-            btreeCache[currentNode] = newLeaf;
-            continue;
+    // Leaves, chained left to right
+    std::vector<int> childIndex, childFirstKey;
+    for (size_t i = 0, pos = 0; i < levelNodes[0]; ++i) {
+        size_t count = runs.size() / levelNodes[0] + (i < runs.size() % levelNodes[0] ? 1 : 0);
+        BTreeNode leaf(btreeOrder, true);
+        for (size_t k = 0; k < count; ++k) {
+            leaf.keys[k] = static_cast<int>(runs[pos + k].startBlock);
+            leaf.values[k] = static_cast<int>(runs[pos + k].blockCount);
+        }
+        leaf.keyCount = static_cast<int>(count);
+
+        int index = placeNode(0);
+        leaf.nextLeaf = (i + 1 < levelNodes[0]) ? index + 1 : -1;
+        childIndex.push_back(index);
+        childFirstKey.push_back(count ? leaf.keys[0] : 0);
+        emit(index, leaf);
+        pos += count;
+    }
+
+    // Each internal level separates its children by their first keys
+    for (size_t level = 1; level < levelNodes.size(); ++level) {
+        const size_t nodes = levelNodes[level];
+        std::vector<int> parentIndex, parentFirstKey;
+
+        for (size_t i = 0, pos = 0; i < nodes; ++i) {
+            size_t count = childIndex.size() / nodes + (i < childIndex.size() % nodes ? 1 : 0);
+            BTreeNode node(btreeOrder, false);
+            for (size_t c = 0; c < count; ++c) {
+                node.children[c] = childIndex[pos + c];
+                if (c > 0) node.keys[c - 1] = childFirstKey[pos + c];
+            }
+            node.keyCount = static_cast<int>(count) - 1;
+
+            int index = placeNode(level);
+            parentIndex.push_back(index);
+            parentFirstKey.push_back(childFirstKey[pos]);
+            emit(index, node);
+            pos += count;
         }
 
-        node->keys[node->keyCount] = block;
-        node->values[node->keyCount] = 0;
-        node->keyCount++;
-        block++;
+        childIndex.swap(parentIndex);
+        childFirstKey.swap(parentFirstKey);
     }
+    flushBatch();
+}
 
-    SaveBTreeNode(currentNode, btreeCache[currentNode]);
+size_t MiniHSFS::RefreshBTree(int firstBlock, int endBlock) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    if (btreeStale) return 0; // a stale tree is rebuilt whole
+
+    firstBlock = (std::max)(firstBlock, dataStartIndex);
+    endBlock = (std::min)(endBlock, static_cast<int>(disk.totalBlocks()));
+    if (firstBlock >= endBlock) return 0;
 
-    if (currentNode != rootNodeIndex) {
-        SaveBTreeNode(rootNodeIndex, btreeCache[rootNodeIndex]);
+    // Free runs on disk and in the map, both clipped to the range
+    std::vector<std::pair<int, int>> onDisk, mapped;
+    for (const auto& run : disk.getFreeRuns(static_cast<uint32_t>(firstBlock), static_cast<uint32_t>(endBlock))) {
+        onDisk.emplace_back(static_cast<int>(run.startBlock), static_cast<int>(run.startBlock + run.blockCount));
     }
-}
 
-///////////////////////////////B-Tree Operations
+    int runStart, runLength;
+    if (BTreeFloor(firstBlock, runStart, runLength) && runStart < firstBlock && runStart + runLength > firstBlock) {
+        mapped.emplace_back(firstBlock, (std::min)(runStart + runLength, endBlock));
+    }
+    for (int key = firstBlock; BTreeCeiling(key, runStart, runLength) && runStart < endBlock; key = runStart + 1) {
+        mapped.emplace_back(runStart, (std::min)(runStart + runLength, endBlock));
+    }
 
-bool MiniHSFS::IsBTreeBlockFree(int index) {
-    try {
-        auto data = disk.readData(VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + index), 1 });
+    // Sweep both lists; blocks free only on disk are added, blocks free only in the map removed
+    std::vector<std::pair<int, int>> toAdd, toRemove;
+    size_t d = 0, m = 0;
+    for (int pos = firstBlock; pos < endBlock;) {
+        while (d < onDisk.size() && onDisk[d].second <= pos) d++;
+        while (m < mapped.size() && mapped[m].second <= pos) m++;
+        bool diskFree = d < onDisk.size() && onDisk[d].first <= pos;
+        bool mapFree = m < mapped.size() && mapped[m].first <= pos;
 
-        // Empty if all data is Zero
-        return std::all_of(data.begin(), data.end(), [](char c) { return c == 0; });
-    }
-    catch (...) {
-        std::cout << "Error XX : Can Not Find Free Blocks!" << std::endl;
-        // if Faild empty also
-        return true;
+        int next = endBlock;
+        if (d < onDisk.size()) next = (std::min)(next, diskFree ? onDisk[d].second : onDisk[d].first);
+        if (m < mapped.size()) next = (std::min)(next, mapFree ? mapped[m].second : mapped[m].first);
+
+        if (diskFree != mapFree) {
+            auto& ranges = diskFree ? toAdd : toRemove;
+            if (!ranges.empty() && ranges.back().first + ranges.back().second == pos) ranges.back().second += next - pos;
+            else ranges.emplace_back(pos, next - pos);
+        }
+        pos = next;
     }
+
+    for (const auto& range : toRemove) FreeMapRemove(range.first, range.second);
+    for (const auto& range : toAdd) FreeMapInsert(range.first, range.second);
+    return toAdd.size() + toRemove.size();
 }
 
+///////////////////////////////B-Tree Operations
+
 int MiniHSFS::AllocateBTreeNode() {
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
-    for (int i = 0; i < btreeBlocks; ++i) {
-        if (IsBTreeBlockFree(i) && !disk.IsNew()) {
-
-            // initial Block by zero data
-            std::vector<char> zeroBuffer(disk.blockSize, 0);
-            disk.writeData(
-                zeroBuffer,
-                VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + i), 1 },
-                "", true
-            );
-            return i;
-        }
-        else
-        {
-            std::vector<char> zeroBuffer(disk.blockSize, 0);
-            disk.writeData(
-                zeroBuffer,
-                VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + i), 1 },
-                "", true
-            );
-            return i;
-        }
+    // Free nodes are known from the last build or load; the caller writes the node
+    if (freeBTreeBlocksCache.empty()) {
+        return -1; // Not Blocks Empty
     }
 
-    return -1; // Not Blocks Empty
+    int index = freeBTreeBlocksCache.back();
+    freeBTreeBlocksCache.pop_back();
+    return index;
 }
 
 void MiniHSFS::FreeBTreeNode(int nodeIndex) {
     if (nodeIndex < 0 || nodeIndex >= btreeBlocks) return;
-    BTreeNode emptyNode(btreeOrder);
-    SaveBTreeNode(nodeIndex, emptyNode);
-    btreeCache.erase(nodeIndex);
-    std::vector<char> emptyBlock(disk.blockSize, 0);
-    disk.writeData(emptyBlock, VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + nodeIndex), 1 }, "", true);
+    nodeCache.discard(nodeIndex);
+
+    freeBTreeBlocksCache.push_back(nodeIndex);
+    disk.zeroBlocks(VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + nodeIndex), 1 }, false);
 }
 
 std::pair<bool, int> MiniHSFS::BTreeFind(int nodeIndex, int key) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
-    // Load the current node
-    BTreeNode node = LoadBTreeNode(nodeIndex);
-
-    // Constant to define the boundary between linear and binary search
-    constexpr int binarySearchThreshold = 16;
+    // Separators route equal keys to the right; entries live in the leaves
+    BTreeNodeRef node = LoadBTreeNode(nodeIndex);
+    while (!node->isLeaf) {
+        int pos = static_cast<int>(std::upper_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
+        node = LoadBTreeNode(node->children[pos]);
+    }
 
-    int pos = 0; //Initial position
+    int pos = static_cast<int>(std::lower_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
+    if (pos < node->keyCount && node->keys[pos] == key) {
+        return { true, node->values[pos] };
+    }
+    return { false, -1 }; // Key not found
+}
 
-    // Selecting a search algorithm based on node size
-    if (node.keyCount > binarySearchThreshold) {
-        // Improved binary search for large nodes
-        int left = 0;
-        int right = node.keyCount - 1;
+bool MiniHSFS::BTreeFloor(int key, int& start, int& length) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
-        while (left <= right) {
-            pos = left + (right - left) / 2;
+    BTreeNodeRef node = LoadBTreeNode(rootNodeIndex);
+    int leftSubtree = -1; // nearest subtree left of the descent path
 
-            if (key == node.keys[pos]) {
-                // We found the key
-                return { true, node.isLeaf ? node.values[pos] : node.children[pos + 1] };
-            }
+    while (!node->isLeaf) {
+        int pos = static_cast<int>(std::upper_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
+        if (pos > 0) leftSubtree = node->children[pos - 1];
+        node = LoadBTreeNode(node->children[pos]);
+    }
 
-            if (key < node.keys[pos]) {
-                right = pos - 1;
-            }
-            else {
-                left = pos + 1;
-            }
-        }
-        pos = left; // The position where the key would have been inserted
+    int pos = static_cast<int>(std::upper_bound(node->keys, node->keys + node->keyCount, key) - node->keys) - 1;
+    if (pos < 0) {
+        // Everything here is greater: the answer is the largest entry of the subtree to the left
+        if (leftSubtree == -1) return false;
+        node = LoadBTreeNode(leftSubtree);
+        while (!node->isLeaf) node = LoadBTreeNode(node->children[node->keyCount]);
+        pos = node->keyCount - 1;
+        if (pos < 0) return false;
     }
-    else {
-        // Improved linear search for small nodes
-        while (pos < node.keyCount && key > node.keys[pos]) {
-            ++pos;
-        }
 
-        // Check if we found the key
-        if (pos < node.keyCount && key == node.keys[pos]) {
-            return { true, node.isLeaf ? node.values[pos] : node.children[pos + 1] };
-        }
+    start = node->keys[pos];
+    length = node->values[pos];
+    return true;
+}
+
+bool MiniHSFS::BTreeCeiling(int key, int& start, int& length) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+
+    BTreeNodeRef node = LoadBTreeNode(rootNodeIndex);
+    while (!node->isLeaf) {
+        int pos = static_cast<int>(std::upper_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
+        node = LoadBTreeNode(node->children[pos]);
     }
 
-    // If we get here and don't find the key
-    if (node.isLeaf) {
-        return { false, -1 }; // Key not found
+    int pos = static_cast<int>(std::lower_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
+    if (pos == node->keyCount) {
+        // Everything here is smaller: the answer opens the next leaf
+        if (node->nextLeaf == -1) return false;
+        node = LoadBTreeNode(node->nextLeaf);
+        pos = 0;
+        if (node->keyCount == 0) return false;
     }
 
-    // Continue searching for the appropriate child node
-    return BTreeFind(node.children[pos], key);
+    start = node->keys[pos];
+    length = node->values[pos];
+    return true;
 }
 
 bool MiniHSFS::BTreeInsert(int nodeIndex, int key, int value) {
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
     if (value < 0) throw std::invalid_argument("B-tree value cannot be negative");
-    BTreeNode node = LoadBTreeNode(nodeIndex);
-
-    if (node.keyCount == btreeOrder - 1) {
-        if (nodeIndex == rootNodeIndex) {
-            BTreeNode newRoot(btreeOrder, false);
-            int newRootIndex = AllocateBTreeNode();
-            if (newRootIndex == -1) throw std::runtime_error("Failed to allocate new root node");
-            newRoot.children[0] = rootNodeIndex;
-            rootNodeIndex = newRootIndex;
-            btreeCache[newRootIndex] = newRoot;
-        }
-        BTreeSplitChild(rootNodeIndex, nodeIndex, 0);
-        return BTreeInsertNonFull(rootNodeIndex, key, value);
-    }
+    BTreeNodeRef node = LoadBTreeNode(nodeIndex);
+
+    if (node->keyCount == btreeOrder - 1 && nodeIndex == rootNodeIndex) {
+        // The root keeps its node: its contents move to a new node that becomes its only child
+        int movedIndex = AllocateBTreeNode();
+        if (movedIndex == -1) throw std::runtime_error("Failed to allocate new root node");
+        BTreeNodeRef moved = NewBTreeNode(movedIndex, node->isLeaf);
+        *moved = *node;
+        SaveBTreeNode(moved);
+
+        node->reset(false);
+        node->children[0] = movedIndex;
+        SaveBTreeNode(node);
+        BTreeSplitChild(rootNodeIndex, movedIndex, 0);
+    }
+    node.release();
     return BTreeInsertNonFull(nodeIndex, key, value);
 }
 
 bool MiniHSFS::BTreeInsertNonFull(int nodeIndex, int key, int value) {
-    BTreeNode node = LoadBTreeNode(nodeIndex);
-    int i = node.keyCount - 1;
-
-    // Check if the core exists -> Just set the value and return true
-    for (int j = 0; j < node.keyCount; ++j) {
-        if (node.keys[j] == key) {
-            node.values[j] = value;
-            SaveBTreeNode(nodeIndex, node);
+    BTreeNodeRef node = LoadBTreeNode(nodeIndex);
+
+    if (node->isLeaf) {
+        int pos = static_cast<int>(std::lower_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
+
+        // Check if the key exists -> Just set the value and return true
+        if (pos < node->keyCount && node->keys[pos] == key) {
+            if (node->values[pos] != value) {
+                node->values[pos] = value;
+                SaveBTreeNode(node);
+            }
             return true;
         }
-    }
 
-    if (node.isLeaf) {
         // Insert the key into the correct position ->
-        while (i >= 0 && key < node.keys[i]) {
-            node.keys[i + 1] = node.keys[i];
-            node.values[i + 1] = node.values[i];
-            i--;
+        for (int i = node->keyCount; i > pos; --i) {
+            node->keys[i] = node->keys[i - 1];
+            node->values[i] = node->values[i - 1];
         }
-
-        node.keys[i + 1] = key;
-        node.values[i + 1] = value;
-        node.keyCount++;
-        SaveBTreeNode(nodeIndex, node);
+        node->keys[pos] = key;
+        node->values[pos] = value;
+        node->keyCount++;
+        SaveBTreeNode(node);
         return true;
     }
-    else {
-        // Going down to the right child ->
-        while (i >= 0 && key < node.keys[i]) i--;
-        i++;
-
-        BTreeNode child = LoadBTreeNode(node.children[i]);
 
-        if (child.keyCount == btreeOrder - 1) {
-            BTreeSplitChild(nodeIndex, node.children[i], i);
-            // After splitting, the input location may change
-            if (key > node.keys[i]) i++;
-        }
-
-        return BTreeInsertNonFull(node.children[i], key, value);
+    // Going down to the right child, splitting it first if it is full (the pinned parent sees the split) ->
+    int i = static_cast<int>(std::upper_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
+    if (LoadBTreeNode(node->children[i])->keyCount == btreeOrder - 1) {
+        BTreeSplitChild(nodeIndex, node->children[i], i);
+        if (key >= node->keys[i]) i++;
     }
+
+    int child = node->children[i];
+    node.release();
+    return BTreeInsertNonFull(child, key, value);
 }
 
 void MiniHSFS::BTreeSplitChild(int parentIndex, int childIndex, int index) {
-    BTreeNode parent = LoadBTreeNode(parentIndex);
-    BTreeNode child = LoadBTreeNode(childIndex);
-    BTreeNode newNode(btreeOrder, child.isLeaf);
+    BTreeNodeRef parent = LoadBTreeNode(parentIndex);
+    BTreeNodeRef child = LoadBTreeNode(childIndex);
 
     int newNodeIndex = AllocateBTreeNode();
     if (newNodeIndex == -1) throw std::runtime_error("No space for new B-tree node");
-
-    int t = (btreeOrder - 1) / 2;
-    newNode.keyCount = t;
-    for (int j = 0; j < t; j++) {
-        newNode.keys[j] = child.keys[j + t + 1];
-        if (child.isLeaf) newNode.values[j] = child.values[j + t + 1];
-    }
-
-    if (!child.isLeaf) {
-        for (int j = 0; j <= t; j++) {
-            newNode.children[j] = child.children[j + t + 1];
-        }
+    BTreeNodeRef newNode = NewBTreeNode(newNodeIndex, child->isLeaf);
+
+    int separator;
+    if (child->isLeaf) {
+        // Leaves keep every entry: the upper half moves and its first key becomes the separator
+        int t = child->keyCount / 2;
+        newNode->keyCount = child->keyCount - t;
+        for (int j = 0; j < newNode->keyCount; j++) {
+            newNode->keys[j] = child->keys[j + t];
+            newNode->values[j] = child->values[j + t];
+        }
+        newNode->nextLeaf = child->nextLeaf;
+        child->nextLeaf = newNodeIndex;
+        child->keyCount = t;
+        separator = newNode->keys[0];
     }
     else {
-        newNode.nextLeaf = child.nextLeaf;
-        child.nextLeaf = newNodeIndex;
+        // Internal nodes hand their middle key up
+        int t = (child->keyCount - 1) / 2;
+        separator = child->keys[t];
+        newNode->keyCount = child->keyCount - t - 1;
+        for (int j = 0; j < newNode->keyCount; j++) {
+            newNode->keys[j] = child->keys[j + t + 1];
+        }
+        for (int j = 0; j <= newNode->keyCount; j++) {
+            newNode->children[j] = child->children[j + t + 1];
+        }
+        child->keyCount = t;
     }
 
-    child.keyCount = t;
-
-    for (int j = parent.keyCount; j > index; j--) {
-        parent.children[j + 1] = parent.children[j];
-        parent.keys[j] = parent.keys[j - 1];
+    for (int j = parent->keyCount; j > index; j--) {
+        parent->children[j + 1] = parent->children[j];
+        parent->keys[j] = parent->keys[j - 1];
     }
-    parent.children[index + 1] = newNodeIndex;
-    parent.keys[index] = child.keys[t];
-    parent.keyCount++;
+    parent->children[index + 1] = newNodeIndex;
+    parent->keys[index] = separator;
+    parent->keyCount++;
 
-    SaveBTreeNode(parentIndex, parent);
-    SaveBTreeNode(childIndex, child);
-    SaveBTreeNode(newNodeIndex, newNode);
+    SaveBTreeNode(parent);
+    SaveBTreeNode(child);
+    SaveBTreeNode(newNode);
 }
 
 bool MiniHSFS::BTreeDelete(int nodeIndex, int key) {
     std::lock_guard<std::recursive_mutex> lock(fsMutex);  // simultaneous protection
 
     try {
-        BTreeNode node = LoadBTreeNode(nodeIndex);
-        int idx = 0;
-
-        // Find the key inside the node
-        while (idx < node.keyCount && key > node.keys[idx]) {
-            idx++;
-        }
+        BTreeNodeRef node = LoadBTreeNode(nodeIndex);
 
-        // Case 1: The key is inside the current node
-        if (idx < node.keyCount && node.keys[idx] == key) {
-            bool success;
-            if (node.isLeaf)
-                success = BTreeDeleteFromLeaf(nodeIndex, idx);
-            else
-                success = BTreeDeleteFromNonLeaf(nodeIndex, idx);
-
-            if (success) {
-                node.isDirty = true;
-                SaveBTreeNode(nodeIndex, node);
+        // Case 1: Entries live in the leaves
+        if (node->isLeaf) {
+            int idx = static_cast<int>(std::lower_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
+            if (idx == node->keyCount || node->keys[idx] != key) {
+                return false;  // Key not found
             }
-
-            return success;
-        }
-
-        // Case 2: The key does not exist and this is a leaf node
-        if (node.isLeaf) {
-            return false;  // Key not found
+            node.release();
+            return BTreeDeleteFromLeaf(nodeIndex, idx);
         }
 
-        // Case 3: The key is in one of the children
-        bool atEnd = (idx == node.keyCount);
-        int childIndex = node.children[atEnd ? idx - 1 : idx];
-
-        // Download the target child
-        BTreeNode child = LoadBTreeNode(childIndex);
-
-        // If the child has fewer keys than the minimum, fill in
-        if (child.keyCount < (btreeOrder / 2)) {
+        // Case 2: Descend, first topping up a child at its minimum so it can lose a key
+        int idx = static_cast<int>(std::upper_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
+        if (LoadBTreeNode(node->children[idx])->keyCount <= (btreeOrder - 2) / 2) {
             BTreeFill(nodeIndex, idx); // May be combined or borrowed from neighbors
 
-            // Reload node and child after modification
-            node = LoadBTreeNode(nodeIndex);
-            childIndex = node.children[atEnd ? idx - 1 : idx];
+            // A root left without keys takes over the contents of its only child
+            if (nodeIndex == rootNodeIndex && node->keyCount == 0) {
+                int onlyChild = node->children[0];
+                *node = *LoadBTreeNode(onlyChild);
+                SaveBTreeNode(node);
+                node.release();
+                FreeBTreeNode(onlyChild);
+                return BTreeDelete(rootNodeIndex, key);
+            }
+
+            idx = static_cast<int>(std::upper_bound(node->keys, node->keys + node->keyCount, key) - node->keys);
         }
 
         // Follow-up deletion within the child
-        return BTreeDelete(childIndex, key);
+        int child = node->children[idx];
+        node.release();
+        return BTreeDelete(child, key);
     }
     catch (const std::exception& e) {
         std::cerr << "BTreeDelete Exception: " << e.what() << "\n";
@@ -552,47 +821,45 @@ bool MiniHSFS::BTreeDelete(int nodeIndex, int key) {
 
 bool MiniHSFS::BTreeMergeChildren(int parentIndex, int index) {
     try {
-        BTreeNode parent = LoadBTreeNode(parentIndex);
-        int leftIndex = parent.children[index];
-        int rightIndex = parent.children[index + 1];
-
-        BTreeNode left = LoadBTreeNode(leftIndex);
-        BTreeNode right = LoadBTreeNode(rightIndex);
-
-        // Add the parent key between the two nodes
-        left.keys[left.keyCount] = parent.keys[index];
-        if (left.isLeaf)
-            left.values[left.keyCount] = right.values[0]; // Or keep it as designed
-        left.keyCount++;
-
-        // Copy the right child's keys
-        for (int i = 0; i < right.keyCount; ++i) {
-            left.keys[left.keyCount + i] = right.keys[i];
-            if (left.isLeaf)
-                left.values[left.keyCount + i] = right.values[i];
-        }
-
-        if (!left.isLeaf) {
-            for (int i = 0; i <= right.keyCount; ++i)
-                left.children[left.keyCount + i] = right.children[i];
+        BTreeNodeRef parent = LoadBTreeNode(parentIndex);
+        int leftIndex = parent->children[index];
+        int rightIndex = parent->children[index + 1];
+
+        BTreeNodeRef left = LoadBTreeNode(leftIndex);
+        BTreeNodeRef right = LoadBTreeNode(rightIndex);
+
+        if (left->isLeaf) {
+            // Leaves simply concatenate; the separator disappears
+            for (int i = 0; i < right->keyCount; ++i) {
+                left->keys[left->keyCount + i] = right->keys[i];
+                left->values[left->keyCount + i] = right->values[i];
+            }
+            left->nextLeaf = right->nextLeaf;
         }
         else {
-            // B+ Tree Support
-            left.nextLeaf = right.nextLeaf;
+            // Internal nodes take the separator down between the two halves
+            left->keys[left->keyCount] = parent->keys[index];
+            left->keyCount++;
+            for (int i = 0; i < right->keyCount; ++i) {
+                left->keys[left->keyCount + i] = right->keys[i];
+            }
+            for (int i = 0; i <= right->keyCount; ++i) {
+                left->children[left->keyCount + i] = right->children[i];
+            }
         }
-
-        left.keyCount += right.keyCount;
+        left->keyCount += right->keyCount;
 
         // Transferring keys and children to the father
-        for (int i = index + 1; i < parent.keyCount; ++i)
-            parent.keys[i - 1] = parent.keys[i];
-        for (int i = index + 2; i <= parent.keyCount; ++i)
-            parent.children[i - 1] = parent.children[i];
+        for (int i = index + 1; i < parent->keyCount; ++i)
+            parent->keys[i - 1] = parent->keys[i];
+        for (int i = index + 2; i <= parent->keyCount; ++i)
+            parent->children[i - 1] = parent->children[i];
 
-        parent.keyCount--;
+        parent->keyCount--;
 
-        SaveBTreeNode(leftIndex, left);
-        SaveBTreeNode(parentIndex, parent);
+        SaveBTreeNode(left);
+        SaveBTreeNode(parent);
+        right.release();
         FreeBTreeNode(rightIndex);
 
         return true;
@@ -604,87 +871,99 @@ bool MiniHSFS::BTreeMergeChildren(int parentIndex, int index) {
 }
 
 void MiniHSFS::BTreeFill(int nodeIndex, int index) {
-    BTreeNode node = LoadBTreeNode(nodeIndex);
-    if (index > 0 && LoadBTreeNode(node.children[index - 1]).keyCount >= btreeOrder / 2) {
+    const int minKeys = (btreeOrder - 2) / 2;
+    BTreeNodeRef node = LoadBTreeNode(nodeIndex);
+    if (index > 0 && LoadBTreeNode(node->children[index - 1])->keyCount > minKeys) {
         BTreeBorrowFromLeft(nodeIndex, index);
     }
-    else if (index < node.keyCount && LoadBTreeNode(node.children[index + 1]).keyCount >= btreeOrder / 2) {
+    else if (index < node->keyCount && LoadBTreeNode(node->children[index + 1])->keyCount > minKeys) {
         BTreeBorrowFromRight(nodeIndex, index);
     }
     else {
-        BTreeMergeChildren(nodeIndex, index == node.keyCount ? index - 1 : index);
+        BTreeMergeChildren(nodeIndex, index == node->keyCount ? index - 1 : index);
     }
 }
 
 void MiniHSFS::BTreeBorrowFromLeft(int nodeIndex, int index) {
-    BTreeNode parent = LoadBTreeNode(nodeIndex);
-    BTreeNode child = LoadBTreeNode(parent.children[index]);
-    BTreeNode left = LoadBTreeNode(parent.children[index - 1]);
+    BTreeNodeRef parent = LoadBTreeNode(nodeIndex);
+    BTreeNodeRef child = LoadBTreeNode(parent->children[index]);
+    BTreeNodeRef left = LoadBTreeNode(parent->children[index - 1]);
 
-    for (int i = child.keyCount - 1; i >= 0; i--) {
-        child.keys[i + 1] = child.keys[i];
-        if (child.isLeaf) child.values[i + 1] = child.values[i];
-    }
-    if (!child.isLeaf) {
-        for (int i = child.keyCount; i >= 0; i--) child.children[i + 1] = child.children[i];
-        child.children[0] = left.children[left.keyCount];
+    for (int i = child->keyCount - 1; i >= 0; i--) {
+        child->keys[i + 1] = child->keys[i];
+        if (child->isLeaf) child->values[i + 1] = child->values[i];
     }
 
-    child.keys[0] = parent.keys[index - 1];
-    if (child.isLeaf) child.values[0] = left.values[left.keyCount - 1];
-    parent.keys[index - 1] = left.keys[left.keyCount - 1];
+    if (child->isLeaf) {
+        // The entry itself moves and becomes the new separator
+        child->keys[0] = left->keys[left->keyCount - 1];
+        child->values[0] = left->values[left->keyCount - 1];
+        parent->keys[index - 1] = child->keys[0];
+    }
+    else {
+        for (int i = child->keyCount; i >= 0; i--) child->children[i + 1] = child->children[i];
+        child->children[0] = left->children[left->keyCount];
+        child->keys[0] = parent->keys[index - 1];
+        parent->keys[index - 1] = left->keys[left->keyCount - 1];
+    }
 
-    child.keyCount++;
-    left.keyCount--;
+    child->keyCount++;
+    left->keyCount--;
 
-    SaveBTreeNode(nodeIndex, parent);
-    SaveBTreeNode(parent.children[index], child);
-    SaveBTreeNode(parent.children[index - 1], left);
+    SaveBTreeNode(parent);
+    SaveBTreeNode(child);
+    SaveBTreeNode(left);
 }
 
 void MiniHSFS::BTreeBorrowFromRight(int nodeIndex, int index) {
-    BTreeNode parent = LoadBTreeNode(nodeIndex);
-    BTreeNode child = LoadBTreeNode(parent.children[index]);
-    BTreeNode right = LoadBTreeNode(parent.children[index + 1]);
-
-    child.keys[child.keyCount] = parent.keys[index];
-    if (child.isLeaf) child.values[child.keyCount] = right.values[0];
-    if (!child.isLeaf) child.children[child.keyCount + 1] = right.children[0];
+    BTreeNodeRef parent = LoadBTreeNode(nodeIndex);
+    BTreeNodeRef child = LoadBTreeNode(parent->children[index]);
+    BTreeNodeRef right = LoadBTreeNode(parent->children[index + 1]);
 
-    parent.keys[index] = right.keys[0];
+    if (child->isLeaf) {
+        child->keys[child->keyCount] = right->keys[0];
+        child->values[child->keyCount] = right->values[0];
+    }
+    else {
+        child->keys[child->keyCount] = parent->keys[index];
+        child->children[child->keyCount + 1] = right->children[0];
+        parent->keys[index] = right->keys[0];
+    }
 
-    for (int i = 1; i < right.keyCount; i++) {
-        right.keys[i - 1] = right.keys[i];
-        if (right.isLeaf) right.values[i - 1] = right.values[i];
+    for (int i = 1; i < right->keyCount; i++) {
+        right->keys[i - 1] = right->keys[i];
+        if (right->isLeaf) right->values[i - 1] = right->values[i];
     }
-    if (!right.isLeaf) {
-        for (int i = 1; i <= right.keyCount; i++) right.children[i - 1] = right.children[i];
+    if (!right->isLeaf) {
+        for (int i = 1; i <= right->keyCount; i++) right->children[i - 1] = right->children[i];
     }
 
-    child.keyCount++;
-    right.keyCount--;
+    child->keyCount++;
+    right->keyCount--;
 
-    SaveBTreeNode(nodeIndex, parent);
-    SaveBTreeNode(parent.children[index], child);
-    SaveBTreeNode(parent.children[index + 1], right);
+    // A leaf separator is the right sibling's new first key
+    if (child->isLeaf) parent->keys[index] = right->keys[0];
+
+    SaveBTreeNode(parent);
+    SaveBTreeNode(child);
+    SaveBTreeNode(right);
 }
 
 bool MiniHSFS::BTreeDeleteFromLeaf(int nodeIndex, int index) {
     try {
-        BTreeNode node = LoadBTreeNode(nodeIndex);
+        BTreeNodeRef node = LoadBTreeNode(nodeIndex);
 
-        if (index < 0 || index >= node.keyCount) {
+        if (index < 0 || index >= node->keyCount) {
             throw std::out_of_range("Invalid index in BTreeDeleteFromLeaf");
         }
 
-        for (int i = index + 1; i < node.keyCount; ++i) {
-            node.keys[i - 1] = node.keys[i];
-            node.values[i - 1] = node.values[i];  // No need for isLeaf
+        for (int i = index + 1; i < node->keyCount; ++i) {
+            node->keys[i - 1] = node->keys[i];
+            node->values[i - 1] = node->values[i];  // No need for isLeaf
         }
 
-        node.keyCount--;
-        node.isDirty = true;
-        SaveBTreeNode(nodeIndex, node);
+        node->keyCount--;
+        SaveBTreeNode(node);
 
         return true;
     }
@@ -694,83 +973,85 @@ bool MiniHSFS::BTreeDeleteFromLeaf(int nodeIndex, int index) {
     }
 }
 
-bool MiniHSFS::BTreeDeleteFromNonLeaf(int nodeIndex, int index) {
-    try {
-        BTreeNode node = LoadBTreeNode(nodeIndex);
-
-        // Input validation
-        if (index < 0 || index >= node.keyCount) {
-            throw std::out_of_range("Invalid index in BTreeDeleteFromNonLeaf");
-        }
+///////////////////////////////Free Extent Map
 
-        int key = node.keys[index];
+void MiniHSFS::FreeMapInsert(int start, int length) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    if (btreeStale || length <= 0) return; // a stale tree is rebuilt whole
 
-        // Case 1: The left child has enough keys.
-        BTreeNode leftChild = LoadBTreeNode(node.children[index]);
-        if (leftChild.keyCount >= (btreeOrder + 1) / 2) {
-            int predecessor = BTreeGetPredecessor(node.children[index]);
-            node.keys[index] = predecessor;
-            node.isDirty = true;
-            SaveBTreeNode(nodeIndex, node);
-            return BTreeDelete(node.children[index], predecessor);
-        }
+    try {
+        int64_t newStart = start;
+        int64_t newEnd = static_cast<int64_t>(start) + length;
+        int runStart, runLength;
 
-        // Case 2: The right child has enough keys.
-        BTreeNode rightChild = LoadBTreeNode(node.children[index + 1]);
-        if (rightChild.keyCount >= (btreeOrder + 1) / 2) {
-            int successor = BTreeGetSuccessor(node.children[index + 1]);
-            node.keys[index] = successor;
-            node.isDirty = true;
-            SaveBTreeNode(nodeIndex, node);
-            return BTreeDelete(node.children[index + 1], successor);
+        // Absorb a run ending at (or overlapping) the new one, then every run it reaches
+        if (BTreeFloor(start, runStart, runLength) && static_cast<int64_t>(runStart) + runLength >= start) {
+            newStart = runStart;
+            newEnd = (std::max)(newEnd, static_cast<int64_t>(runStart) + runLength);
         }
-
-        // Case 3: Required Merger
-        if (!BTreeMergeChildren(nodeIndex, index)) {
-            throw std::runtime_error("Failed to merge children");
+        while (BTreeCeiling(static_cast<int>(newStart) + 1, runStart, runLength) && runStart <= newEnd) {
+            newEnd = (std::max)(newEnd, static_cast<int64_t>(runStart) + runLength);
+            BTreeDelete(rootNodeIndex, runStart);
         }
 
-        // Reload node after merge
-        node = LoadBTreeNode(nodeIndex);
-        return BTreeDelete(node.children[index], key);
-
+        BTreeInsert(rootNodeIndex, static_cast<int>(newStart), static_cast<int>(newEnd - newStart));
     }
     catch (const std::exception& e) {
-        std::cerr << "Error in BTreeDeleteFromNonLeaf: " << e.what() << std::endl;
-        return false;
+        std::cerr << "Free map update failed: " << e.what() << std::endl;
+        MarkBTreeStale();
     }
 }
 
-int MiniHSFS::BTreeGetPredecessor(int nodeIndex) {
-    BTreeNode node = LoadBTreeNode(nodeIndex);
-    while (!node.isLeaf) node = LoadBTreeNode(node.children[node.keyCount]);
-    return node.keys[node.keyCount - 1];
-}
+void MiniHSFS::FreeMapRemove(int start, int length) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    if (btreeStale || length <= 0) return; // a stale tree is rebuilt whole
 
-int MiniHSFS::BTreeGetSuccessor(int nodeIndex) {
-    BTreeNode node = LoadBTreeNode(nodeIndex);
-    while (!node.isLeaf) node = LoadBTreeNode(node.children[0]);
-    return node.keys[0];
+    try {
+        const int64_t end = static_cast<int64_t>(start) + length;
+        int runStart, runLength;
+
+        // A run starting before the range is cut short, and split if it also reaches past it
+        if (BTreeFloor(start, runStart, runLength) && runStart < start && static_cast<int64_t>(runStart) + runLength > start) {
+            BTreeInsert(rootNodeIndex, runStart, start - runStart);
+            if (static_cast<int64_t>(runStart) + runLength > end) {
+                BTreeInsert(rootNodeIndex, static_cast<int>(end), static_cast<int>(runStart + runLength - end));
+                return;
+            }
+        }
+
+        // Runs starting inside the range go; the last may leave a tail
+        while (BTreeCeiling(start, runStart, runLength) && runStart < end) {
+            BTreeDelete(rootNodeIndex, runStart);
+            if (static_cast<int64_t>(runStart) + runLength > end) {
+                BTreeInsert(rootNodeIndex, static_cast<int>(end), static_cast<int>(runStart + runLength - end));
+                break;
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Free map update failed: " << e.what() << std::endl;
+        MarkBTreeStale();
+    }
 }
 
 /////////////////////////////////Load and Save Tables
 
 MiniHSFS::SuperblockInfo MiniHSFS::LoadSuperblock() {
-    std::vector<char> data = disk.readData(
-        VirtualDisk::Extent{ static_cast<uint32_t>(superBlockIndex), static_cast<uint32_t>(superBlockBlocks) });
-
+    // Read straight into the struct; a short read leaves the rest zeroed
     SuperblockInfo info;
-    std::memcpy(&info, data.data(), sizeof(SuperblockInfo));
+    std::memset(&info, 0, sizeof(SuperblockInfo));
+    disk.readInto(VirtualDisk::Extent{ static_cast<uint32_t>(superBlockIndex), static_cast<uint32_t>(superBlockBlocks) },
+        0, sizeof(SuperblockInfo), reinterpret_cast<char*>(&info));
 
     return info;
 }
 
 void MiniHSFS::SaveSuperblock(const SuperblockInfo& info) {
-    std::vector<char> data(superBlockBlocks * disk.blockSize, 0);
+    auto data = disk.acquireBuffer(superBlockBlocks * disk.blockSize, true);
 
     std::memcpy(data.data(), &info, sizeof(SuperblockInfo));
-    disk.writeData(data,
-        VirtualDisk::Extent{ static_cast<uint32_t>(superBlockIndex), static_cast<uint32_t>(superBlockBlocks) }, "", false);
+    disk.writeFrom(
+        VirtualDisk::Extent{ static_cast<uint32_t>(superBlockIndex), static_cast<uint32_t>(superBlockBlocks) }, data.data(), false);
 
 }
 
@@ -783,7 +1064,7 @@ void MiniHSFS::UpdateSuperblockForDynamicInodes() {
     info.dataStartIndex = dataStartIndex;
 
     // Update the system size to reflect the expansion of the inodes area
-    info.systemSize = static_cast<uint32_t>(disk.getSystemBlocks() + superBlockBlocks + inodeBlocks + btreeBlocks);
+    info.systemSize = static_cast<uint32_t>(disk.getSystemBlocks() + superBlockBlocks + inodeBlocks + btreeBlocks + checksumBlocks);
 
     SaveSuperblock(info);
 }
@@ -798,13 +1079,19 @@ void MiniHSFS::LoadInodeTable() {
     inodeBlocks = CalculateBlocksForNewInodes(inodeCount); // Calculate how many blocks we need to read
     inodeTable.assign(inodeCount, Inode{});
 
-    // Read all blocks of the iode table
+    // Read all blocks of the iode table in a single batch
     size_t bytes = inodeBlocks * disk.blockSize;
     std::vector<char> buf(bytes, 0);
+    std::vector<VirtualDisk::BatchRequest> reads(inodeBlocks);
+    for (size_t b = 0; b < inodeBlocks; ++b) {
+        reads[b].extent = VirtualDisk::Extent(disk.getSystemBlocks() + static_cast<uint32_t>(superBlockBlocks) + static_cast<uint32_t>(b), 1);
+        reads[b].buffer = buf.data() + b * disk.blockSize;
+    }
+    disk.runBatch(reads);
+
+    // A block that failed to read decodes as empty inodes
     for (size_t b = 0; b < inodeBlocks; ++b) {
-        auto data = disk.readData(
-            VirtualDisk::Extent(disk.getSystemBlocks() + static_cast<uint32_t>(superBlockBlocks) + static_cast<uint32_t>(b), 1));
-        std::copy(data.begin(), data.end(), buf.begin() + b * disk.blockSize);
+        if (!reads[b].ok) std::fill_n(reads[b].buffer, disk.blockSize, 0);
     }
 
     // Decode each inode
@@ -826,19 +1113,19 @@ void MiniHSFS::SaveInodeTable() {
         VirtualDisk::Extent ext(disk.getSystemBlocks() + static_cast<uint32_t>(superBlockBlocks) + static_cast<uint32_t>(inodeBlocks), static_cast<uint32_t>(add));
         disk.allocateBlocks(ext.blockCount);
 
-        std::vector<char> zero(disk.blockSize, 0);
-        for (size_t i = 0; i < add; ++i)
-            disk.writeData(zero, VirtualDisk::Extent(ext.startBlock + static_cast<uint32_t>(i), 1), "", true);
-
         inodeBlocks = requiredBlocks;
+        ClipBTreeArea();
+        disk.zeroBlocks(ext, true);
+
         UpdateSuperblockForDynamicInodes();
     }
 
-    std::vector<char> big(inodeBlocks * disk.blockSize, 0);
+    const size_t tableBytes = inodeBlocks * disk.blockSize;
+    auto big = disk.acquireBuffer(tableBytes, true);
     size_t ok = 0;
     for (size_t i = 0; i < inodeTable.size(); ++i) {
         size_t off = i * inodeSize;
-        if (off + inodeSize > big.size())
+        if (off + inodeSize > tableBytes)
             throw std::runtime_error("SaveInodeTable: inode area too small");
 
         /////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -850,13 +1137,16 @@ void MiniHSFS::SaveInodeTable() {
         ok++;
     }
 
+    // Submit every inode block at once; one flush covers the whole table
+    std::vector<VirtualDisk::BatchRequest> writes(inodeBlocks);
     for (size_t b = 0; b < inodeBlocks; ++b) {
-        uint32_t phys = disk.getSystemBlocks() + superBlockBlocks + static_cast<uint32_t>(b);
-        size_t start = b * disk.blockSize;
-        size_t end = (std::min)(start + (size_t)disk.blockSize, big.size());
-        std::vector<char> blk(big.begin() + start, big.begin() + end);
-        disk.writeData(blk, VirtualDisk::Extent(phys, 1), "", true);
+        writes[b].extent = VirtualDisk::Extent(disk.getSystemBlocks() + superBlockBlocks + static_cast<uint32_t>(b), 1);
+        writes[b].buffer = big.data() + b * disk.blockSize;
+        writes[b].write = true;
     }
+    if (!disk.runBatch(writes, true))
+        throw std::runtime_error("SaveInodeTable: failed to write inode blocks");
+    dirtyInodes.clear();
 
     UpdateSuperblockForDynamicInodes();
 }
@@ -864,100 +1154,86 @@ void MiniHSFS::SaveInodeTable() {
 void MiniHSFS::LoadBTree() {
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
+    // An older per-block tree, or one not closed cleanly, is rebuilt from the bitmap when needed
+    SuperblockInfo info = LoadSuperblock();
+    btreeStale = (info.features & featureBTreeStale) != 0 || (info.features & featureExtentFreeMap) == 0;
+    if (btreeStale) return;
+
     try {
-        // Load root data from disk
-        auto rootData = disk.readData(VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + rootNodeIndex), 1 });
+        // Walk the tree from the root; nodes it does not reach are free
+        std::vector<bool> reached(btreeBlocks, false);
+        std::vector<int> pending{ rootNodeIndex };
+        while (!pending.empty()) {
+            int index = pending.back();
+            pending.pop_back();
+            if (index < 0 || index >= btreeBlocks || reached[index]) {
+                throw std::runtime_error("B-tree node reached twice or out of range");
+            }
+            reached[index] = true;
 
-        // Use the correct btreeOrder in the configuration
-        BTreeNode rootNode(btreeOrder);
-        DeserializeBTreeNode(rootNode, rootData.data());
+            BTreeNodeRef node = LoadBTreeNode(index);
+            if (!node->isLeaf) {
+                for (int i = 0; i <= node->keyCount; ++i) pending.push_back(node->children[i]);
+            }
+        }
 
-        // Store root in cache
-        btreeCache[rootNodeIndex] = std::move(rootNode);
-        TouchBTreeNode(rootNodeIndex);
+        freeBTreeBlocksCache.clear();
+        for (int i = btreeBlocks - 1; i >= 0; --i) {
+            if (!reached[i]) freeBTreeBlocksCache.push_back(i);
+        }
     }
     catch (...) {
-        // If the upload fails, rebuild the tree from scratch.
-        InitializeBTree();
+        // If the upload fails, rebuild the tree from the bitmap when needed
+        MarkBTreeStale();
     }
 }
 
 void MiniHSFS::SaveBTree() {
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
-    for (auto& entry : btreeCache) {
-        if (entry.second.isDirty) {
-            SaveBTreeNode(entry.first, entry.second);
-            entry.second.isDirty = false;
-        }
-    }
+    nodeCache.flush();
 }
 
-MiniHSFS::BTreeNode MiniHSFS::LoadBTreeNode(int nodeIndex) {
-    try {
-        if (nodeIndex < 0 || nodeIndex >= btreeBlocks) {
-            throw std::out_of_range("Invalid B-tree node index");
-        }
-
-        auto it = btreeCache.find(nodeIndex);
-        if (it != btreeCache.end()) {
-            it->second.accessCount++;
-            TouchBTreeNode(nodeIndex);
-            return it->second;
-        }
-
-        // Load node data from disk
-        auto nodeData = disk.readData(
-            VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + nodeIndex), 1 });
-
-        BTreeNode node(btreeOrder);
-        DeserializeBTreeNode(node, nodeData.data());
-
-        node.accessCount = 1;
-        btreeCache[nodeIndex] = node;
-        TouchBTreeNode(nodeIndex);
-
-        btreeLoadCounter++;
-        if (btreeLoadCounter >= 100) {
-            for (auto& entry : btreeCache) {
-                entry.second.accessCount /= 2;
-            }
-            btreeLoadCounter = 0;
-        }
-
-        return node;
-    }
-    catch (const std::bad_alloc&) {
-        std::cerr << "!! Memory pressure detected during BTree node load. Clearing BTree cache.\n";
-        btreeCache.clear();
-        btreeLruMap.clear();
-        btreeLruList.clear();
-        throw;
+MiniHSFS::BTreeNodeRef MiniHSFS::LoadBTreeNode(int nodeIndex) {
+    if (nodeIndex < 0 || nodeIndex >= btreeBlocks) {
+        throw std::out_of_range("Invalid B-tree node index");
     }
+    return nodeCache.get(nodeIndex);
 }
 
-void MiniHSFS::SaveBTreeNode(int nodeIndex, const BTreeNode& node) {
+MiniHSFS::BTreeNodeRef MiniHSFS::NewBTreeNode(int nodeIndex, bool leaf) {
     if (nodeIndex < 0 || nodeIndex >= btreeBlocks) {
         throw std::out_of_range("Invalid B-tree node index");
     }
+    return nodeCache.create(nodeIndex, leaf);
+}
 
-    std::vector<char> buffer(disk.blockSize, 0);
-    SerializeBTreeNode(node, buffer.data());
-
-    disk.writeData(buffer,
-        VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + nodeIndex), 1 },
-        "", true);
+void MiniHSFS::ReadBTreeNode(int nodeIndex, BTreeNode& node) {
+    // Decode straight into the cache slot from the reused block buffer
+    nodeReadBuffer.resize(disk.blockSize);
+    disk.readInto(VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + nodeIndex), 1 },
+        0, nodeReadBuffer.size(), nodeReadBuffer.data());
+    DeserializeBTreeNode(node, nodeReadBuffer.data());
+}
 
-    // Update the cache without resetting the entire node
-    auto it = btreeCache.find(nodeIndex);
-    if (it != btreeCache.end()) {
-        it->second.isDirty = false;
-    }
-    else {
-        btreeCache[nodeIndex] = node;
-        btreeCache[nodeIndex].isDirty = false;
+void MiniHSFS::SaveBTreeNode(const BTreeNodeRef& node) {
+    if (writeBack) {
+        // Written by the flusher, or by the cache when it evicts the node
+        nodeCache.markDirty(node);
+        NoteDirty();
+        return;
     }
 
-    TouchBTreeNode(nodeIndex);
+    WriteBTreeNode(node.index(), *node);
+    nodeCache.markClean(node);
+}
+
+void MiniHSFS::WriteBTreeNode(int nodeIndex, const BTreeNode& node, bool flushImmediately) {
+    auto buffer = disk.acquireBuffer(disk.blockSize, true);
+    SerializeBTreeNode(node, buffer.data());
+
+    disk.writeFrom(
+        VirtualDisk::Extent{ static_cast<uint32_t>(btreeStartIndex + nodeIndex), 1 },
+        buffer.data(), flushImmediately);
 }
 
 /////////////////////////////File System Operations
@@ -969,39 +1245,33 @@ VirtualDisk::Extent MiniHSFS::AllocateContiguousBlocks(int blocksNeeded) {
         throw std::invalid_argument("Block count must be positive");
     }
 
-    // First: Try customizing directly
-    try {
-
-        VirtualDisk::Extent extent = disk.allocateBlocks(blocksNeeded);
-
-        if (extent.blockCount > 100)
-        {
-            for (uint32_t i = 0; i < extent.blockCount; ++i) {
-                MarkBlockUsed(extent.startBlock + i);
-            }
-        }
-        else
-            MarkBlocksUsed(extent);
-
-        return extent;
-    }
-    catch (const VirtualDisk::DiskFullException&) {
-        // If it fails, defragment and try again
-        DefragmentDisk();
-
-        // Try allocating again after defragmenting
+    // The disk's free-extent index decides; the B-tree free map follows with one carve
+    auto tryAllocate = [&](VirtualDisk::Extent& extent) {
         try {
-            VirtualDisk::Extent extent = disk.allocateBlocks(blocksNeeded);
-            for (uint32_t i = 0; i < extent.blockCount; ++i) {
-                MarkBlockUsed(extent.startBlock + i);
-            }
-            return extent;
+            extent = disk.allocateBlocks(blocksNeeded);
         }
         catch (const VirtualDisk::DiskFullException&) {
-            VirtualDisk::Extent extent(-1, 0);
-            return extent;
+            return false;
         }
+        FreeMapRemove(extent.startBlock, extent.blockCount);
+        return true;
+        };
+
+    VirtualDisk::Extent extent(-1, 0);
+    if (tryAllocate(extent)) return extent;
+
+    // Blocks freed in write-back mode come back once the inodes that dropped them are written
+    if (!pendingFrees.empty()) {
+        FlushMetadata();
+        if (tryAllocate(extent)) return extent;
     }
+
+    // If it fails, defragment and try again
+    if (defragmenting) return VirtualDisk::Extent(-1, 0);
+    DefragmentDisk();
+    if (tryAllocate(extent)) return extent;
+
+    return VirtualDisk::Extent(-1, 0);
 }
 
 int MiniHSFS::AllocateInode(bool isDirectory) {
@@ -1148,6 +1418,9 @@ void MiniHSFS::PrintSuperblockInfo() {
     printField("Free Blocks", std::to_string(info.freeBlocks));
     printField("Total Inodes", std::to_string(info.totalInodes));
     printField("Free Inodes", std::to_string(info.freeInodes));
+    printField("Inode Checksum", info.version < crc32cVersion ? "legacy" : "CRC32C");
+    printField("Data Checksums", (info.features & featureDataChecksums)
+        ? std::to_string(info.checksumBlocks) + " blocks at " + std::to_string(info.checksumStart) : "off");
 
     char buffer[26];
 #ifdef _WIN32
@@ -1180,6 +1453,8 @@ void MiniHSFS::PrintBTreeStructure() {
         return;
     }
 
+    ReconcileBTree();
+
     std::cout << "\n\033[1m\033[34mB-Tree Structure (Root: " << rootNodeIndex << ")\033[0m\n";
     std::cout << "\033[34m----------------------------------------\033[0m\n";
 
@@ -1207,7 +1482,7 @@ void MiniHSFS::PrintBTreeStructure() {
         visitedNodes.insert(current.index);
 
         try {
-            BTreeNode node = LoadBTreeNode(current.index);
+            BTreeNodeRef node = LoadBTreeNode(current.index);
 
             // Indents by level
             for (int i = 0; i < current.level; i++) {
@@ -1216,49 +1491,49 @@ void MiniHSFS::PrintBTreeStructure() {
 
             // Node information
             std::cout << "\033[1m\033[36m[" << current.index << "] "
-                << (node.isLeaf ? "\033[32mLeaf\033[0m" : "\033[33mNode\033[0m")
-                << " (" << node.keyCount << " keys)\033[0m: ";
+                << (node->isLeaf ? "\033[32mLeaf\033[0m" : "\033[33mNode\033[0m")
+                << " (" << node->keyCount << " keys)\033[0m: ";
 
             // Print keys and values
-            for (int i = 0; i < node.keyCount; i++) {
-                std::cout << "\033[35m" << node.keys[i] << "\033[0m";
-                if (node.isLeaf) {
-                    std::cout << (node.values[i] ? "\033[92m(U)\033[0m" : "\033[90m(F)\033[0m");
+            for (int i = 0; i < node->keyCount; i++) {
+                std::cout << "\033[35m" << node->keys[i] << "\033[0m";
+                if (node->isLeaf) {
+                    std::cout << "\033[90m(+" << node->values[i] << ")\033[0m"; // free run length
                 }
-                if (i < node.keyCount - 1) std::cout << ", ";
+                if (i < node->keyCount - 1) std::cout << ", ";
             }
 
             // Print children's indicators for internal nodes
-            if (!node.isLeaf) {
+            if (!node->isLeaf) {
                 std::cout << " \033[34m[Children: ";
-                for (int i = 0; i <= node.keyCount; i++) {
-                    if (node.children[i] != -1) {
-                        std::cout << node.children[i];
-                        if (i < node.keyCount) std::cout << ", ";
+                for (int i = 0; i <= node->keyCount; i++) {
+                    if (node->children[i] != -1) {
+                        std::cout << node->children[i];
+                        if (i < node->keyCount) std::cout << ", ";
                     }
                 }
                 std::cout << "]\033[0m";
             }
 
             // Print the next sheet index if present
-            if (node.isLeaf && node.nextLeaf != -1) {
-                std::cout << " \033[90m-> Next: " << node.nextLeaf << "\033[0m";
+            if (node->isLeaf && node->nextLeaf != -1) {
+                std::cout << " \033[90m-> Next: " << node->nextLeaf << "\033[0m";
             }
 
             std::cout << std::endl;
 
             // Add contract to waiting list
-            if (!node.isLeaf && !current.from_next_leaf) {
+            if (!node->isLeaf && !current.from_next_leaf) {
                 // For internal nodes: Add children
-                for (int i = node.keyCount; i >= 0; i--) {
-                    if (node.children[i] != -1) {
-                        nodes.push_front({ node.children[i], current.level + 1, false });
+                for (int i = node->keyCount; i >= 0; i--) {
+                    if (node->children[i] != -1) {
+                        nodes.push_front({ node->children[i], current.level + 1, false });
                     }
                 }
             }
-            else if (node.isLeaf && node.nextLeaf != -1) {
+            else if (node->isLeaf && node->nextLeaf != -1) {
                 // For paper knots: Follow the chain
-                nodes.push_back({ node.nextLeaf, current.level, true });
+                nodes.push_back({ node->nextLeaf, current.level, true });
             }
         }
         catch (const std::exception& e) {
@@ -1276,35 +1551,14 @@ void MiniHSFS::PrintBTreeStructure() {
 int MiniHSFS::FindFreeBlock() {
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
+    // One descent of the free map; the disk answers while the tree is stale
     auto searchFreeBlock = [this]() -> int {
-        int currentLeaf = rootNodeIndex;
-
-        // Move to the first leaf node
-        while (!btreeCache[currentLeaf].isLeaf) {
-            currentLeaf = btreeCache[currentLeaf].children[0];
-        }
-
-        // Search paper nodes
-        while (currentLeaf != -1) {
-            BTreeNode& leaf = btreeCache[currentLeaf];
-
-            for (int i = 0; i < leaf.keyCount; ++i) {
-                if (leaf.values[i] == 0) {  //Free block
-                    int block = leaf.keys[i];
-
-                    // Check block scope and grouping preference
-                    if (block >= dataStartIndex) {
-                        // Prefer contiguous blocks (optimize for fragmentation)
-                        if (i + 1 < leaf.keyCount && leaf.values[i + 1] == 0) {
-                            return leaf.keys[i + 1];  // Return the next block to help with contiguous allocation
-                        }
-                        return block;
-                    }
-                }
-            }
-            currentLeaf = leaf.nextLeaf;  // Move to the next leaf node
+        if (!btreeStale) {
+            int start, length;
+            return BTreeCeiling(dataStartIndex, start, length) ? start : -1;
         }
-        return -1;  // No free blocks found
+        uint32_t block = disk.findContiguousBlocks(1);
+        return block == UINT32_MAX ? -1 : static_cast<int>(block);
         };
 
     //First attempt
@@ -1390,182 +1644,62 @@ int MiniHSFS::FindFile(const std::string& path) {
     return currentInode;
 }
 
-void MiniHSFS::MarkBlockUsed(int blockIndex) {
-    std::lock_guard<std::recursive_mutex> lock(fsMutex);
-
-    // Quick check of cache first
-    auto rootIt = btreeCache.find(rootNodeIndex);
-    if (rootIt != btreeCache.end()) {
-        BTreeNode& rootNode = rootIt->second;
-
-        // Fast binary search in the root node
-        auto it = std::lower_bound(rootNode.keys, rootNode.keys + rootNode.keyCount, blockIndex);
-        int pos = it - rootNode.keys;
-
-        if (pos < rootNode.keyCount && rootNode.keys[pos] == blockIndex) {
-            if (rootNode.values[pos] != 1) {
-                rootNode.values[pos] = 1;
-                rootNode.isDirty = true;
+bool MiniHSFS::MoveFileBlocks(int inodeIndex, uint32_t oldStart, uint32_t newStart, uint32_t blockCount) {
+    try {
+        const size_t blockSize = disk.blockSize;
+
+        // Read data (raw blocks, so trailing zeros survive the move)
+        const size_t bytes = static_cast<size_t>(blockCount) * blockSize;
+        auto fileData = disk.acquireBuffer(bytes);
+        std::vector<VirtualDisk::BatchRequest> batch(1);
+        batch[0].extent = VirtualDisk::Extent(oldStart, blockCount);
+        batch[0].buffer = fileData.data();
+        if (!disk.runBatch(batch)) {
+            throw std::runtime_error("Failed to read source blocks");
+        }
+
+        // Claim the new location on the disk, write it, then free the vacated blocks (which also
+        // punches them out of the image). Blocks shared by both ranges stay with the file.
+        uint32_t oldEnd = oldStart + blockCount;
+        uint32_t newEnd = newStart + blockCount;
+
+        std::vector<VirtualDisk::Extent> claimed;
+        auto releaseClaimed = [&]() {
+            for (const auto& range : claimed) disk.freeBlocks(range);
+            };
+        auto claimRange = [&](uint32_t from, uint32_t to) {
+            if (from >= to) return;
+            VirtualDisk::Extent range(from, to - from);
+            if (!disk.reserveBlocks(range)) {
+                releaseClaimed();
+                throw std::runtime_error("Destination blocks are in use");
             }
-            return;  // Updated successfully
-        }
-    }
-    // If not in root, use global insertion
-    if (!BTreeInsert(rootNodeIndex, blockIndex, 1)) {
-        throw std::runtime_error("Failed to mark block as used");
-    }
-}
-
-void MiniHSFS::MarkBlocksUsed(const VirtualDisk::Extent& extent) {
-    std::lock_guard<std::recursive_mutex> lock(fsMutex);
-
-    // Helper functions
-    auto logError = [](const std::string& msg) {
-        std::cerr << "\n[ERROR] " << msg << std::endl;
-        };
-
-    auto showProgress = [](int processed, int total) {
-        int percent = static_cast<int>((processed * 100.0) / total);
-        std::cerr << "\rMarking blocks: " << percent << "% ("
-            << processed << "/" << total << ")" << std::flush;
-        };
-
-    // Validate input
-    if (extent.startBlock < static_cast<uint32_t>(dataStartIndex) || extent.startBlock + extent.blockCount > disk.totalBlocks()) {
-        std::ostringstream msg;
-        msg << "Invalid block range [" << extent.startBlock << ", "
-            << extent.startBlock + extent.blockCount << "]";
-        logError(msg.str());
-        throw std::invalid_argument(msg.str());
-    }
-
-    const int totalBlocks = extent.blockCount;
-    int processed = 0;
-    bool hasErrors = false;
-
-    // Processing large batches
-    constexpr int batchThreshold = 2;
-    if (totalBlocks >= batchThreshold) {
-        try {
-            int currentBlock = extent.startBlock;
-            int remaining = totalBlocks;
-            int lastUsedNodeIndex = -1;
-            BTreeNode lastUsedNode(btreeOrder);
-            bool hasLastNode = false;
-
-            while (remaining > 0) {
-                // Find the appropriate node
-                int nodeIndex = rootNodeIndex;
-                BTreeNode node;
-
-                if (hasLastNode && currentBlock > lastUsedNode.keys[0] &&
-                    currentBlock < lastUsedNode.keys[lastUsedNode.keyCount - 1]) {
-                    nodeIndex = lastUsedNodeIndex;
-                    node = lastUsedNode;
-                }
-                else {
-                    int cur = rootNodeIndex;
-                    node = LoadBTreeNode(cur);
-
-                    while (!node.isLeaf) {
-                        int i = 0;
-                        while (i < node.keyCount && currentBlock > node.keys[i]) i++;
-                        cur = node.children[i];
-                        node = LoadBTreeNode(cur);
-                    }
-                    nodeIndex = cur;
-                }
-
-                // Insert blocks into the node
-                int available = (btreeOrder - 1) - node.keyCount;
-                int blocksToInsert = (std::min)(remaining, available);
-
-                for (int i = 0; i < blocksToInsert; ++i) {
-                    int key = currentBlock;
-                    int pos = 0;
-
-                    // Find the right position
-                    while (pos < node.keyCount && key > node.keys[pos]) pos++;
-
-                    if (pos < node.keyCount&& node.keys[pos] == key) {
-                        node.values[pos] = 1; // Update an existing block
-                    }
-                    else {
-                        // Insert a new block
-                        for (int j = node.keyCount; j > pos; --j) {
-                            node.keys[j] = node.keys[j - 1];
-                            node.values[j] = node.values[j - 1];
-                        }
-                        node.keys[pos] = key;
-                        node.values[pos] = 1;
-                        node.keyCount++;
-                    }
-
-                    currentBlock++;
-                    remaining--;
-                    processed++;
-                    showProgress(processed, totalBlocks);
-                }
-
-                node.isDirty = true;
-                SaveBTreeNode(nodeIndex, node);
-
-                lastUsedNode = node;
-                lastUsedNodeIndex = nodeIndex;
-                hasLastNode = true;
+            claimed.push_back(range);
+            };
+        claimRange(newStart, (std::min)(newEnd, oldStart));
+        claimRange((std::max)(newStart, oldEnd), newEnd);
 
-                if (remaining > 0 && node.keyCount == btreeOrder - 1) {
-                    if (node.nextLeaf == -1) break;
-                }
-            }
-        }
-        catch (const std::exception& e) {
-            logError(std::string("Batch processing failed: ") + e.what());
-            hasErrors = true;
+        batch[0].extent = VirtualDisk::Extent(newStart, blockCount);
+        batch[0].write = true;
+        if (!disk.runBatch(batch, true)) {
+            releaseClaimed();
+            throw std::runtime_error("Failed to write moved blocks");
         }
-    }
 
-    // Process the remaining blocks individually
-    if (processed < totalBlocks) {
-        for (uint32_t i = processed; i < static_cast<uint32_t>(totalBlocks); ++i) {
-            try {
-                BTreeInsert(rootNodeIndex, extent.startBlock + i, 1);
-                processed++;
-                showProgress(processed, totalBlocks);
-            }
-            catch (const std::exception& e) {
-                logError("Failed to mark block " + std::to_string(extent.startBlock + i) +
-                    ": " + e.what());
-                hasErrors = true;
-            }
+        for (const auto& range : claimed) {
+            FreeMapRemove(range.startBlock, range.blockCount);
         }
-    }
-    std::cout << "" << std::endl;
-}
 
-bool MiniHSFS::MoveFileBlocks(int inodeIndex, uint32_t oldStart, uint32_t newStart, uint32_t blockCount) {
-    try {
-        // Read data
-        std::vector<char> fileData = disk.readData(VirtualDisk::Extent(oldStart, blockCount));
-
-        // Writing data to the new location
-        disk.writeData(fileData, VirtualDisk::Extent(newStart, blockCount), "", true);
-
-        // Update the Inode
+        // Update the Inode; it is saved (or queued ahead of the frees) before the old range is released
         inodeTable[inodeIndex].firstBlock = newStart;
         inodeTable[inodeIndex].isDirty = true;
+        SaveInodeToDisk(inodeIndex);
 
-        // Free up old space
-        std::vector<char> zeroBlock(disk.blockSize, 0);
-        for (uint32_t i = 0; i < blockCount; ++i) {
-            disk.writeData(zeroBlock, VirtualDisk::Extent(oldStart + i, 1), "", true);
-        }
-
-        // Update the B-tree
-        for (uint32_t i = 0; i < blockCount; ++i) {
-            BTreeDelete(rootNodeIndex, oldStart + i);
-            BTreeInsert(rootNodeIndex, newStart + i, 1);
-        }
+        auto freeRange = [&](uint32_t from, uint32_t to) {
+            if (from < to) FreeContiguousBlocks(VirtualDisk::Extent(from, to - from));
+            };
+        freeRange(oldStart, (std::min)(oldEnd, newStart));
+        freeRange((std::max)(oldStart, newEnd), oldEnd);
 
         return true;
     }
@@ -1595,6 +1729,25 @@ int MiniHSFS::GetInodeIndex(const Inode& inode) const {
     throw std::runtime_error("Inode not found in inodeTable");
 }
 
+void MiniHSFS::FreeContiguousBlocks(const VirtualDisk::Extent& extent) {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+
+    if (writeBack) {
+        // The inode still naming these blocks may only be dirty in memory: freeing them now would
+        // let the bitmap (and reuse of the blocks) reach the disk first
+        pendingFrees.push_back(extent);
+        NoteDirty();
+        return;
+    }
+
+    ReleaseBlocks(extent);
+}
+
+void MiniHSFS::ReleaseBlocks(const VirtualDisk::Extent& extent) {
+    disk.freeBlocks(extent);
+    FreeMapInsert(extent.startBlock, extent.blockCount);
+}
+
 bool MiniHSFS::FreeFileBlocks(Inode& inode) {
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
@@ -1602,20 +1755,8 @@ bool MiniHSFS::FreeFileBlocks(Inode& inode) {
         return true;  //No need to free
 
     try {
-        for (int i = 0; i < inode.blocksUsed; ++i) {
-            int block = inode.firstBlock + i;
-
-            if (block >= 0 && block < Disk().totalBlocks()) {
-                if (Disk().getBitmap()[block]) {
-                    Disk().setBitmap(block, false);
-                }
-
-                BTreeDelete(rootNodeIndex, block);
-            }
-        }
-
-        // Remove blocks from the disk
-        disk.freeBlocks(VirtualDisk::Extent(inode.firstBlock, inode.blocksUsed));
+        // One extent goes back to the disk and merges into the free map
+        FreeContiguousBlocks(VirtualDisk::Extent(inode.firstBlock, inode.blocksUsed));
 
         // Update the inode
         inode.firstBlock = -1;
@@ -1659,9 +1800,7 @@ void MiniHSFS::FreeInode(int index) {
 }
 
 bool MiniHSFS::IsBlockUsed(int blockIndex) {
-    std::lock_guard<std::recursive_mutex> lock(fsMutex);
-    auto result = BTreeFind(rootNodeIndex, blockIndex);
-    return result.first && result.second == 1;
+    return blockIndex >= 0 && disk.isBlockUsed(static_cast<uint32_t>(blockIndex));
 }
 
 void MiniHSFS::UpdateInodeTimestamps(int inodeIndex, bool modify) {
@@ -1693,7 +1832,7 @@ size_t MiniHSFS::CalculateInodeCount() {
     if (inodePercentage > 1)
         return inodePercentage;
 
-    size_t diskSizeBytes = disk.totalBlocks() * disk.blockSize;
+    size_t diskSizeBytes = disk.initialBlocks() * disk.blockSize; // a grown volume keeps its original layout
 
     double inodeAreaSize = static_cast<double>(diskSizeBytes) * inodePercentage;
     size_t inodeCount = static_cast<size_t>(inodeAreaSize / inodeSize);
@@ -1709,7 +1848,7 @@ size_t MiniHSFS::CalculateBTreeBlocks() {
     if (btreePercentage > 1)
         return btreePercentage;
 
-    size_t totalBlocks = disk.totalBlocks();
+    size_t totalBlocks = disk.initialBlocks();
     size_t suggested = static_cast<size_t>(std::ceil(totalBlocks * btreePercentage));
     return std::max<size_t>(suggested, 16); //Minimum 16 blocks
 }
@@ -1737,6 +1876,11 @@ uint32_t MiniHSFS::CalculateChecksum(const char* data, size_t length) {
     if (data == nullptr || length == 0) {
         return 0;
     }
+    if (!legacyInodeChecksum) {
+        return Crc32c::compute(data, length);
+    }
+
+    // Volumes formatted before version 2 keep their original hash
     uint32_t checksum = 0;
     for (size_t i = 0; i < length; ++i) {
         checksum = (checksum << 4) ^ (checksum >> 28) ^ static_cast<uint8_t>(data[i]);
@@ -1856,7 +2000,6 @@ size_t MiniHSFS::DeserializeInode(Inode& inode, const char* buffer, size_t buffe
         return 0;
     }
 
-    std::vector<char> copy(buffer, buffer + bufferSize);
     size_t offset = 0;
 
     try {
@@ -1945,7 +2088,7 @@ size_t MiniHSFS::DeserializeInode(Inode& inode, const char* buffer, size_t buffe
         if (offset + sizeof(uint32_t) <= bufferSize) {
             uint32_t stored = 0;
             std::memcpy(&stored, buffer + offset, sizeof(stored));
-            uint32_t calc = CalculateChecksum(copy.data(), offset);
+            uint32_t calc = CalculateChecksum(buffer, offset);
             if (stored != calc) {
                 std::cerr << "Checksum mismatch in inode — treating as invalid.\n";
                 inode.isDirty = true;
@@ -2009,7 +2152,11 @@ void MiniHSFS::DeserializeBTreeNode(BTreeNode& node, const char* buffer) {
         throw std::runtime_error("DeserializeBTreeNode: Invalid key count");
     }
 
-    node = BTreeNode(order, isLeaf);
+    if (order != node.order) {
+        throw std::runtime_error("DeserializeBTreeNode: Unexpected order");
+    }
+
+    node.reset(isLeaf);
     node.keyCount = key_count;
 
     read(node.keys, sizeof(int) * (order - 1));
@@ -2102,6 +2249,9 @@ bool MiniHSFS::DefragmentAndExtendInodes(size_t extraInodes) {
         }
     }
 
+    // The vacated range becomes inode area: deferred frees of it must land before it is reused
+    if (!pendingFrees.empty()) FlushMetadata();
+
     // Expansion after freeing up space
     if (!ExpandInodeAreaDirect(additionalBlocks, newTotalInodes)) {
         std::cerr << "Failed to expand inode area after moving files" << std::endl;
@@ -2129,31 +2279,31 @@ void MiniHSFS::DefragmentFileBlocks(int inodeIndex) {
     // Read normally
     fileData = disk.readData(oldExtent);
 
-    // 2. Free old blocks
-    for (int i = 0; i < (int)oldExtent.blockCount; ++i) {
-        BTreeDelete(rootNodeIndex, oldExtent.startBlock + i);
-    }
-    disk.freeBlocks(oldExtent);
-
-    // 3. Allocate new contiguous blocks
+    // 2. Allocate new contiguous blocks; the old ones stay with the file until the inode is saved
     VirtualDisk::Extent newExtent = AllocateContiguousBlocks(inode.blocksUsed);
     if (newExtent.startBlock == -1) {
         throw std::runtime_error("Failed to allocate blocks during defragmentation");
     }
 
-    // 4. Write data with proper encryption handling
+    // 3. Write data with proper encryption handling
     if (!disk.writeData(fileData, newExtent, "", false)) {
+        FreeContiguousBlocks(newExtent);
         throw std::runtime_error("Failed to write data during defragmentation");
     }
 
-    // 5. Update inode information
+    // 4. Update inode information
     inode.firstBlock = newExtent.startBlock;
     inode.blocksUsed = newExtent.blockCount;
     inode.isDirty = true;
     UpdateInodeTimestamps(inodeIndex, true);
+    SaveInodeToDisk(inodeIndex);
+
+    // 5. Free old blocks, behind the inode that no longer names them
+    FreeContiguousBlocks(oldExtent);
 }
 
 void MiniHSFS::DefragmentDisk() {
+    VirtualDisk::FlushScope flush(disk);
     std::lock_guard<std::recursive_mutex> lock(fsMutex);
 
     // Collect information about files that need to be defragmented
@@ -2173,6 +2323,7 @@ void MiniHSFS::DefragmentDisk() {
         });
 
     // Defragment each file and print progress
+    defragmenting = true;
     int totalFiles = static_cast<int>(filesToDefrag.size());
     for (int i = 0; i < totalFiles; ++i) {
         int inodeIndex = filesToDefrag[i];
@@ -2190,10 +2341,8 @@ void MiniHSFS::DefragmentDisk() {
         std::cout << "\rDefragmenting... " << percent << "% completed" << std::flush;
     }
 
+    defragmenting = false;
     std::cout << std::endl << "Defragmentation completed." << std::endl;
-
-    // Rebuild the free block map
-    RebuildFreeBlockList();
 }
 
 //void MiniHSFS::DefragmentDisk() {
@@ -2245,11 +2394,9 @@ bool MiniHSFS::ExpandInodeAreaByInodes(size_t extraInodes) {
         VirtualDisk::Extent ext(disk.getSystemBlocks() + static_cast<uint32_t>(superBlockBlocks) + static_cast<uint32_t>(inodeBlocks), static_cast<uint32_t>(addBlocks));
         disk.allocateBlocks(ext.blockCount);
 
-        std::vector<char> zero(disk.blockSize, 0);
-        for (size_t i = 0; i < addBlocks; ++i)
-            disk.writeData(zero, VirtualDisk::Extent(ext.startBlock + static_cast<uint32_t>(i), 1), "", true);
-
         inodeBlocks = newBlocks;
+        ClipBTreeArea();
+        disk.zeroBlocks(ext, true);
     }
 
     // Enlarge structures in memory
@@ -2267,15 +2414,12 @@ bool MiniHSFS::ExpandInodeAreaDirect(size_t additionalBlocks, size_t newTotalIno
         VirtualDisk::Extent extent(disk.getSystemBlocks() + static_cast<uint32_t>(superBlockBlocks) + static_cast<uint32_t>(inodeBlocks), static_cast<uint32_t>(additionalBlocks));
         disk.allocateBlocks(extent.blockCount);
 
-        // Initialize new blocks
-        std::vector<char> zeroBlock(disk.blockSize, 0);
-        for (size_t i = 0; i < additionalBlocks; ++i) {
-            disk.writeData(zeroBlock,
-                VirtualDisk::Extent(extent.startBlock + static_cast<uint32_t>(i), 1), "", true);
-        }
-
         // Update internal variables
         inodeBlocks += additionalBlocks;
+        ClipBTreeArea();
+
+        // Initialize new blocks
+        disk.zeroBlocks(extent, true);
         dataStartIndex += static_cast<int>(additionalBlocks);
 
         // Expand the table in memory
@@ -2296,17 +2440,51 @@ bool MiniHSFS::ExpandInodeAreaDirect(size_t additionalBlocks, size_t newTotalIno
 }
 
 void MiniHSFS::RebuildFreeBlockList() {
-    std::vector<int> freeBlocks;
+    // A current tree is only patched where it differs from the bitmap; a stale one is bulk-loaded
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    RefreshBTree(dataStartIndex, static_cast<int>(disk.totalBlocks()));
+    ReconcileBTree();
+}
 
-    // Clear all blocks in the data range
-    for (int block = dataStartIndex; block < disk.totalBlocks(); ++block) {
-        if (!IsBlockUsed(block)) {
-            freeBlocks.push_back(block);
-        }
+void MiniHSFS::MarkBTreeStale() {
+    // The superblock already carries featureBTreeStale while mounted
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    btreeStale = true;
+}
+
+void MiniHSFS::ClipBTreeArea() {
+    // The B-tree area starts right after the inode table and gives up the blocks the table takes
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    int inodeEnd = disk.getSystemBlocks() + superBlockBlocks + static_cast<int>(inodeBlocks);
+    if (inodeEnd <= btreeStartIndex) return;
+
+    btreeBlocks = (std::max)(0, btreeBlocks - (inodeEnd - btreeStartIndex));
+    btreeStartIndex = inodeEnd;
+
+    // Cached nodes belong to the old layout and must never be written back
+    nodeCache.clear();
+    freeBTreeBlocksCache.clear();
+    MarkBTreeStale();
+}
+
+void MiniHSFS::ReconcileBTree() {
+    std::lock_guard<std::recursive_mutex> lock(fsMutex);
+    if (!btreeStale) return;
+
+    try {
+        InitializeBTree();
+        SaveBTree();
+    }
+    catch (const std::exception& e) {
+        // Left stale; allocation never depends on the tree
+        std::cerr << "Failed to rebuild the free extent B-tree: " << e.what() << std::endl;
+        return;
     }
 
-    // Reconstruct the B-tree with free blocks
-    InitializeBTree();
+    SuperblockInfo info = LoadSuperblock();
+    info.features |= featureExtentFreeMap;
+    SaveSuperblock(info);
+    btreeStale = false;
 }
 
 void MiniHSFS::RebuildFreeInodesList() {
@@ -2342,6 +2520,19 @@ void MiniHSFS::SaveInodeToDisk(int inodeIndex) {
         throw std::runtime_error("SaveInodeToDisk: inode " + std::to_string(inodeIndex) + " is invalid");
     }
 
+    if (writeBack) {
+        // Written with its neighbours by the flusher
+        inodeTable[inodeIndex].isDirty = true;
+        dirtyInodes.insert(inodeIndex);
+        NoteDirty();
+        return;
+    }
+
+    WriteInodeToDisk(inodeIndex);
+}
+
+void MiniHSFS::WriteInodeToDisk(int inodeIndex) {
+
     // Prepare a fixed inode buffer of inodeSize
     std::vector<char> buf(inodeSize, 0);
     if (SerializeInode(inodeTable[inodeIndex], buf.data(), inodeSize) == 0)
@@ -2364,6 +2555,7 @@ void MiniHSFS::SaveInodeToDisk(int inodeIndex) {
     }
 
     size_t remaining = inodeSize, src = 0;
+    auto blockBuf = disk.acquireBuffer(disk.blockSize);
     for (size_t k = 0; k < blocksNeeded; ++k) {
         uint32_t relBlock = static_cast<uint32_t>(startBlockRel + k);
         uint32_t absBlock = disk.getSystemBlocks() + static_cast<uint32_t>(superBlockBlocks) + relBlock;
@@ -2371,17 +2563,14 @@ void MiniHSFS::SaveInodeToDisk(int inodeIndex) {
             throw std::runtime_error("SaveInodeToDisk: absBlock out of range: " + std::to_string(absBlock));
 
         // Read the block, modify the part for this inode, and then write
-        auto diskData = disk.readData(VirtualDisk::Extent(absBlock, 1));
-        std::vector<char> blockBuf(disk.blockSize, 0);
-        if (!diskData.empty()) {
-            std::memcpy(blockBuf.data(), diskData.data(), (std::min)(blockBuf.size(), diskData.size()));
-        }
+        if (disk.readInto(VirtualDisk::Extent(absBlock, 1), 0, disk.blockSize, blockBuf.data()) != disk.blockSize)
+            std::memset(blockBuf.data(), 0, disk.blockSize);
 
         size_t dest = (k == 0) ? offsetInBlock : 0;
         size_t can = (std::min)(disk.blockSize - dest, remaining);
         std::memcpy(blockBuf.data() + dest, buf.data() + src, can);
 
-        disk.writeData(blockBuf, VirtualDisk::Extent(absBlock, 1), "", true);
+        disk.writeFrom(VirtualDisk::Extent(absBlock, 1), blockBuf.data(), true);
 
         remaining -= can;
         src += can;
@@ -2393,40 +2582,54 @@ void MiniHSFS::SaveInodeToDisk(int inodeIndex) {
     inodeTable[inodeIndex].isDirty = false;
 }
 
-void MiniHSFS::TouchBTreeNode(int index) {
-    std::lock_guard<std::recursive_mutex> lock(fsMutex);
-
-    auto it = btreeCache.find(index);
-    if (it != btreeCache.end()) {
-        it->second.accessCount++; // Update usage
-    }
+void MiniHSFS::WriteDirtyInodes() {
+    if (dirtyInodes.empty()) return;
 
-    if (btreeLruMap.find(index) != btreeLruMap.end()) {
-        btreeLruList.erase(btreeLruMap[index]);
+    // Inodes past the end of the area take the single-inode path, which expands it
+    for (int index : dirtyInodes) {
+        if ((static_cast<size_t>(index) + 1) * inodeSize > inodeBlocks * disk.blockSize) {
+            WriteInodeToDisk(index);
+        }
     }
-    btreeLruList.push_front(index);
-    btreeLruMap[index] = btreeLruList.begin();
 
-    if (btreeLruList.size() > std::max<size_t>(1000, static_cast<size_t>((getAvailableMemory() * 0.05) / sizeof(BTreeNode)))) {
-        FreeLRUBTreeNode(); // Throw out the least used
+    // Every block holding a dirty inode is rebuilt from the table and written in one batch
+    std::vector<uint32_t> blocks;
+    for (int index : dirtyInodes) {
+        size_t first = static_cast<size_t>(index) * inodeSize / disk.blockSize;
+        size_t last = ((static_cast<size_t>(index) + 1) * inodeSize - 1) / disk.blockSize;
+        for (size_t b = first; b <= last && b < inodeBlocks; ++b) {
+            if (blocks.empty() || blocks.back() < b) blocks.push_back(static_cast<uint32_t>(b));
+        }
     }
-}
 
-void MiniHSFS::FreeLRUBTreeNode() {
-    if (btreeLruList.empty()) return;
+    auto data = disk.acquireBuffer(blocks.size() * disk.blockSize, true);
+    std::vector<char> scratch(inodeSize);
+    std::vector<VirtualDisk::BatchRequest> writes(blocks.size());
+    for (size_t k = 0; k < blocks.size(); ++k) {
+        char* block = data.data() + k * disk.blockSize;
+        const size_t blockStart = static_cast<size_t>(blocks[k]) * disk.blockSize;
+        const size_t blockEnd = blockStart + disk.blockSize;
 
-    // Get the oldest node (last in LRU)
-    int victimIndex = btreeLruList.back();
-    btreeLruList.pop_back();
-    btreeLruMap.erase(victimIndex);
+        for (size_t i = blockStart / inodeSize; i * inodeSize < blockEnd && i < inodeTable.size(); ++i) {
+            if (SerializeInode(inodeTable[i], scratch.data(), inodeSize) == 0)
+                throw std::runtime_error("WriteDirtyInodes: serialize failed for inode " + std::to_string(i));
 
-    auto it = btreeCache.find(victimIndex);
-    if (it != btreeCache.end()) {
-        if (it->second.isDirty) {
-            SaveBTreeNode(victimIndex, it->second);
+            size_t from = (std::max)(i * inodeSize, blockStart);
+            size_t to = (std::min)((i + 1) * inodeSize, blockEnd);
+            std::memcpy(block + (from - blockStart), scratch.data() + (from - i * inodeSize), to - from);
         }
-        btreeCache.erase(it);
+
+        writes[k].extent = VirtualDisk::Extent(disk.getSystemBlocks() + static_cast<uint32_t>(superBlockBlocks) + blocks[k], 1);
+        writes[k].buffer = block;
+        writes[k].write = true;
+    }
+    if (!writes.empty() && !disk.runBatch(writes))
+        throw std::runtime_error("WriteDirtyInodes: failed to write inode blocks");
+
+    for (int index : dirtyInodes) {
+        if (static_cast<size_t>(index) < inodeTable.size()) inodeTable[index].isDirty = false;
     }
+    dirtyInodes.clear();
 }
 
 //Nowww
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define MINI_HSFS_H
 
 #include "VirtualDisk.h"
+#include "BTreeNodeCache.h"
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
@@ -17,6 +18,10 @@
 #include <deque>
 #include <list>
 #include <map>
+#include <set>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
 
 
 class MiniHSFS {
@@ -106,7 +111,8 @@ public:
     const int maxPathLength = 4096;
 
 
-    MiniHSFS(const std::string& path, uint32_t sizeMB, uint32_t blockSize);
+    MiniHSFS(const std::string& path, uint32_t sizeMB, uint32_t blockSize, VirtualDisk::IOMode ioMode = VirtualDisk::IOMode::Standard,
+        const std::vector<std::string>& stripeMembers = {}, uint32_t stripeUnitBytes = VirtualDisk::defaultStripeUnit);
     ~MiniHSFS();
     VirtualDisk& Disk();
 
@@ -118,15 +124,25 @@ public:
     void Initialize();
     void Mount(size_t inodePercentage = 0, size_t btreePercentage = 0, size_t inodeSize = 512);
     void Unmount();
+    void Grow(uint32_t newSizeMB); // online: extends the disk, the B-tree free map and the superblock
+    void SetDataChecksums(bool enabled); // per-block CRC32C area; applies when a new volume is formatted
     void SaveInodeToDisk(int inodeIndex);
 
+    // Background write-back: while the flusher runs, inode and B-tree node saves only mark them dirty.
+    // A flush happens once the oldest change reaches maxAge or maxDirty items are waiting.
+    // Blocks freed meanwhile stay allocated until a flush has made the inodes that dropped them
+    // durable, so a crash never leaves an inode on disk pointing at a free or reused block.
+    // StopFlusher writes back whatever is left; neither may be called with fsMutex held.
+    void StartFlusher(std::chrono::milliseconds maxAge = std::chrono::milliseconds(5000), size_t maxDirty = 256,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+    void StopFlusher();
+    void FlushMetadata(); // write back dirty inodes, B-tree nodes and the disk bitmap, then release deferred frees
+
     // File operations
     int FindFile(const std::string& path);
     int FindFreeBlock();
     bool FreeFileBlocks(Inode& inode);
-    
-    // Directory operations
-    void MarkBlockUsed(int blockIndex);
+    void FreeContiguousBlocks(const VirtualDisk::Extent& extent); // undo AllocateContiguousBlocks
 
 
     int PathToInode(const std::vector<std::string>& path);
@@ -161,8 +177,17 @@ private:
         time_t lastMountTime; // 8 bytes
         time_t lastWriteTime;// 8 bytes
         uint32_t state;     // 4 bytes
+        uint32_t features;          // 4 bytes (version 2; zero on older volumes)
+        uint32_t checksumStart;    // 4 bytes (first block of the data checksum area)
+        uint32_t checksumBlocks;  // 4 bytes
     };
 
+    static constexpr uint32_t legacyVersion = 0x00010000;   // inode checksum is the rotate/xor hash
+    static constexpr uint32_t crc32cVersion = 0x00020000;   // inode checksum is CRC32C
+    static constexpr uint32_t featureDataChecksums = 0x1;   // per-block checksum area present
+    static constexpr uint32_t featureBTreeStale = 0x2;      // free-extent B-tree lags the disk bitmap
+    static constexpr uint32_t featureExtentFreeMap = 0x4;   // B-tree maps free-run start -> length
+
     // File Info Structure, Inode File Information Using in Defragmentation Inodes Table 
     struct FileInfo {
         int inodeIndex;
@@ -179,104 +204,16 @@ private:
         bool success;
     };
 
-    //B-Tree Structure, Using To Control in free or not Inodes
-    struct BTreeNode {
-        bool isLeaf;
-        int keyCount;
-        int* keys;
-        union {
-            int* children;
-            int* values;
-        };
-        int nextLeaf;
-        int accessCount;
-        bool isDirty;
-        int order; //We need to store btreeOrder in each node
-
-        //Basic constructor
-        BTreeNode(int btree_order, bool leaf = true)
-            : isLeaf(leaf), keyCount(0), nextLeaf(-1),
-            accessCount(0), isDirty(false), order(btree_order)
-        {
-            keys = new int[btree_order - 1];
-            if (isLeaf)
-                values = new int[btree_order - 1]();
-            else
-                children = new int[btree_order]();
-            std::fill(keys, keys + btree_order - 1, -1);
-        }
-
-        //Default constructor(to bypass C2512 errors)
-        BTreeNode() : isLeaf(true), keyCount(0), nextLeaf(-1),
-            accessCount(0), isDirty(false), order(4)
-        {
-            keys = new int[order - 1];
-            values = new int[order - 1]();
-            std::fill(keys, keys + order - 1, -1);
-        }
-
-        ~BTreeNode() {
-            delete[] keys;
-            if (isLeaf)
-                delete[] values;
-            else
-                delete[] children;
-        }
-
-        BTreeNode(const BTreeNode& other)
-            : isLeaf(other.isLeaf), keyCount(other.keyCount),
-            nextLeaf(other.nextLeaf), accessCount(other.accessCount),
-            isDirty(other.isDirty), order(other.order)
-        {
-            keys = new int[order - 1];
-            std::copy(other.keys, other.keys + order - 1, keys);
-            if (isLeaf) {
-                values = new int[order - 1];
-                std::copy(other.values, other.values + order - 1, values);
-            }
-            else {
-                children = new int[order];
-                std::copy(other.children, other.children + order, children);
-            }
-        }
-
-        BTreeNode& operator=(const BTreeNode& other) {
-            if (this == &other) return *this;
-            isLeaf = other.isLeaf;
-            keyCount = other.keyCount;
-            nextLeaf = other.nextLeaf;
-            accessCount = other.accessCount;
-            isDirty = other.isDirty;
-            order = other.order;
-
-            delete[] keys;
-            keys = new int[order - 1];
-            std::copy(other.keys, other.keys + order - 1, keys);
-
-            if (isLeaf) {
-                delete[] values;
-                values = new int[order - 1];
-                std::copy(other.values, other.values + order - 1, values);
-            }
-            else {
-                delete[] children;
-                children = new int[order];
-                std::copy(other.children, other.children + order, children);
-            }
+    //B-Tree node (keys/children point into a cache slot or own storage) and a pinned handle to a cached node
+    using BTreeNode = ::BTreeNode;
+    using BTreeNodeRef = BTreeNodeCache::Ref;
 
-            return *this;
-        }
-    };
-
-    std::unordered_map<int, std::list<int>::iterator> btreeLruMap;
-    std::vector<int> freeBTreeBlocksCache;
-    std::map<int, BTreeNode> btreeCache;
+    std::vector<int> freeBTreeBlocksCache; // B-tree nodes not in the tree, found at build or load
     std::vector<int> freeInodesList;
     std::vector<bool> inodeBitmap;   //To track used/free nodes
     const int superBlockIndex = 0;  // First Index Have data SuperBlock 
-    std::list<int> btreeLruList;   //
     size_t inodeAreaSize = 0;     //Current size of the contract space
-    int btreeLoadCounter = 0;    //
+    std::vector<char> nodeReadBuffer; // One block, reused by ReadBTreeNode
     size_t nextFreeInode = 1;   // To speed up the search for a free node
     size_t freeBlocks = 0;     //Number of free blocks
     size_t inodePercentage;   // Control Inode Count
@@ -289,6 +226,31 @@ private:
     VirtualDisk disk;  // Object from VirtualDisk File
     int btreeBlocks;  // B-Tree Blocks Count
     int btreeOrder;  // B-Tree Order
+    bool legacyInodeChecksum = false; // volume predates CRC32C inode checksums
+    bool dataChecksums = false;      // format new volumes with a data checksum area
+    uint32_t checksumBlocks = 0;    // Data Checksum Area Blocks Count
+    BTreeNodeCache nodeCache;      // fixed slab of B-tree nodes, CLOCK eviction (after the members its callbacks use)
+
+    // Background flusher state (dirty sets and writeBack are guarded by fsMutex)
+    std::thread flusherThread;
+    std::mutex flusherMutex;
+    std::condition_variable flusherWake;
+    bool flusherStop = false;
+    bool writeBack = false;
+    std::chrono::milliseconds flushMaxAge{ 5000 };
+    std::chrono::milliseconds flushInterval{ 1000 };
+    size_t flushMaxDirty = 256;
+    std::set<int> dirtyInodes;
+    std::vector<VirtualDisk::Extent> pendingFrees; // freed in write-back mode, released by FlushMetadata
+    std::chrono::steady_clock::time_point dirtySince;
+
+    // The disk's free-extent index decides allocation. The B-tree mirrors its free runs
+    // (start -> length) and is kept in step extent by extent; after a failed update or on an
+    // older volume it is stale until rebuilt from the disk bitmap
+    bool btreeStale = false;
+
+    // A defragmentation pass is running: allocation failures inside it do not start another
+    bool defragmenting = false;
 
     //Inode Operations
     int GetInodeIndex(const Inode& inode) const;
@@ -297,24 +259,28 @@ private:
     int AllocateBTreeNode();
     bool BTreeInsert(int nodeIndex, int key, int value);
     void FreeBTreeNode(int nodeIndex);
-    bool IsBTreeBlockFree(int index);
     std::pair<bool, int> BTreeFind(int nodeIndex, int key);
+    bool BTreeFloor(int key, int& start, int& length);    // entry with the greatest key <= key
+    bool BTreeCeiling(int key, int& start, int& length);  // entry with the smallest key >= key
     void BTreeSplitChild(int parentIndex, int childIndex, int index);
     bool BTreeMergeChildren(int nodeIndex, int index);
     bool BTreeInsertNonFull(int nodeIndex, int key, int value);
-    int BTreeGetSuccessor(int nodeIndex);
-    int BTreeGetPredecessor(int nodeIndex);
-    bool BTreeDeleteFromNonLeaf(int nodeIndex, int index);
     bool BTreeDeleteFromLeaf(int nodeIndex, int index);
     void BTreeBorrowFromRight(int nodeIndex, int index);
     void BTreeBorrowFromLeft(int nodeIndex, int index);
     void BTreeFill(int nodeIndex, int index);
 
+    // Free extent map: coalescing insert and carving remove over the B-tree (no-ops while stale)
+    void FreeMapInsert(int start, int length);
+    void FreeMapRemove(int start, int length);
+
     // Initializations
     void InitializeSuperblock();
     void InitializeInodeTable();
     int InitializeInode(int index, bool isDirectory);
     void InitializeBTree();
+    void BulkLoadBTree(const std::vector<VirtualDisk::Extent>& runs); // runs sorted by start
+    size_t RefreshBTree(int firstBlock, int endBlock); // patch the map to the bitmap; returns ranges fixed
 
     //Calculations
     void CalculatePercentage(size_t inodePercentage = 0.015, size_t btreePercentage = 0.01);
@@ -328,19 +294,27 @@ private:
     size_t CalculateBlocksForNewInodes(size_t inodeCount);
 
     //Loader
-    BTreeNode LoadBTreeNode(int nodeIndex);
+    BTreeNodeRef LoadBTreeNode(int nodeIndex);            // pinned cached node
+    BTreeNodeRef NewBTreeNode(int nodeIndex, bool leaf);  // pinned empty node, nothing read
+    void ReadBTreeNode(int nodeIndex, BTreeNode& node);
     SuperblockInfo LoadSuperblock();
     void LoadInodeTable();
     void LoadBTree();
 
     //Saver
-    void SaveBTreeNode(int nodeIndex, const BTreeNode& node);
+    void SaveBTreeNode(const BTreeNodeRef& node);
     void SaveSuperblock(const SuperblockInfo& info);
     void SaveInodeTable();
     void SaveBTree();
+    void WriteBTreeNode(int nodeIndex, const BTreeNode& node, bool flushImmediately = true);
+    void WriteInodeToDisk(int inodeIndex);
+    void WriteDirtyInodes();
+    void ReleaseBlocks(const VirtualDisk::Extent& extent);
 
-    // Directory operations
-    void MarkBlocksUsed(const VirtualDisk::Extent& extent);
+    //Flusher
+    void FlusherLoop();
+    bool FlushDue() const;
+    void NoteDirty();
 
     //Updater
     void UpdateSuperblockForDynamicInodes();
@@ -370,12 +344,12 @@ private:
 
     //Rebuldations
     void RebuildFreeBlockList();
+    void MarkBTreeStale();
+    void ReconcileBTree();
+    void ClipBTreeArea(); // inode table grew into the front of the B-tree area
     void RebuildFreeInodesList();
     void RebuildInodeBitmap();
 
-    void TouchBTreeNode(int index);
-    void FreeLRUBTreeNode();
-
 };
 
 #endif // MINI_HSFS_H
\ No newline at end of file
@@ -17,6 +17,7 @@ void Parser::initializeAI(MiniHSFS& mini) {
 
 // Account Settings
 bool Parser::createAccount(MiniHSFS& mini) {
+    VirtualDisk::FlushScope flush(mini.Disk()); // one durability barrier per operation, after fsMutex is released
     std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
 
     if (!mini.mounted) throw std::runtime_error("Filesystem not mounted");
@@ -101,6 +102,7 @@ int Parser::checkingAccount(MiniHSFS& mini, size_t dataSize,bool read)
 
 void Parser::ChangeInfo(MiniHSFS& mini, std::string email, std::string password,std::string username)
 {
+    VirtualDisk::FlushScope flush(mini.Disk());
     if (!mini.mounted)
         throw std::runtime_error("Filesystem not mounted");
     int index = checkingAccount(mini,0,true);
@@ -711,6 +713,7 @@ void Parser::printInodeInfo(int inodeNum, const std::string& path, bool longForm
 }
 
 bool Parser::createDirectory(const std::string path, const std::string name, MiniHSFS& mini) {
+    VirtualDisk::FlushScope flush(mini.Disk());
     std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
 
     if (!mini.mounted) {
@@ -811,6 +814,7 @@ bool Parser::createDirectory(const std::string path, const std::string name, Min
 }
 
 int Parser::createFile(const std::string& path, const std::string name, MiniHSFS& mini) {
+    VirtualDisk::FlushScope flush(mini.Disk());
     std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
 
     if (!mini.mounted) {
@@ -914,6 +918,7 @@ int Parser::createFile(const std::string& path, const std::string name, MiniHSFS
 }
 
 bool Parser::deleteDirectory(const std::string& path, MiniHSFS& mini) {
+    VirtualDisk::FlushScope flush(mini.Disk());
     std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
 
     if (!mini.mounted) {
@@ -1027,6 +1032,7 @@ bool Parser::deleteDirectory(const std::string& path, MiniHSFS& mini) {
 }
 
 bool Parser::deleteFile(const std::string& path, MiniHSFS& mini) {
+    VirtualDisk::FlushScope flush(mini.Disk());
     std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
 
     if (!mini.mounted) {
@@ -1052,7 +1058,6 @@ bool Parser::deleteFile(const std::string& path, MiniHSFS& mini) {
     }
 
     // Save file information before deleting
-    int firstBlock = mini.inodeTable[targetInode].firstBlock;
     int blocksUsed = mini.inodeTable[targetInode].blocksUsed;
     size_t fileSize = mini.inodeTable[targetInode].size;
 
@@ -1093,14 +1098,7 @@ bool Parser::deleteFile(const std::string& path, MiniHSFS& mini) {
         mini.SaveInodeToDisk(parentInode);
         mini.SaveInodeToDisk(ownerInode);
 
-        // Then edit the file blocks
-        if (firstBlock != -1 && blocksUsed > 0) {
-            for (int i = 0; i < blocksUsed; ++i) {
-                mini.BTreeDelete(mini.rootNodeIndex, firstBlock + i);
-            }
-        }
-
-        // Then edit the inode
+        // Then edit the inode (its blocks go back to the disk in one extent)
         mini.FreeInode(targetInode);
 
         std::cout << "File '" << filename << "' deleted successfully.\n";
@@ -1140,6 +1138,19 @@ std::vector<char> Parser::readFile(const std::string& path, MiniHSFS& mini, size
     }
 
     VirtualDisk::Extent extent(inode.firstBlock, inode.blocksUsed);
+
+    // Plain files are read length-exact straight into the result (keeps trailing zero bytes)
+    if (password.empty()) {
+        size_t length = inode.size;
+        if (maxChunkSize > 0 && length > maxChunkSize) {
+            length = maxChunkSize;
+        }
+
+        std::vector<char> result(length);
+        result.resize(mini.Disk().readInto(extent, 0, length, result.data()));
+        return result;
+    }
+
     std::vector<char> result = mini.Disk().readData(extent, password);
 
     if (maxChunkSize > 0 && result.size() > maxChunkSize) {
@@ -1149,7 +1160,48 @@ std::vector<char> Parser::readFile(const std::string& path, MiniHSFS& mini, size
     return result;
 }
 
+std::vector<char> Parser::readFileRange(const std::string& path, MiniHSFS& mini, size_t offset, size_t length, const std::string& password) {
+
+    std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
+
+    if (!mini.mounted)
+        throw std::runtime_error("Filesystem not mounted");
+
+    checkingAccount(mini, 0, true);
+
+    mini.ValidatePath(path);
+
+    int inode_index = mini.FindFile(path);
+    if (inode_index == -1)
+        throw std::runtime_error("File not found");
+
+    MiniHSFS::Inode& inode = mini.inodeTable[inode_index];
+    if (inode.isDirectory)
+        throw std::runtime_error("Cannot read a directory");
+
+    if (inode.blocksUsed == 0 || inode.firstBlock == -1 || offset >= inode.size) {
+        return {};
+    }
+    length = (std::min)(length, inode.size - offset);
+
+    VirtualDisk::Extent extent(inode.firstBlock, inode.blocksUsed);
+
+    // Plain files: only the blocks covering the range are touched
+    if (password.empty()) {
+        std::vector<char> result(length);
+        result.resize(mini.Disk().readInto(extent, offset, length, result.data()));
+        return result;
+    }
+
+    // Encrypted files have to be decrypted as a whole
+    std::vector<char> plain = mini.Disk().readData(extent, password);
+    if (offset >= plain.size()) return {};
+    length = (std::min)(length, plain.size() - offset);
+    return std::vector<char>(plain.begin() + offset, plain.begin() + offset + length);
+}
+
 bool Parser::writeFile(const std::string& path, const std::vector<char>& data, MiniHSFS& mini, bool append, const std::string& password) {
+    VirtualDisk::FlushScope flush(mini.Disk());
 
     std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
 
@@ -1215,7 +1267,7 @@ bool Parser::writeFile(const std::string& path, const std::vector<char>& data, M
     // Writing data
     if (!mini.Disk().writeData(data, newExtent, password, true)) {
         // Undo: Edit new blocks and redo old ones
-        mini.Disk().freeBlocks(newExtent);
+        mini.FreeContiguousBlocks(newExtent);
         if (!append && oldFirstBlock != -1) {
             inode.firstBlock = oldFirstBlock;
             inode.blocksUsed = oldBlocksUsed;
@@ -1229,7 +1281,7 @@ bool Parser::writeFile(const std::string& path, const std::vector<char>& data, M
         
         // Append support  we will assume that append only works for data that is currently unencrypted
         if (!password.empty()) {
-            mini.Disk().freeBlocks(newExtent);
+            mini.FreeContiguousBlocks(newExtent);
             throw std::runtime_error("Appending to encrypted files is not supported");
         }
 
@@ -1282,7 +1334,7 @@ bool Parser::writeFile(const std::string& path, const std::vector<char>& data, M
     }
     catch (const std::exception& e) {
         // Undo all changes if save fails
-        mini.Disk().freeBlocks(newExtent);
+        mini.FreeContiguousBlocks(newExtent);
         if (oldFirstBlock != -1) {
             inode.firstBlock = oldFirstBlock;
             inode.blocksUsed = oldBlocksUsed;
@@ -1294,6 +1346,7 @@ bool Parser::writeFile(const std::string& path, const std::vector<char>& data, M
 }
 
 bool Parser::rename(const std::string& oldPath, const std::string& newName, MiniHSFS& mini) {
+    VirtualDisk::FlushScope flush(mini.Disk());
     std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
 
     if (!mini.mounted)
@@ -1361,6 +1414,7 @@ bool Parser::rename(const std::string& oldPath, const std::string& newName, Mini
 }
 
 bool Parser::move(const std::string& srcPath, const std::string& destPath, MiniHSFS& mini) {
+    VirtualDisk::FlushScope flush(mini.Disk());
     std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
 
     if (!mini.mounted)
@@ -1428,6 +1482,7 @@ bool Parser::move(const std::string& srcPath, const std::string& destPath, MiniH
 }
 
 bool Parser::copy(const std::string& srcPath, const std::string& destPath, MiniHSFS& mini) {
+    VirtualDisk::FlushScope flush(mini.Disk());
     std::lock_guard<std::recursive_mutex> lock(mini.fsMutex);
 
     if (!mini.mounted)
@@ -1504,6 +1559,30 @@ void Parser::printBitmap(MiniHSFS& mini) {
     mini.Disk().printBitmap();
 }
 
+void Parser::grow(const std::string& sizeMB, MiniHSFS& mini) {
+    if (!mini.mounted)
+        throw std::runtime_error("Filesystem not mounted");
+    checkingAccount(mini, 0, true);
+
+    mini.Grow(static_cast<uint32_t>(std::stoul(sizeMB)));
+
+    mini.Disk().SetConsoleColor(mini.Disk().Green);
+    std::cout << "Volume grown to " << mini.Disk().totalBlocks() << " blocks ("
+        << mini.Disk().freeBlocksCount() << " free)" << std::endl;
+    mini.Disk().SetConsoleColor(mini.Disk().Default);
+}
+
+void Parser::ioStats(MiniHSFS& mini, bool reset) {
+    checkingAccount(mini, 0, true);
+
+    if (reset) {
+        mini.Disk().resetIOStats();
+        std::cout << "I/O statistics reset" << std::endl;
+        return;
+    }
+    mini.Disk().printIOStats();
+}
+
 void Parser::exit(MiniHSFS& mini) {
     mini.Disk().SetConsoleColor(mini.Disk().Green);
     std::cout << "Bye :)" << std::endl;
@@ -1567,6 +1646,7 @@ void Parser::predictNextAccess(MiniHSFS& mini) {
 }
 
 void Parser::optimizeFilePlacement(const std::string& filePath, MiniHSFS& mini) {
+    VirtualDisk::FlushScope flush(mini.Disk());
     initializeAI(mini);
 
     int inode = mini.PathToInode(mini.SplitPath(filePath));
@@ -1590,7 +1670,7 @@ void Parser::optimizeFilePlacement(const std::string& filePath, MiniHSFS& mini)
         if (mini.Disk().writeData(data, new_extent, "", true)) {
             // Free old blocks
             VirtualDisk::Extent old_extent(file.firstBlock, file.blocksUsed);
-            mini.Disk().freeBlocks(old_extent);
+            mini.FreeContiguousBlocks(old_extent);
 
             // Update inode
             file.firstBlock = new_extent.startBlock;
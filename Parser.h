@@ -25,6 +25,8 @@ public:
 	void cd(const std::string& path, MiniHSFS& mini);
 	void cls();
 	void printBitmap(MiniHSFS& mini);
+	void grow(const std::string& sizeMB, MiniHSFS& mini);
+	void ioStats(MiniHSFS& mini, bool reset = false);
 	MiniHSFS::Inode getDirectoryItems(const std::string& path, MiniHSFS& mini);
 	void exit(MiniHSFS& mini);
 	void printFileSystemInfo(MiniHSFS& mini);
@@ -47,6 +49,7 @@ public:
 
 	// Smart Read/Write with AI
 	std::vector<char> readFile(const std::string& path, MiniHSFS& mini, size_t maxChunkSize = 0, bool showProgress = true, const std::string& password = "");
+	std::vector<char> readFileRange(const std::string& path, MiniHSFS& mini, size_t offset, size_t length, const std::string& password = "");
 	bool writeFile(const std::string& path, const std::vector<char>& data, MiniHSFS& mini, bool append = false, const std::string& password = "");
 
 	// AI Analysis Functions
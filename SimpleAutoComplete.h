@@ -27,7 +27,7 @@ public:
     const std::vector<std::string> builtInCommands = {
     "exit", "quit", "ls", "move", "mv", "write", "open", "read", "copy", "cp",
     "mkfile", "mf", "mkdir", "md", "tree", "info", "cd",
-    "redir", "refile", "rename", "rd", "del", "cls", "map", "AI"
+    "redir", "refile", "rename", "rd", "del", "cls", "map", "grow", "iostats", "AI"
     };
 
     using SuggestionsCallback = std::function<std::vector<std::string>(const std::string&)>;
@@ -352,6 +352,12 @@ void Tokenizer::handleCommand(const std::vector<std::string>& args, MiniHSFS& mi
     else if (args[0] == "map" && args.size() == 1)
         parse.printBitmap(mini);
 
+    else if (args[0] == "grow" && args.size() == 2)
+        parse.grow(args[1], mini);
+
+    else if (args[0] == "iostats" && (args.size() == 1 || (args.size() == 2 && args[1] == "reset")))
+        parse.ioStats(mini, args.size() == 2);
+
     else if (args[0] == "exit")
         parse.exit(mini);
     
@@ -1,5 +1,88 @@
 ﻿#include "VirtualDisk.h"
 
+#include <unordered_map>
+#include <fstream>
+#include <cstring>
+#include <cstddef>
+#include <cstdio>
+
+#if defined(__linux__) && !defined(IOV_MAX)
+#define IOV_MAX 1024
+#endif
+
+namespace {
+    // Per-thread FlushScope nesting, keyed by disk
+    struct ScopeState {
+        int depth = 0;
+        bool pending = false;
+    };
+
+    thread_local std::unordered_map<const VirtualDisk*, ScopeState> flushScopes;
+
+    // Geometry label in the last block of a grown or striped image, followed by its bitmap segments
+    constexpr char geometryMagic[8] = { 'V', 'D', 'G', 'E', 'O', 'M', '1', '\0' };
+    constexpr uint32_t geometryVersion = 1;
+
+    struct GeometryHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t blockSize;
+        uint64_t totalBlocks;
+        uint64_t initialBlocks;
+        uint32_t systemBlock;
+        uint32_t segmentCount;
+        uint32_t stripeWidth;
+        uint32_t stripeUnit;
+        uint64_t checksum;    // FNV-1a over header (checksum zeroed) and segments
+    };
+
+    // True when every byte of the block is zero
+    inline bool isZeroBlock(const char* data, size_t length) {
+        return length == 0 || (data[0] == 0 && std::memcmp(data, data + 1, length - 1) == 0);
+    }
+
+#ifdef __linux__
+    // preadv/pwritev until everything moved or the call fails; vectors are consumed
+    size_t transferDescriptor(int fd, bool write, uint64_t offset, std::vector<iovec>& vectors) {
+        size_t done = 0;
+        size_t index = 0;
+        while (index < vectors.size()) {
+            int count = static_cast<int>((std::min<size_t>)(vectors.size() - index, IOV_MAX));
+            off_t position = static_cast<off_t>(offset + done);
+            ssize_t n = write ? pwritev(fd, &vectors[index], count, position)
+                              : preadv(fd, &vectors[index], count, position);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += static_cast<size_t>(n);
+
+            // Drop fully transferred vectors and trim a partially transferred one
+            size_t left = static_cast<size_t>(n);
+            while (left > 0 && index < vectors.size()) {
+                if (left >= vectors[index].iov_len) {
+                    left -= vectors[index].iov_len;
+                    ++index;
+                }
+                else {
+                    vectors[index].iov_base = static_cast<char*>(vectors[index].iov_base) + left;
+                    vectors[index].iov_len -= left;
+                    left = 0;
+                }
+            }
+        }
+        return done;
+    }
+#endif
+
+    uint64_t geometryChecksum(const char* data, size_t length) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < length; ++i) {
+            hash ^= static_cast<uint8_t>(data[i]);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+}
+
 // Constructor
 VirtualDisk::VirtualDisk(int superblock, uint32_t blockSize)
     : systemBlock(0), diskSize(0), superBlockBlocks(superblock), blockSize(blockSize), isNewDisk(false) {
@@ -12,10 +95,23 @@ VirtualDisk::~VirtualDisk() {
 
 //Ensure everything you want is preserved on the virtual disk
 void VirtualDisk::syncToDisk() {
+    IOStats::Scope stats(ioStats, IOStats::Op::Sync);
     std::unique_lock<std::shared_mutex> lock(diskMutex);
     // call no-lock implementation inline (original code used platform-specific fsync)
     if (!ensureOpen_unlocked()) return;
 
+    if (cache) {
+        cache->flush();
+    }
+
+    saveBitmap_nl(false);
+    saveChecksums_nl();
+
+    if (mappedBase) {
+        flushRange_nl(0, mappedLength);
+    }
+
+    const uint64_t fsyncStarted = IOStats::clock();
 #ifdef _WIN32
     
     if (!FlushFileBuffers(fileHandle)) {
@@ -38,15 +134,20 @@ void VirtualDisk::syncToDisk() {
     }
 
 #endif
+    ioStats.record(IOStats::Op::Fsync, IOStats::clock() - fsyncStarted, 0, true);
+    stats.succeed(0);
 }
 
 //Initialize Disk
-void VirtualDisk::Initialize(const std::string& path, uint64_t diskSizeMB) {
+void VirtualDisk::Initialize(const std::string& path, uint64_t diskSizeMB, IOMode mode) {
+    FlushScope flush(*this);
+
     // lock once here and call no-lock implementations
     std::unique_lock<std::shared_mutex> lock(diskMutex);
 
     try {
         diskPath = path;
+        ioMode = mode;
         diskSizeMB = (diskSizeMB < 1) ? VirtualDisk::defaultSizeDisk : diskSizeMB;
         diskSize = diskSizeMB;
         const uint64_t totalBlocks = (diskSizeMB * 1024 * 1024) / blockSize;
@@ -55,8 +156,10 @@ void VirtualDisk::Initialize(const std::string& path, uint64_t diskSizeMB) {
             throw VirtualDiskException("Invalid disk size - too small");
         }
 
-        blockBitmap.clear();
-        blockBitmap.resize(totalBlocks, false);
+        blockBitmap.assign(totalBlocks, false);
+        blockBitmap.setChunkSize(blockSize);
+        freeExtentsStale = true;
+        knownZero.assign(totalBlocks, false);
 
         systemBlock = static_cast<uint32_t>(std::min<uint64_t>(
             static_cast<uint64_t>(std::ceil((totalBlocks / 8.0) / blockSize) + extraSystemBlocks),
@@ -87,6 +190,16 @@ void VirtualDisk::Initialize(const std::string& path, uint64_t diskSizeMB) {
         else {
             createNewDisk_nl(totalBlocks);
         }
+
+        if (ioMode == IOMode::Direct) {
+            openDirect_nl();
+        }
+
+        createCache_nl();
+
+        if (ioMode == IOMode::Memory) {
+            snapshotPath = diskPath;
+        }
     }
     catch (const std::exception& e) {
         std::cout << e.what() << std::endl;
@@ -131,82 +244,106 @@ size_t VirtualDisk::determineSmartBufferSize() {
 
 //Create New Disk with lock
 void VirtualDisk::createNewDisk(uint64_t totalBlocks) {
+    FlushScope flush(*this);
     std::unique_lock<std::shared_mutex> lock(diskMutex);
     createNewDisk_nl(totalBlocks);
 }
 
-//Create New Disk without lock
+//Create New Disk without lock (sparse: unwritten blocks read back as zeros)
 void VirtualDisk::createNewDisk_nl(uint64_t totalBlocks) {
-    const size_t BUFFER_SIZE = determineSmartBufferSize();
-    std::vector<char> buffer(BUFFER_SIZE, 0);
-    uint64_t remaining = totalBlocks * blockSize;
-
-#ifdef _WIN32
-    fileHandle = CreateFileA(diskPath.c_str(), GENERIC_READ | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CREATE_ALWAYS,
-        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH, NULL);
-    if (fileHandle == INVALID_HANDLE_VALUE) {
-        Close();
-        throw VirtualDiskException("Failed to create new disk file");
+    const uint64_t imageBytes = totalBlocks * blockSize;
+    initialBlockCount = totalBlocks;
+    bitmapSegments.clear();
+    labelBlock = 0;
+
+    if (ioMode == IOMode::Memory) {
+        // A fresh RAM image reads back as zeros, just like a sparse file
+        openMemory_nl(imageBytes);
     }
+    else {
+#ifdef _WIN32
+        fileHandle = CreateFileA(diskPath.c_str(), GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            Close();
+            throw VirtualDiskException("Failed to create new disk file");
+        }
 
-    while (remaining > 0) {
-        DWORD chunk = static_cast<DWORD>(std::min<size_t>(BUFFER_SIZE, remaining));
-        DWORD written;
-        if (!WriteFile(fileHandle, buffer.data(), chunk, &written, NULL) || written != chunk) {
+        // Best effort: on volumes without sparse support the extension is simply allocated
+        DWORD returned = 0;
+        DeviceIoControl(fileHandle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL);
+
+        LARGE_INTEGER size;
+        size.QuadPart = static_cast<LONGLONG>(imageBytes);
+        if (!SetFilePointerEx(fileHandle, size, NULL, FILE_BEGIN) || !SetEndOfFile(fileHandle)) {
             CloseHandle(fileHandle);
             fileHandle = INVALID_HANDLE_VALUE;
             Close();
-            throw VirtualDiskException("Failed to write to disk");
+            throw VirtualDiskException("Failed to size new disk file");
         }
-        remaining -= chunk;
-    }
-
-    FlushFileBuffers(fileHandle);
 #elif __linux__
-    fileDescriptor = open(diskPath.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_SYNC, 0644);
-    if (fileDescriptor < 0) {
-        Close();
-        throw VirtualDiskException("Failed to create new disk file");
-    }
+        fileDescriptor = open(diskPath.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fileDescriptor < 0) {
+            Close();
+            throw VirtualDiskException("Failed to create new disk file");
+        }
 
-    while (remaining > 0) {
-        size_t chunk = std::min(BUFFER_SIZE, remaining);
-        if (write(fileDescriptor, buffer.data(), chunk) != (ssize_t)chunk) {
+        // Extending with ftruncate allocates nothing; blocks are materialized on first write
+        if (ftruncate(fileDescriptor, static_cast<off_t>(imageBytes)) != 0) {
             close(fileDescriptor);
             fileDescriptor = -1;
             Close();
-            throw VirtualDiskException("Failed to write to disk");
+            throw VirtualDiskException("Failed to size new disk file: " + std::string(strerror(errno)));
         }
-        remaining -= chunk;
-    }
-
-    fsync(fileDescriptor);
 #else
-    // C++ standard implementation
-    diskFile.open(diskPath, std::ios::out | std::ios::binary);
-    if (!diskFile.is_open()) {
-        Close();
-        throw VirtualDiskException("Failed to create new disk file");
-    }
+        // C++ standard implementation
+        ioMode = IOMode::Standard; // no mapping support for plain streams
+        diskFile.open(diskPath, std::ios::out | std::ios::binary);
+        if (!diskFile.is_open()) {
+            Close();
+            throw VirtualDiskException("Failed to create new disk file");
+        }
 
-    while (remaining > 0) {
-        size_t chunk = std::min(BUFFER_SIZE, remaining);
-        diskFile.write(buffer.data(), chunk);
+        // Writing the last byte sets the size; sparseness is up to the file system
+        if (imageBytes > 0) {
+            diskFile.seekp(static_cast<std::streamoff>(imageBytes - 1));
+            diskFile.put('\0');
+        }
         if (!diskFile.good()) {
             diskFile.close();
             Close();
-            throw VirtualDiskException("Failed to write to disk");
+            throw VirtualDiskException("Failed to size new disk file");
         }
-        remaining -= chunk;
-    }
 
-    diskFile.flush();
-    diskFile.close();
+        diskFile.flush();
+        diskFile.close();
 #endif
+    }
 
-    std::fill_n(blockBitmap.begin(), systemBlock + superBlockBlocks, true);
-    saveBitmap_nl(true);
+    openStripes_nl(true, imageBytes);
+
+    if (ioMode == IOMode::MemoryMapped) {
+        mapImage_nl(imageBytes);
+    }
+
+    // A sparse image already reads back as an all-free bitmap; only the system range is written
+    blockBitmap.clearDirty();
+    setBlocks_nl(0, systemBlock + superBlockBlocks, true);
+    knownZero.setRange(systemBlock + superBlockBlocks, totalBlocks - (systemBlock + superBlockBlocks), true);
+
+    // The stripe layout is recorded so a mismatched reopen is refused
+    if (stripeWidth > 1) {
+        labelBlock = totalBlocks - 1;
+        setBlocks_nl(labelBlock, 1, true);
+        knownZero.set(labelBlock, false);
+        saveGeometry_nl();
+        requestFlush_nl(labelBlock * blockSize, blockSize);
+    }
+    saveBitmap_nl(false);
+
+    // One sync for the new image: size, system area and bitmap
+    requestFlush_nl(0, static_cast<size_t>(systemBlock) * blockSize);
     isNewDisk = true;
 }
 
@@ -218,28 +355,61 @@ void VirtualDisk::loadExistingDisk(uint64_t expectedBlocks) {
 
 //Load Disk without lock
 void VirtualDisk::loadExistingDisk_nl(uint64_t expectedBlocks) {
-#ifdef _WIN32
-    fileHandle = CreateFileA(diskPath.c_str(), GENERIC_READ | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
-        FILE_ATTRIBUTE_NORMAL, NULL);
-    if (!ensureOpen_unlocked()) {
-        Close();
-        throw VirtualDiskException("Failed to open disk file");
+    if (ioMode == IOMode::Memory) {
+        // The snapshot is copied into RAM; the file itself is not touched again until Close
+        loadSnapshot_nl();
     }
+    else {
+#ifdef _WIN32
+        fileHandle = CreateFileA(diskPath.c_str(), GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, NULL);
+        if (!ensureOpen_unlocked()) {
+            Close();
+            throw VirtualDiskException("Failed to open disk file");
+        }
 #elif __linux__
-    fileDescriptor = open(diskPath.c_str(), O_RDWR);
-    if (fileDescriptor < 0) {
-        Close();
-        throw VirtualDiskException("Failed to open disk file");
-    }
+        fileDescriptor = open(diskPath.c_str(), O_RDWR);
+        if (fileDescriptor < 0) {
+            Close();
+            throw VirtualDiskException("Failed to open disk file");
+        }
 #else
-    // C++ standard implementation
-    diskFile.open(diskPath, std::ios::in | std::ios::out | std::ios::binary);
-    if (!diskFile.is_open()) {
-        Close();
-        throw VirtualDiskException("Failed to open disk file");
-    }
+        // C++ standard implementation
+        ioMode = IOMode::Standard; // no mapping support for plain streams
+        diskFile.open(diskPath, std::ios::in | std::ios::out | std::ios::binary);
+        if (!diskFile.is_open()) {
+            Close();
+            throw VirtualDiskException("Failed to open disk file");
+        }
 #endif
+    }
+
+    openStripes_nl(false, 0);
+
+    // A grown image carries its own geometry; otherwise the requested size applies
+    bitmapSegments.clear();
+    labelBlock = 0;
+    if (loadGeometry_nl()) {
+        expectedBlocks = blockBitmap.size();
+    }
+    else if (stripeWidth > 1) {
+        // Striped images always carry a label; not finding it means the layout is wrong
+        throw VirtualDiskException("Stripe members do not match the image layout");
+    }
+    else {
+        initialBlockCount = expectedBlocks;
+    }
+
+    if (ioMode == IOMode::MemoryMapped) {
+        mapImage_nl(expectedBlocks * blockSize);
+    }
+    else if (ioMode == IOMode::Memory && memoryImageBytes < expectedBlocks * blockSize) {
+        // A short snapshot is extended with zeros, as mapImage_nl does for files
+        unmapImage_nl();
+        resizeImage_nl(expectedBlocks * blockSize);
+        mapImage_nl(expectedBlocks * blockSize);
+    }
 
     loadBitmap_nl();
     isNewDisk = false;
@@ -247,6 +417,7 @@ void VirtualDisk::loadExistingDisk_nl(uint64_t expectedBlocks) {
 
 //Use Blocks and Mark it
 VirtualDisk::Extent VirtualDisk::allocateBlocks(uint32_t blocksNeeded) {
+    IOStats::Scope stats(ioStats, IOStats::Op::Allocate);
     std::unique_lock<std::shared_mutex> lock(diskMutex);
 
     if (freeBlocksCount_nl() < blocksNeeded) {
@@ -257,58 +428,96 @@ VirtualDisk::Extent VirtualDisk::allocateBlocks(uint32_t blocksNeeded) {
         throw std::invalid_argument("Block count cannot be zero");
     }
 
-    int totalBlocks = static_cast<int>(blockBitmap.size());
-    int start = -1;
-    int count = 0;
+    ensureFreeExtents_nl();
+    uint64_t start = freeExtents.find(blocksNeeded, allocationPolicy);
+    if (start == FreeExtentIndex::npos) {
+        throw DiskFullException();
+    }
 
-    for (int currentBlock = systemBlock; currentBlock < totalBlocks; ++currentBlock) {
-        if (!blockBitmap[currentBlock]) {
-            if (start == -1)
-                start = currentBlock;
-            count++;
+    setBlocks_nl(start, blocksNeeded, true);
+    stats.succeed(static_cast<uint64_t>(blocksNeeded) * blockSize);
+    return Extent(static_cast<uint32_t>(start), blocksNeeded);
+}
 
-            if (count == blocksNeeded) {
-                for (int j = start; j < start + static_cast<int>(blocksNeeded); ++j)
-                    blockBitmap[j] = true;
+//Mark a chosen extent as used
+bool VirtualDisk::reserveBlocks(const Extent& extent) {
+    std::unique_lock<std::shared_mutex> lock(diskMutex);
 
-                return Extent(start, blocksNeeded);
-            }
-        }
-        else {
-            start = -1;
-            count = 0;
-        }
+    if (extent.blockCount == 0) {
+        throw std::invalid_argument("Block count cannot be zero");
+    }
+    const uint64_t end = static_cast<uint64_t>(extent.startBlock) + extent.blockCount;
+    if (extent.startBlock < systemBlock || end > blockBitmap.size()) {
+        throw std::out_of_range("Extent exceeds disk bounds");
+    }
+    if (blockBitmap.nextUsed(extent.startBlock, end) != end) {
+        return false;
     }
 
-    throw DiskFullException();
+    setBlocks_nl(extent.startBlock, extent.blockCount, true);
+    return true;
 }
 
 //Get Status Bit Map (Meta Data)
 std::vector<bool> VirtualDisk::getBitmap() {
     std::shared_lock<std::shared_mutex> lock(diskMutex);
-    return blockBitmap;
+    return blockBitmap.toVector();
+}
+
+//Free runs of a block range, found a word at a time
+std::vector<VirtualDisk::Extent> VirtualDisk::getFreeRuns(uint32_t fromBlock, uint32_t endBlock) {
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+    std::vector<Extent> runs;
+    const size_t limit = (std::min)(static_cast<size_t>(endBlock), blockBitmap.size());
+
+    size_t block = fromBlock;
+    while (block < limit) {
+        size_t start = blockBitmap.nextFree(block);
+        if (start == BlockBitmap::npos || start >= limit) break;
+
+        size_t end = blockBitmap.nextUsed(start, limit);
+        runs.emplace_back(static_cast<uint32_t>(start), static_cast<uint32_t>(end - start));
+        block = end;
+    }
+    return runs;
 }
 
 //Set Status Bit Map (Meta Data)
 void VirtualDisk::setBitmap(int index, bool state) {
     std::unique_lock<std::shared_mutex> lock(diskMutex);
     if (index >= 0 && static_cast<size_t>(index) < blockBitmap.size()) {
-        blockBitmap[index] = state;
+        setBlocks_nl(index, 1, state);
     }
 }
 
+//Get Status of one Block
+bool VirtualDisk::isBlockUsed(uint32_t index) {
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+    return index < blockBitmap.size() && blockBitmap.test(index);
+}
+
 //Free Blocks Was Used
 void VirtualDisk::freeBlocks(const Extent& extent) {
+    FlushScope flush(*this);
     std::unique_lock<std::shared_mutex> lock(diskMutex);
     if (!ensureOpen_unlocked()) return;
 
     if (extent.startBlock + extent.blockCount > blockBitmap.size() && extent.startBlock != -1) {
         throw std::out_of_range("Extent exceeds disk bounds");
     }
-    if (extent.startBlock != -1)
-        std::fill_n(blockBitmap.begin() + extent.startBlock, extent.blockCount, false);
+    if (extent.startBlock != -1) {
+        setBlocks_nl(extent.startBlock, extent.blockCount, false);
 
-    saveBitmap_nl(true); // Force flush after freeing blocks
+        // Freed contents never need to reach the disk: drop them from the cache and hand the
+        // space back to the host file system (best effort, nothing is written to clear them)
+        if (cache) cache->invalidate(extent.startBlock, extent.blockCount);
+        zeroBlocks_nl(extent, false, false);
+    }
+
+    // Only the touched bitmap blocks are written, at the next flush point
+    if (!deferFlush_nl(0, 0)) {
+        saveBitmap_nl(true);
+    }
 }
 
 //Get Total Blocks Free Count with lock
@@ -319,96 +528,156 @@ uint64_t VirtualDisk::freeBlocksCount() {
 
 //Get Total Blocks Free Count without lock
 uint64_t VirtualDisk::freeBlocksCount_nl() const {
-    return static_cast<uint64_t>(std::count(blockBitmap.begin(), blockBitmap.end(), false));
+    return static_cast<uint64_t>(blockBitmap.freeCount());
+}
+
+//Mark blocks in the bitmap and keep the free-extent index in step
+void VirtualDisk::setBlocks_nl(uint64_t start, uint64_t count, bool used) {
+    blockBitmap.setRange(start, count, used);
+    if (freeExtentsStale) return;
+
+    // The system area is never handed out, so it is never indexed
+    uint64_t end = (std::min<uint64_t>)(start + count, blockBitmap.size());
+    start = (std::max<uint64_t>)(start, systemBlock);
+    if (start >= end) return;
+    if (used) freeExtents.reserve(start, end - start);
+    else freeExtents.release(start, end - start);
+}
+
+//Rebuild the free-extent index from the bitmap after a bulk change
+void VirtualDisk::ensureFreeExtents_nl() {
+    if (!freeExtentsStale) return;
+    freeExtents.rebuild(blockBitmap, systemBlock);
+    freeExtentsStale = false;
+}
+
+//Set Allocation Policy
+void VirtualDisk::setAllocationPolicy(AllocationPolicy policy) {
+    std::unique_lock<std::shared_mutex> lock(diskMutex);
+    allocationPolicy = policy;
+}
+
+//Get Allocation Policy
+VirtualDisk::AllocationPolicy VirtualDisk::getAllocationPolicy() const {
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+    return allocationPolicy;
 }
 
 // Write Data in Disk
 bool VirtualDisk::writeData(const std::vector<char>& data, const Extent& extent, const std::string& password, bool flushImmediately) {
-    std::unique_lock<std::shared_mutex> lock(diskMutex);
+    // Outlives the flush scope so the operation's barrier is part of its latency
+    IOStats::Scope stats(ioStats, IOStats::Op::Write);
+
+    // Declared first so the barrier (if any) runs after the locks are released
+    FlushScope flush(*this);
+
+    // Shared disk lock keeps the file open; the extent lock serializes only overlapping writers
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
 
     if (!ensureOpen_unlocked()) return false;
 
-    std::vector<uint8_t> finalData;
+    const size_t totalBlockSize = static_cast<size_t>(extent.blockCount) * blockSize;
+    const char* source = data.data();
+    AlignedBufferPool::Buffer staging;
 
     if (password.empty()) {
-        finalData.assign(data.begin(), data.end());
+        if (data.size() > totalBlockSize) return false;
+
+        // Exactly block-sized payloads are written from the caller's memory
+        if (data.size() != totalBlockSize) {
+            staging = ioBuffers.acquire(totalBlockSize);
+            std::memcpy(staging.data(), data.data(), data.size());
+            std::memset(staging.data() + data.size(), 0, totalBlockSize - data.size());
+            source = staging.data();
+        }
     }
     else {
+        // The plaintext copy lives only for this call: wiped and freed once it is encrypted
         uint32_t originalSize = static_cast<uint32_t>(data.size());
         std::vector<uint8_t> fullData(sizeof(uint32_t) + data.size());
         std::memcpy(fullData.data(), &originalSize, sizeof(uint32_t));
         std::memcpy(fullData.data() + sizeof(uint32_t), data.data(), data.size());
 
+        const uint64_t cryptoStarted = IOStats::clock();
         CryptoUtils crypto;  // constructor
 
         auto encrypted = crypto.EncryptWithSalt(fullData, password);
+        stats.addCrypto(IOStats::clock() - cryptoStarted);
+
+        volatile uint8_t* wipe = fullData.data();
+        for (size_t i = 0; i < fullData.size(); ++i) wipe[i] = 0;
+        std::vector<uint8_t>().swap(fullData);
 
         uint32_t encryptedSize = static_cast<uint32_t>(encrypted.size());
-        finalData.resize(sizeof(uint32_t) + encryptedSize);
-        std::memcpy(finalData.data(), &encryptedSize, sizeof(uint32_t));
-        std::memcpy(finalData.data() + sizeof(uint32_t), encrypted.data(), encryptedSize);
+        if (sizeof(uint32_t) + encryptedSize > totalBlockSize) return false;
+
+        staging = ioBuffers.acquire(totalBlockSize);
+        std::memcpy(staging.data(), &encryptedSize, sizeof(uint32_t));
+        std::memcpy(staging.data() + sizeof(uint32_t), encrypted.data(), encryptedSize);
+        std::memset(staging.data() + sizeof(uint32_t) + encryptedSize, 0, totalBlockSize - sizeof(uint32_t) - encryptedSize);
+        source = staging.data();
     }
 
-    size_t totalBlockSize = extent.blockCount * blockSize;
-    if (finalData.size() > totalBlockSize) return false;
-    finalData.resize(totalBlockSize, 0);
+    ExtentGuard range(extentLocks, extent, true);
 
-#ifdef _WIN32
-    LARGE_INTEGER offset;
-    offset.QuadPart = static_cast<LONGLONG>(extent.startBlock) * blockSize;
-    SetFilePointerEx(fileHandle, offset, NULL, FILE_BEGIN);
-    DWORD written;
-    BOOL result = WriteFile(fileHandle, finalData.data(), (DWORD)finalData.size(), &written, NULL);
-    if (flushImmediately) FlushFileBuffers(fileHandle);
-    return result && written == finalData.size();
-#elif __linux__
-    off_t offset = static_cast<off_t>(extent.startBlock) * blockSize;
-    if (lseek(fileDescriptor, offset, SEEK_SET) == -1) {
-        return false;
-    }
-    ssize_t written = write(fileDescriptor, finalData.data(), finalData.size());
-    if (flushImmediately) fsync(fileDescriptor);
-    return written == (ssize_t)finalData.size();
-#else
-    // C++ standard implementation
-    diskFile.seekp(extent.startBlock * blockSize);
-    diskFile.write(reinterpret_cast<const char*>(finalData.data()), finalData.size());
-    if (flushImmediately) {
-        diskFile.flush();
-    }
-    return diskFile.good();
-#endif
+    noteWritten_nl(extent);
+    const uint64_t ioStarted = IOStats::clock();
+    size_t written = writeBlocks_nl(extent, source, flushImmediately);
+    stats.addIo(IOStats::clock() - ioStarted);
+    if (written != totalBlockSize) return false;
+
+    updateChecksums_nl(extent, source);
+    stats.succeed(totalBlockSize);
+    return true;
+}
+
+// Write whole blocks straight from caller memory
+bool VirtualDisk::writeFrom(const Extent& extent, const char* src, bool flushImmediately) {
+    IOStats::Scope stats(ioStats, IOStats::Op::Write);
+    FlushScope flush(*this);
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+
+    if (!ensureOpen_unlocked()) return false;
+    if (extent.blockCount == 0) return true;
+
+    const size_t bytes = static_cast<size_t>(extent.blockCount) * blockSize;
+    ExtentGuard range(extentLocks, extent, true);
+    noteWritten_nl(extent);
+    const uint64_t ioStarted = IOStats::clock();
+    size_t written = writeBlocks_nl(extent, src, flushImmediately);
+    stats.addIo(IOStats::clock() - ioStarted);
+    if (written != bytes) return false;
+
+    updateChecksums_nl(extent, src);
+    stats.succeed(bytes);
+    return true;
+}
+
+// Lease a pooled scratch buffer
+AlignedBufferPool::Buffer VirtualDisk::acquireBuffer(size_t bytes, bool zeroed) {
+    AlignedBufferPool::Buffer buffer = ioBuffers.acquire(bytes);
+    if (zeroed) std::memset(buffer.data(), 0, buffer.size());
+    return buffer;
 }
 
 // Read Data From Disk
 std::vector<char> VirtualDisk::readData(const Extent& extent, const std::string& password) {
+    IOStats::Scope stats(ioStats, IOStats::Op::Read);
     std::shared_lock<std::shared_mutex> lock(diskMutex);
 
     if (!ensureOpen_unlocked()) return {};
     std::vector<char> buffer(extent.blockCount * blockSize);
 
-#ifdef _WIN32
-    LARGE_INTEGER offset;
-    offset.QuadPart = static_cast<LONGLONG>(extent.startBlock) * blockSize;
-    SetFilePointerEx(fileHandle, offset, NULL, FILE_BEGIN);
-    DWORD bytesRead;
-    BOOL result = ReadFile(fileHandle, buffer.data(), (DWORD)buffer.size(), &bytesRead, NULL);
-    if (!result || bytesRead == 0) return {};
-#elif __linux__
-    off_t offset = static_cast<off_t>(extent.startBlock) * blockSize;
-    if (lseek(fileDescriptor, offset, SEEK_SET) == -1) {
-        return {};
-    }
-    ssize_t bytesRead = read(fileDescriptor, buffer.data(), buffer.size());
-    if (bytesRead <= 0) return {};
-#else
-    // C++ standard implementation
-    diskFile.seekg(extent.startBlock * blockSize);
-    diskFile.read(buffer.data(), buffer.size());
-    if (diskFile.gcount() <= 0) {
-        return {};
+    {
+        ExtentGuard range(extentLocks, extent, false);
+        const uint64_t ioStarted = IOStats::clock();
+        size_t read = readBlocks_nl(extent, buffer.data());
+        stats.addIo(IOStats::clock() - ioStarted);
+        if (read == 0) return {};
+        if (!verifyChecksums_nl(extent, buffer.data())) return {};
     }
-#endif
+    noteRead_nl(extent);
+    stats.succeed(buffer.size());
 
     if (password.empty()) {
         size_t actualSize = buffer.size();
@@ -426,14 +695,17 @@ std::vector<char> VirtualDisk::readData(const Extent& extent, const std::string&
 
     std::vector<uint8_t> encryptedBytes(buffer.begin() + sizeof(uint32_t), buffer.begin() + sizeof(uint32_t) + encryptedSize);
     std::vector<uint8_t> decryptedBytes;
+    const uint64_t cryptoStarted = IOStats::clock();
     try {
         CryptoUtils crypto;  // constructor
 
         decryptedBytes = crypto.DecryptWithSalt(encryptedBytes, password);
     }
     catch (...) {
+        stats.addCrypto(IOStats::clock() - cryptoStarted);
         return {};
     }
+    stats.addCrypto(IOStats::clock() - cryptoStarted);
 
     if (decryptedBytes.size() < sizeof(uint32_t)) return {};
     uint32_t originalSize;
@@ -443,103 +715,1511 @@ std::vector<char> VirtualDisk::readData(const Extent& extent, const std::string&
     return std::vector<char>(decryptedBytes.begin() + sizeof(uint32_t), decryptedBytes.begin() + sizeof(uint32_t) + originalSize);
 }
 
-// Close Disk
-void VirtualDisk::Close() {
-    std::unique_lock<std::shared_mutex> lock(diskMutex);
+// Read an exact byte range of an extent into caller memory
+size_t VirtualDisk::readInto(const Extent& extent, size_t byteOffset, size_t length, char* out) {
+    IOStats::Scope stats(ioStats, IOStats::Op::Read);
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
 
-#ifdef _WIN32
-    if (fileHandle != INVALID_HANDLE_VALUE) {
-        try {
-            saveBitmap_nl(true);
-            FlushFileBuffers(fileHandle);
-            CloseHandle(fileHandle);
-            fileHandle = INVALID_HANDLE_VALUE;
-        }
-        catch (...) {
-            if (fileHandle != INVALID_HANDLE_VALUE) {
-                CloseHandle(fileHandle);
-                fileHandle = INVALID_HANDLE_VALUE;
+    if (!ensureOpen_unlocked()) return 0;
+
+    size_t extentBytes = extent.size(blockSize);
+    if (byteOffset >= extentBytes || length == 0) return 0;
+    length = (std::min)(length, extentBytes - byteOffset);
+
+    uint32_t firstBlock = extent.startBlock + static_cast<uint32_t>(byteOffset / blockSize);
+    uint32_t lastBlock = extent.startBlock + static_cast<uint32_t>((byteOffset + length - 1) / blockSize);
+    ExtentGuard range(extentLocks, Extent(firstBlock, lastBlock - firstBlock + 1), false);
+
+    // Partial head/tail blocks go through a per-thread scratch block; whole blocks land in out directly
+    thread_local std::vector<char> scratch;
+    size_t copied = 0;
+    uint32_t block = firstBlock;
+    size_t skip = byteOffset % blockSize;
+
+    auto copyPartial = [&](size_t from, size_t count) -> bool {
+        scratch.resize(blockSize);
+        if (readBlocks_nl(Extent(block, 1), scratch.data()) != blockSize) return false;
+        if (!verifyChecksums_nl(Extent(block, 1), scratch.data())) return false;
+        std::memcpy(out + copied, scratch.data() + from, count);
+        copied += count;
+        block++;
+        return true;
+        };
+
+    if (skip != 0 || length < blockSize) {
+        if (!copyPartial(skip, (std::min)(length, blockSize - skip))) return copied;
+    }
+
+    uint32_t whole = static_cast<uint32_t>((length - copied) / blockSize);
+    if (whole > 0) {
+        size_t bytes = static_cast<size_t>(whole) * blockSize;
+        if (readBlocks_nl(Extent(block, whole), out + copied) != bytes) return copied;
+        if (!verifyChecksums_nl(Extent(block, whole), out + copied)) return copied;
+        copied += bytes;
+        block += whole;
+    }
+
+    if (copied < length && !copyPartial(0, length - copied)) return copied;
+
+    noteRead_nl(Extent(firstBlock, lastBlock - firstBlock + 1));
+    stats.succeed(copied);
+    return copied;
+}
+
+// Run a batch of raw block reads/writes, one flush at the end if requested
+bool VirtualDisk::runBatch(std::vector<BatchRequest>& requests, bool flushImmediately, const BatchCallback& onComplete) {
+    IOStats::Scope stats(ioStats, IOStats::Op::Batch);
+    FlushScope flush(*this);
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+
+    if (!ensureOpen_unlocked()) return false;
+    if (requests.empty()) {
+        stats.succeed(0);
+        return true;
+    }
+
+    // A single covering range lock keeps lock ordering trivial between concurrent batches
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+    bool anyWrite = false;
+    for (auto& request : requests) {
+        first = (std::min<uint64_t>)(first, request.extent.startBlock);
+        last = (std::max<uint64_t>)(last, static_cast<uint64_t>(request.extent.startBlock) + request.extent.blockCount);
+        anyWrite = anyWrite || request.write;
+        request.ok = false;
+    }
+    Extent span(static_cast<uint32_t>(first), static_cast<uint32_t>(last - first));
+    ExtentGuard range(extentLocks, span, anyWrite);
+
+    for (const auto& request : requests) {
+        if (request.write) noteWritten_nl(request.extent);
+    }
+
+    // The batch talks to the file directly: push dirty cached blocks out first and
+    // refresh cached copies of blocks about to be overwritten
+    if (cache) {
+        cache->flushRange(span.startBlock, span.blockCount);
+        for (auto& request : requests) {
+            if (!request.write) continue;
+            for (uint32_t i = 0; i < request.extent.blockCount; ++i) {
+                cache->update(request.extent.startBlock + i, request.buffer + static_cast<size_t>(i) * blockSize, false, false);
             }
-            throw;
         }
     }
-#elif __linux__
-    if (fileDescriptor >= 0) {
-        try {
-            saveBitmap_nl(true);
-            fsync(fileDescriptor);
-            close(fileDescriptor);
-            fileDescriptor = -1;
+
+    // Requests on adjacent extents going the same way become one vectored transfer
+    struct Run {
+        bool write;
+        uint64_t endBlock;
+        std::vector<size_t> members;
+    };
+
+    std::vector<size_t> order(requests.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return requests[a].extent.startBlock < requests[b].extent.startBlock;
+        });
+
+    constexpr size_t maxRunSlices = 1024; // IOV_MAX on Linux
+    std::vector<Run> runs;
+    for (size_t index : order) {
+        const BatchRequest& request = requests[index];
+        if (!runs.empty() && runs.back().write == request.write && runs.back().endBlock == request.extent.startBlock &&
+            runs.back().members.size() < maxRunSlices) {
+            runs.back().members.push_back(index);
         }
-        catch (...) {
-            if (fileDescriptor >= 0) {
-                close(fileDescriptor);
-                fileDescriptor = -1;
-            }
-            throw;
+        else {
+            runs.push_back(Run{ request.write, request.extent.startBlock, { index } });
         }
+        runs.back().endBlock = static_cast<uint64_t>(request.extent.startBlock) + request.extent.blockCount;
     }
-#else
-    if (diskFile.is_open()) {
-        try {
-            saveBitmap_nl(true);
-            diskFile.flush();
-            diskFile.close();
+
+    // Reads that fail checksum verification fail on their own, not the whole run
+    auto finishRun = [&](const Run& run, bool ok) {
+        for (size_t index : run.members) {
+            BatchRequest& request = requests[index];
+            request.ok = ok && (request.write || verifyChecksums_nl(request.extent, request.buffer));
+            if (onComplete) onComplete(request);
         }
-        catch (...) {
-            if (diskFile.is_open()) {
-                diskFile.close();
+        };
+
+    std::vector<bool> handled(runs.size(), false);
+
+#ifdef __linux__
+    if (!mappedBase && stripeWidth == 1) {
+        std::lock_guard<std::mutex> ringLock(ringMutex);
+        if (!ring) ring = std::make_unique<IoUring>(batchQueueDepth);
+
+        if (ring->available()) {
+            std::vector<IoUring::Operation> ops(runs.size());
+            std::vector<std::vector<iovec>> vectors(runs.size());
+            for (size_t r = 0; r < runs.size(); ++r) {
+                const Run& run = runs[r];
+                const BatchRequest& head = requests[run.members.front()];
+                ops[r].write = run.write;
+                ops[r].fd = fileDescriptor;
+                ops[r].offset = static_cast<uint64_t>(head.extent.startBlock) * blockSize;
+                ops[r].length = static_cast<size_t>(run.endBlock - head.extent.startBlock) * blockSize;
+
+                if (run.members.size() == 1) {
+                    ops[r].buffer = head.buffer;
+                    continue;
+                }
+                for (size_t index : run.members) {
+                    vectors[r].push_back(iovec{ requests[index].buffer, requests[index].extent.size(blockSize) });
+                }
+                ops[r].vectors = vectors[r].data();
+                ops[r].vectorCount = static_cast<unsigned>(vectors[r].size());
             }
-            throw;
+
+            ring->run(ops, [&](size_t r) {
+                // Failed or short runs are retried below with plain positional I/O
+                if (ops[r].result != static_cast<int64_t>(ops[r].length)) return;
+                handled[r] = true;
+                finishRun(runs[r], true);
+                });
         }
     }
 #endif
-}
 
-// Print Bit map
-void VirtualDisk::printBitmap() {
-    std::shared_lock<std::shared_mutex> lock(diskMutex);
+    // Anything the ring did not complete goes through positional (vectored) I/O
+    for (size_t r = 0; r < runs.size(); ++r) {
+        if (handled[r]) continue;
 
-    ensureOpen_unlocked();
+        const Run& run = runs[r];
+        std::vector<IoSlice> slices;
+        size_t length = 0;
+        for (size_t index : run.members) {
+            slices.push_back(IoSlice{ requests[index].buffer, requests[index].extent.size(blockSize) });
+            length += slices.back().length;
+        }
 
-    const size_t blocksPerRow = 32;
-    const size_t totalBlocks = blockBitmap.size();
-    const size_t usedBlocks = totalBlocks - freeBlocksCount_nl();
-    const float usedPercent = (totalBlocks == 0) ? 0.0f : (static_cast<float>(usedBlocks) / totalBlocks) * 100.0f;
+        uint64_t offset = static_cast<uint64_t>(requests[run.members.front()].extent.startBlock) * blockSize;
+        finishRun(run, transferv_nl(run.write, offset, slices) == length);
+    }
 
-    std::cout << "\n";
-    std::cout << "=========================================================\n";
-    std::cout << "|              VIRTUAL DISK BITMAP                     |\n";
-    std::cout << "=========================================================\n";
-    std::cout << "| Total Blocks: " << std::setw(10) << totalBlocks
-        << " | Free: " << std::setw(5) << freeBlocksCount_nl()
-        << " | Used: " << std::setw(6) << usedBlocks << " |\n";
-    std::cout << "| Usage: " << std::setw(4) << std::fixed << std::setprecision(1)
-        << usedPercent << "%"
-        << std::string(42, ' ') << "|\n";
-    std::cout << "| Legend: [ ] = Free, [X] = Used"
-        << std::string(24, ' ') << "|\n";
-    std::cout << "=========================================================\n\n";
+    for (const auto& request : requests) {
+        if (request.write && request.ok) updateChecksums_nl(request.extent, request.buffer);
+    }
 
-    std::cout << "Block  +";
-    for (size_t col = 0; col < blocksPerRow; ++col) {
-        std::cout << "--";
+    if (flushImmediately && anyWrite) {
+        requestFlush_nl(first * blockSize, static_cast<size_t>((last - first) * blockSize));
     }
-    std::cout << "+\n";
 
-    std::cout << "       |";
-    for (size_t col = 0; col < blocksPerRow; ++col) {
-        std::cout << std::setw(2) << col % 10;
+    uint64_t bytes = 0;
+    bool ok = true;
+    for (const auto& request : requests) {
+        if (request.ok) bytes += request.extent.size(blockSize);
+        ok = ok && request.ok;
     }
-    std::cout << "|\n";
-    std::cout << "-------+";
-    for (size_t col = 0; col < blocksPerRow; ++col) {
-        std::cout << "--";
+    if (ok) stats.succeed(bytes);
+    return ok;
+}
+
+// Scatter read of several extents
+bool VirtualDisk::readExtents(const std::vector<Extent>& extents, const std::vector<char*>& buffers) {
+    if (extents.size() != buffers.size()) {
+        throw std::invalid_argument("Each extent needs exactly one buffer");
     }
-    std::cout << "+\n";
 
-    for (size_t i = 0; i < totalBlocks; i++) {
-        if (i % blocksPerRow == 0) {
+    std::vector<BatchRequest> requests(extents.size());
+    for (size_t i = 0; i < extents.size(); ++i) {
+        requests[i].extent = extents[i];
+        requests[i].buffer = buffers[i];
+    }
+    return runBatch(requests);
+}
+
+// Gather write of several extents
+bool VirtualDisk::writeExtents(const std::vector<Extent>& extents, const std::vector<const char*>& buffers, bool flushImmediately) {
+    if (extents.size() != buffers.size()) {
+        throw std::invalid_argument("Each extent needs exactly one buffer");
+    }
+
+    std::vector<BatchRequest> requests(extents.size());
+    for (size_t i = 0; i < extents.size(); ++i) {
+        requests[i].extent = extents[i];
+        requests[i].buffer = const_cast<char*>(buffers[i]); // writes never modify the buffer
+        requests[i].write = true;
+    }
+    return runBatch(requests, flushImmediately);
+}
+
+// Asynchronous variant of runBatch
+std::future<bool> VirtualDisk::submitBatch(std::vector<BatchRequest>& requests, bool flushImmediately, BatchCallback onComplete) {
+    return std::async(std::launch::async, [this, &requests, flushImmediately, onComplete]() {
+        return runBatch(requests, flushImmediately, onComplete);
+        });
+}
+
+// Read whole blocks, serving cached ones from memory and reading the gaps in runs
+size_t VirtualDisk::readBlocks_nl(const Extent& extent, char* dst) {
+    uint64_t offset = static_cast<uint64_t>(extent.startBlock) * blockSize;
+    size_t length = extent.size(blockSize);
+    if (!cache) return readRange_nl(offset, dst, length);
+
+    // Large reads are not cached so one big file cannot displace the metadata
+    bool fill = extent.blockCount <= cache->capacityBlocks() / 4;
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+
+    auto readRun = [&]() -> bool {
+        if (runLength == 0) return true;
+        char* runDst = dst + static_cast<size_t>(runStart - extent.startBlock) * blockSize;
+        size_t runBytes = static_cast<size_t>(runLength) * blockSize;
+        if (readRange_nl(static_cast<uint64_t>(runStart) * blockSize, runDst, runBytes) != runBytes) return false;
+        if (fill) {
+            for (uint32_t k = 0; k < runLength; ++k) {
+                cache->update(runStart + k, runDst + static_cast<size_t>(k) * blockSize, false);
+            }
+        }
+        runLength = 0;
+        return true;
+        };
+
+    for (uint32_t i = 0; i < extent.blockCount; ++i) {
+        uint32_t block = extent.startBlock + i;
+        if (cache->lookup(block, dst + static_cast<size_t>(i) * blockSize)) {
+            if (!readRun()) return 0;
+        }
+        else {
+            if (runLength == 0) runStart = block;
+            runLength++;
+        }
+    }
+
+    return readRun() ? length : 0;
+}
+
+// Write whole blocks; small lazy writes stay dirty in the cache, the rest write through
+size_t VirtualDisk::writeBlocks_nl(const Extent& extent, const char* src, bool flushImmediately) {
+    uint64_t offset = static_cast<uint64_t>(extent.startBlock) * blockSize;
+    size_t length = extent.size(blockSize);
+
+    if (cache) {
+        bool small = extent.blockCount <= cache->capacityBlocks() / 4;
+        bool writeBack = small && !flushImmediately;
+        bool cachedAll = true;
+
+        // Update the cache first so a pending write-back can never land after this write
+        for (uint32_t i = 0; i < extent.blockCount; ++i) {
+            cachedAll = cache->update(extent.startBlock + i, src + static_cast<size_t>(i) * blockSize, writeBack, small) && cachedAll;
+        }
+        if (writeBack && cachedAll) return length;
+    }
+
+    size_t written = writeRange_nl(offset, src, length);
+    if (flushImmediately) requestFlush_nl(offset, length);
+    return written;
+}
+
+// Follow sequential streams and queue read-ahead for them (caller holds diskMutex)
+void VirtualDisk::noteRead_nl(const Extent& extent) {
+    if (!cache || extent.blockCount == 0) return;
+
+    const uint64_t start = extent.startBlock;
+    const uint64_t end = start + extent.blockCount;
+    const uint64_t wasted = cache->prefetchWasted();
+
+    std::lock_guard<std::mutex> lock(readAheadMutex);
+    if (readAheadMaxBytes == 0) return;
+
+    const uint64_t minWindow = (std::max<uint64_t>)(1, readAheadMinBytes / blockSize);
+    const uint64_t maxWindow = (std::max<uint64_t>)(minWindow,
+        (std::min<uint64_t>)(readAheadMaxBytes / blockSize, cache->capacityBlocks() / 4));
+    ++readAheadClock;
+
+    // A read continuing a stream may overlap its last block (unaligned ranges) or skip into
+    // the part already prefetched
+    ReadStream* stream = nullptr;
+    for (ReadStream& candidate : readStreams) {
+        if (start + 1 >= candidate.next && start <= candidate.prefetchedEnd) {
+            stream = &candidate;
+            break;
+        }
+    }
+
+    if (stream == nullptr) {
+        // A new stream replaces the least recently used one; nothing is prefetched until it continues
+        if (readStreams.size() < readAheadStreams) {
+            readStreams.emplace_back();
+            stream = &readStreams.back();
+        }
+        else {
+            stream = &*std::min_element(readStreams.begin(), readStreams.end(),
+                [](const ReadStream& a, const ReadStream& b) { return a.lastUse < b.lastUse; });
+        }
+        *stream = ReadStream{ end, end, minWindow, readAheadClock };
+        return;
+    }
+
+    // Prefetched blocks evicted unread mean the cache is under pressure: back off
+    if (wasted != readAheadWasted) {
+        stream->window = (std::max)(minWindow, stream->window / 2);
+        readAheadWasted = wasted;
+    }
+    else {
+        stream->window = (std::min)(maxWindow, stream->window * 2);
+    }
+    stream->next = (std::max)(stream->next, end);
+    stream->prefetchedEnd = (std::max)(stream->prefetchedEnd, end);
+    stream->lastUse = readAheadClock;
+
+    // Keep a window ahead of the reader, topping it up once half of it is consumed
+    if (stream->prefetchedEnd - end > stream->window / 2) return;
+
+    const uint64_t from = stream->prefetchedEnd;
+    const uint64_t to = (std::min<uint64_t>)(end + stream->window, blockBitmap.size());
+    if (to <= from || readAheadQueue.size() >= readAheadStreams * 2) return;
+
+    readAheadQueue.push_back(Extent(static_cast<uint32_t>(from), static_cast<uint32_t>(to - from)));
+    stream->prefetchedEnd = to;
+
+    if (!readAheadThread.joinable()) {
+        readAheadThread = std::thread(&VirtualDisk::readAheadLoop, this);
+    }
+    readAheadWake.notify_one();
+}
+
+// Read-ahead worker
+void VirtualDisk::readAheadLoop() {
+    std::vector<char> buffer;
+
+    while (true) {
+        Extent job;
+        {
+            std::unique_lock<std::mutex> lock(readAheadMutex);
+            readAheadWake.wait(lock, [this] { return readAheadStop || !readAheadQueue.empty(); });
+            if (readAheadStop) return;
+            job = readAheadQueue.front();
+            readAheadQueue.pop_front();
+        }
+        prefetchBlocks(job, buffer);
+    }
+}
+
+// Bring the uncached blocks of an extent into the cache
+void VirtualDisk::prefetchBlocks(const Extent& extent, std::vector<char>& buffer) {
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+    if (!isOpen_nl() || !cache) return;
+
+    // Writers to the range wait until these blocks are cached, so nothing stale gets in
+    ExtentGuard range(extentLocks, extent, false);
+
+    uint32_t i = 0;
+    while (i < extent.blockCount) {
+        if (cache->contains(extent.startBlock + i)) {
+            ++i;
+            continue;
+        }
+
+        uint32_t runStart = i;
+        while (i < extent.blockCount && !cache->contains(extent.startBlock + i)) ++i;
+
+        size_t bytes = static_cast<size_t>(i - runStart) * blockSize;
+        buffer.resize(bytes);
+        uint64_t offset = static_cast<uint64_t>(extent.startBlock + runStart) * blockSize;
+        if (readRange_nl(offset, buffer.data(), bytes) != bytes) return;
+
+        for (uint32_t k = runStart; k < i; ++k) {
+            if (!cache->prefetch(extent.startBlock + k, buffer.data() + static_cast<size_t>(k - runStart) * blockSize)) return;
+        }
+    }
+}
+
+// Stop the worker and forget all streams (must not hold diskMutex)
+void VirtualDisk::stopReadAhead() {
+    {
+        std::lock_guard<std::mutex> lock(readAheadMutex);
+        readAheadStop = true;
+        readAheadQueue.clear();
+    }
+    readAheadWake.notify_all();
+    if (readAheadThread.joinable()) readAheadThread.join();
+
+    std::lock_guard<std::mutex> lock(readAheadMutex);
+    readAheadStop = false;
+    readStreams.clear();
+}
+
+// Change the read-ahead limit (0 disables it)
+void VirtualDisk::setReadAhead(size_t maxBytes) {
+    std::lock_guard<std::mutex> lock(readAheadMutex);
+    readAheadMaxBytes = maxBytes;
+    if (maxBytes == 0) {
+        readStreams.clear();
+        readAheadQueue.clear();
+    }
+}
+
+// Create the block cache for file-backed images
+void VirtualDisk::createCache_nl() {
+    cache.reset();
+    if (cacheBudget == 0 || mappedBase) return;
+
+    cache = std::make_unique<BlockCache>(blockSize, cacheBudget, [this](uint64_t block, const char* data) {
+        return writeAt_nl(block * blockSize, data, blockSize) == blockSize;
+        });
+}
+
+// Change the cache budget (0 disables the cache)
+void VirtualDisk::setCacheBudget(size_t budgetBytes) {
+    std::unique_lock<std::shared_mutex> lock(diskMutex);
+
+    cacheBudget = budgetBytes;
+    if (cache && budgetBytes > 0) {
+        cache->setBudget(budgetBytes);
+        return;
+    }
+
+    if (cache) {
+        cache->clear();
+        cache.reset();
+    }
+    else if (budgetBytes > 0 && isOpen_nl()) {
+        createCache_nl();
+    }
+}
+
+// I/O counters and latency percentiles
+IOStats::Snapshot VirtualDisk::getIOStats() const {
+    return ioStats.snapshot();
+}
+
+// Latency histogram of one operation as (bucket upper bound in ns, count)
+std::vector<std::pair<uint64_t, uint64_t>> VirtualDisk::getLatencyHistogram(IOStats::Op op) const {
+    return ioStats.histogram(op);
+}
+
+// Start a new measurement window
+void VirtualDisk::resetIOStats() {
+    ioStats.reset();
+}
+
+// Print I/O statistics
+void VirtualDisk::printIOStats() const {
+    ioStats.print(std::cout);
+}
+
+// Cache counters (all zero when the cache is disabled)
+BlockCache::Stats VirtualDisk::getCacheStats() const {
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+    return cache ? cache->stats() : BlockCache::Stats{};
+}
+
+// Keep blocks resident in the cache
+void VirtualDisk::pinBlocks(const Extent& extent) {
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+    if (!cache || !ensureOpen_unlocked()) return;
+
+    ExtentGuard range(extentLocks, extent, false);
+    std::vector<char> block(blockSize);
+    for (uint32_t i = 0; i < extent.blockCount; ++i) {
+        uint32_t index = extent.startBlock + i;
+        if (cache->pin(index)) continue;
+        if (readAt_nl(static_cast<uint64_t>(index) * blockSize, block.data(), blockSize) == blockSize &&
+            cache->update(index, block.data(), false)) {
+            cache->pin(index);
+        }
+    }
+}
+
+// Release pinned blocks
+void VirtualDisk::unpinBlocks(const Extent& extent) {
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+    if (!cache) return;
+
+    for (uint32_t i = 0; i < extent.blockCount; ++i) {
+        cache->unpin(extent.startBlock + i);
+    }
+}
+
+// Positional read, returns the number of bytes read (0 on failure)
+size_t VirtualDisk::readAt_nl(uint64_t offset, char* dst, size_t length) {
+    size_t done = 0;
+
+    if (mappedBase) {
+        if (offset >= mappedLength) return 0;
+        done = static_cast<size_t>((std::min<uint64_t>)(length, mappedLength - offset));
+        std::memcpy(dst, mappedBase + offset, done);
+        return done;
+    }
+
+    if (stripeWidth > 1) {
+        return transferStriped_nl(false, offset, { IoSlice{ dst, length } });
+    }
+
+#ifdef _WIN32
+    while (done < length) {
+        OVERLAPPED ov = {};
+        uint64_t position = offset + done;
+        ov.Offset = static_cast<DWORD>(position & 0xFFFFFFFFULL);
+        ov.OffsetHigh = static_cast<DWORD>(position >> 32);
+        DWORD chunk = static_cast<DWORD>((std::min<size_t>)(length - done, 1u << 30));
+        DWORD bytesRead = 0;
+        if (!ReadFile(fileHandle, dst + done, chunk, &bytesRead, &ov) || bytesRead == 0) break;
+        done += bytesRead;
+    }
+#elif __linux__
+    while (done < length) {
+        ssize_t n = pread(fileDescriptor, dst + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += static_cast<size_t>(n);
+    }
+#else
+    // C++ standard implementation
+    std::lock_guard<std::mutex> streamLock(streamMutex);
+    diskFile.seekg(offset);
+    diskFile.read(dst, length);
+    done = diskFile.gcount() > 0 ? static_cast<size_t>(diskFile.gcount()) : 0;
+    diskFile.clear();
+#endif
+
+    return done;
+}
+
+// Positional write, returns the number of bytes written
+size_t VirtualDisk::writeAt_nl(uint64_t offset, const char* src, size_t length) {
+    size_t done = 0;
+
+    if (mappedBase) {
+        if (offset >= mappedLength) return 0;
+        done = static_cast<size_t>((std::min<uint64_t>)(length, mappedLength - offset));
+        std::memcpy(mappedBase + offset, src, done);
+        return done;
+    }
+
+    if (stripeWidth > 1) {
+        return transferStriped_nl(true, offset, { IoSlice{ const_cast<char*>(src), length } });
+    }
+
+#ifdef _WIN32
+    while (done < length) {
+        OVERLAPPED ov = {};
+        uint64_t position = offset + done;
+        ov.Offset = static_cast<DWORD>(position & 0xFFFFFFFFULL);
+        ov.OffsetHigh = static_cast<DWORD>(position >> 32);
+        DWORD chunk = static_cast<DWORD>((std::min<size_t>)(length - done, 1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(fileHandle, src + done, chunk, &written, &ov) || written == 0) break;
+        done += written;
+    }
+#elif __linux__
+    while (done < length) {
+        ssize_t n = pwrite(fileDescriptor, src + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += static_cast<size_t>(n);
+    }
+#else
+    // C++ standard implementation
+    std::lock_guard<std::mutex> streamLock(streamMutex);
+    diskFile.seekp(offset);
+    diskFile.write(src, length);
+    done = diskFile.good() ? length : 0;
+#endif
+
+    return done;
+}
+
+// Vectored positional I/O: slices are laid out back to back starting at offset
+size_t VirtualDisk::transferv_nl(bool write, uint64_t offset, const std::vector<IoSlice>& slices) {
+    size_t done = 0;
+
+    if (stripeWidth > 1) {
+        return transferStriped_nl(write, offset, slices);
+    }
+
+#ifdef __linux__
+    if (!mappedBase) {
+        std::vector<iovec> vectors;
+        vectors.reserve(slices.size());
+        for (const IoSlice& slice : slices) {
+            if (slice.length > 0) vectors.push_back(iovec{ slice.buffer, slice.length });
+        }
+        return transferDescriptor(fileDescriptor, write, offset, vectors);
+    }
+#endif
+
+    // Mapped images and other platforms: one positional call per slice
+    for (const IoSlice& slice : slices) {
+        size_t n = write ? writeAt_nl(offset + done, slice.buffer, slice.length)
+                         : readAt_nl(offset + done, slice.buffer, slice.length);
+        done += n;
+        if (n != slice.length) break;
+    }
+    return done;
+}
+
+// Configure striping for the next Initialize
+void VirtualDisk::setStriping(const std::vector<std::string>& memberPaths, uint32_t stripeUnitBytes) {
+    std::unique_lock<std::shared_mutex> lock(diskMutex);
+
+    if (stripeUnitBytes == 0 || stripeUnitBytes % blockSize != 0) {
+        throw std::invalid_argument("Stripe unit must be a non-zero multiple of the block size");
+    }
+    if (isOpen_nl()) {
+        throw VirtualDiskException("Striping must be configured before Initialize");
+    }
+
+    stripePaths = memberPaths;
+    stripeUnit = stripeUnitBytes;
+}
+
+// Open (or create) the members after the first; existing members must match the layout
+void VirtualDisk::openStripes_nl(bool create, uint64_t imageBytes) {
+    if (ioMode != IOMode::Striped || stripePaths.empty()) return;
+
+#ifdef _WIN32
+    for (const std::string& path : stripePaths) {
+        HANDLE member = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, create ? CREATE_ALWAYS : OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, NULL);
+        if (member == INVALID_HANDLE_VALUE) {
+            throw VirtualDiskException("Failed to open stripe member " + path);
+        }
+        if (create) {
+            DWORD returned = 0;
+            DeviceIoControl(member, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL);
+        }
+        stripeHandles.push_back(member);
+    }
+#elif __linux__
+    for (const std::string& path : stripePaths) {
+        int member = open(path.c_str(), create ? (O_CREAT | O_RDWR | O_TRUNC) : O_RDWR, 0644);
+        if (member < 0) {
+            throw VirtualDiskException("Failed to open stripe member " + path + ": " + std::string(strerror(errno)));
+        }
+        stripeDescriptors.push_back(member);
+    }
+#else
+    return; // plain streams have no positional I/O; the image stays a single file
+#endif
+
+    stripeWidth = static_cast<uint32_t>(stripePaths.size() + 1);
+
+    if (create) {
+        resizeImage_nl(imageBytes);
+        return;
+    }
+
+    // A different member count or stripe unit would silently scramble every block
+#ifdef _WIN32
+    std::vector<uint64_t> sizes;
+    LARGE_INTEGER size;
+    sizes.push_back(GetFileSizeEx(fileHandle, &size) ? static_cast<uint64_t>(size.QuadPart) : 0);
+    for (HANDLE member : stripeHandles) {
+        sizes.push_back(GetFileSizeEx(member, &size) ? static_cast<uint64_t>(size.QuadPart) : 0);
+    }
+#elif __linux__
+    std::vector<uint64_t> sizes;
+    struct stat st;
+    sizes.push_back(fstat(fileDescriptor, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0);
+    for (int member : stripeDescriptors) {
+        sizes.push_back(fstat(member, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0);
+    }
+#endif
+    uint64_t total = 0;
+    for (uint64_t bytes : sizes) total += bytes;
+    for (uint32_t m = 0; m < stripeWidth; ++m) {
+        if (sizes[m] != stripeMemberBytes(m, total)) {
+            throw VirtualDiskException("Stripe members do not match the configured layout");
+        }
+    }
+}
+
+// Close the members after the first
+void VirtualDisk::closeStripes_nl() {
+#ifdef _WIN32
+    for (HANDLE member : stripeHandles) {
+        FlushFileBuffers(member);
+        CloseHandle(member);
+    }
+    stripeHandles.clear();
+#elif __linux__
+    for (int member : stripeDescriptors) {
+        fsync(member);
+        close(member);
+    }
+    stripeDescriptors.clear();
+#endif
+    stripeWidth = 1;
+}
+
+// Bytes of an imageBytes-long image that live on one member
+uint64_t VirtualDisk::stripeMemberBytes(uint32_t member, uint64_t imageBytes) const {
+    if (stripeWidth <= 1) return imageBytes;
+
+    const uint64_t units = imageBytes / stripeUnit;
+    const uint64_t tail = imageBytes % stripeUnit;
+    uint64_t bytes = (units / stripeWidth) * stripeUnit;
+    if (member < units % stripeWidth) bytes += stripeUnit;
+    else if (member == units % stripeWidth) bytes += tail;
+    return bytes;
+}
+
+// Striped I/O: split at stripe-unit boundaries, merge pieces that are contiguous on the same
+// member, then run the members side by side once the transfer is large enough
+size_t VirtualDisk::transferStriped_nl(bool write, uint64_t offset, const std::vector<IoSlice>& slices) {
+    struct MemberRun {
+        uint64_t fileOffset;
+        uint64_t nextOffset;
+        size_t length;
+        std::vector<IoSlice> pieces;
+    };
+    std::vector<std::vector<MemberRun>> plan(stripeWidth);
+
+    uint64_t position = offset;
+    size_t total = 0;
+    for (const IoSlice& slice : slices) {
+        size_t used = 0;
+        while (used < slice.length) {
+            const uint64_t unit = position / stripeUnit;
+            const uint64_t within = position % stripeUnit;
+            const uint32_t member = static_cast<uint32_t>(unit % stripeWidth);
+            const uint64_t fileOffset = (unit / stripeWidth) * stripeUnit + within;
+            const size_t piece = static_cast<size_t>((std::min<uint64_t>)(slice.length - used, stripeUnit - within));
+
+            std::vector<MemberRun>& runs = plan[member];
+            if (runs.empty() || runs.back().nextOffset != fileOffset) {
+                runs.push_back(MemberRun{ fileOffset, fileOffset, 0, {} });
+            }
+            runs.back().pieces.push_back(IoSlice{ slice.buffer + used, piece });
+            runs.back().nextOffset += piece;
+            runs.back().length += piece;
+
+            used += piece;
+            position += piece;
+        }
+        total += slice.length;
+    }
+
+    auto runMember = [this, write, &plan](uint32_t member) {
+        size_t done = 0;
+        for (const MemberRun& run : plan[member]) {
+            size_t n = transferMember_nl(member, write, run.fileOffset, run.pieces);
+            done += n;
+            if (n != run.length) break;
+        }
+        return done;
+    };
+
+    std::vector<uint32_t> busy;
+    for (uint32_t m = 0; m < stripeWidth; ++m) {
+        if (!plan[m].empty()) busy.push_back(m);
+    }
+
+    // A short total means some member failed
+    size_t done = 0;
+    if (busy.size() > 1 && total >= stripeParallelBytes) {
+        std::vector<std::future<size_t>> others;
+        for (size_t i = 1; i < busy.size(); ++i) {
+            others.push_back(std::async(std::launch::async, runMember, busy[i]));
+        }
+        done = runMember(busy[0]);
+        for (auto& other : others) done += other.get();
+    }
+    else {
+        for (uint32_t member : busy) done += runMember(member);
+    }
+    return done;
+}
+
+// Positional (vectored) transfer on one stripe member
+size_t VirtualDisk::transferMember_nl(uint32_t member, bool write, uint64_t fileOffset, const std::vector<IoSlice>& pieces) {
+#ifdef _WIN32
+    HANDLE handle = member == 0 ? fileHandle : stripeHandles[member - 1];
+    size_t done = 0;
+    for (const IoSlice& piece : pieces) {
+        size_t moved = 0;
+        while (moved < piece.length) {
+            OVERLAPPED ov = {};
+            uint64_t position = fileOffset + done + moved;
+            ov.Offset = static_cast<DWORD>(position & 0xFFFFFFFFULL);
+            ov.OffsetHigh = static_cast<DWORD>(position >> 32);
+            DWORD chunk = static_cast<DWORD>((std::min<size_t>)(piece.length - moved, 1u << 30));
+            DWORD n = 0;
+            BOOL ok = write ? WriteFile(handle, piece.buffer + moved, chunk, &n, &ov)
+                            : ReadFile(handle, piece.buffer + moved, chunk, &n, &ov);
+            if (!ok || n == 0) return done + moved;
+            moved += n;
+        }
+        done += moved;
+    }
+    return done;
+#elif __linux__
+    std::vector<iovec> vectors;
+    vectors.reserve(pieces.size());
+    for (const IoSlice& piece : pieces) {
+        vectors.push_back(iovec{ piece.buffer, piece.length });
+    }
+    return transferDescriptor(member == 0 ? fileDescriptor : stripeDescriptors[member - 1], write, fileOffset, vectors);
+#else
+    return 0;
+#endif
+}
+
+// Open the unbuffered handle; without one every transfer simply stays buffered
+void VirtualDisk::openDirect_nl() {
+    closeDirect_nl();
+
+    // Unbuffered I/O needs sector-aligned offsets and lengths; every transfer is whole blocks
+    if (blockSize % 4096 == 0) directAlignment = 4096;
+    else if (blockSize % 512 == 0) directAlignment = 512;
+    else return;
+
+#ifdef _WIN32
+    directHandle = CreateFileA(diskPath.c_str(), GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, NULL);
+    if (directHandle == INVALID_HANDLE_VALUE) return;
+#elif __linux__
+    // Some file systems (tmpfs, older overlayfs) refuse O_DIRECT
+    directDescriptor = open(diskPath.c_str(), O_RDWR | O_DIRECT);
+    if (directDescriptor < 0) return;
+#else
+    return;
+#endif
+
+    alignedBuffers = std::make_unique<AlignedBufferPool>(directAlignment, 4 * directChunkBytes);
+}
+
+// Close the unbuffered handle
+void VirtualDisk::closeDirect_nl() {
+#ifdef _WIN32
+    if (directHandle != INVALID_HANDLE_VALUE) CloseHandle(directHandle);
+    directHandle = INVALID_HANDLE_VALUE;
+#elif __linux__
+    if (directDescriptor >= 0) close(directDescriptor);
+    directDescriptor = -1;
+#endif
+    alignedBuffers.reset();
+}
+
+// Large, aligned transfers go around the page cache when the direct handle is open
+bool VirtualDisk::useDirect_nl(uint64_t offset, size_t length) const {
+    if (!alignedBuffers || length < directMinBytes) return false;
+    return offset % directAlignment == 0 && length % directAlignment == 0;
+}
+
+// Unbuffered transfer; unaligned caller memory is bounced through pooled aligned buffers
+size_t VirtualDisk::transferDirect_nl(bool write, uint64_t offset, char* data, size_t length) {
+    bool aligned = reinterpret_cast<uintptr_t>(data) % directAlignment == 0;
+    AlignedBufferPool::Buffer bounce;
+    if (!aligned) bounce = alignedBuffers->acquire((std::min)(length, directChunkBytes));
+
+    size_t done = 0;
+    while (done < length) {
+        size_t chunk = aligned ? length - done : (std::min)(length - done, directChunkBytes);
+        char* buffer = aligned ? data + done : bounce.data();
+        if (write && !aligned) std::memcpy(buffer, data + done, chunk);
+
+        uint64_t position = offset + done;
+        size_t moved = 0;
+#ifdef _WIN32
+        while (moved < chunk) {
+            OVERLAPPED ov = {};
+            uint64_t at = position + moved;
+            ov.Offset = static_cast<DWORD>(at & 0xFFFFFFFFULL);
+            ov.OffsetHigh = static_cast<DWORD>(at >> 32);
+            DWORD step = static_cast<DWORD>((std::min<size_t>)(chunk - moved, 1u << 30));
+            DWORD n = 0;
+            BOOL ok = write ? WriteFile(directHandle, buffer + moved, step, &n, &ov)
+                            : ReadFile(directHandle, buffer + moved, step, &n, &ov);
+            if (!ok || n == 0) break;
+            moved += n;
+        }
+#elif __linux__
+        while (moved < chunk) {
+            off_t at = static_cast<off_t>(position + moved);
+            ssize_t n = write ? pwrite(directDescriptor, buffer + moved, chunk - moved, at)
+                              : pread(directDescriptor, buffer + moved, chunk - moved, at);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            moved += static_cast<size_t>(n);
+        }
+#endif
+
+        if (!write && !aligned) std::memcpy(data + done, buffer, moved);
+        done += moved;
+        if (moved != chunk) break;
+    }
+
+    return done;
+}
+
+// Read a byte range, unbuffered when it qualifies
+size_t VirtualDisk::readRange_nl(uint64_t offset, char* dst, size_t length) {
+    if (useDirect_nl(offset, length)) {
+        size_t done = transferDirect_nl(false, offset, dst, length);
+        if (done == length) return done;
+    }
+    return readAt_nl(offset, dst, length);
+}
+
+// Write a byte range, unbuffered when it qualifies
+size_t VirtualDisk::writeRange_nl(uint64_t offset, const char* src, size_t length) {
+    if (useDirect_nl(offset, length)) {
+        // the source is only read; the bounce path copies out of it
+        size_t done = transferDirect_nl(true, offset, const_cast<char*>(src), length);
+        if (done == length) return done;
+    }
+    return writeAt_nl(offset, src, length);
+}
+
+// Flush file contents to stable storage
+void VirtualDisk::flushFile_nl() {
+    if (ioMode == IOMode::Memory) return; // nothing durable behind a RAM image
+
+    IOStats::Scope stats(ioStats, IOStats::Op::Fsync);
+#ifdef _WIN32
+    FlushFileBuffers(fileHandle);
+    for (HANDLE member : stripeHandles) FlushFileBuffers(member);
+#elif __linux__
+    fsync(fileDescriptor);
+    for (int member : stripeDescriptors) fsync(member);
+#else
+    std::lock_guard<std::mutex> streamLock(streamMutex);
+    diskFile.flush();
+#endif
+    stats.succeed(0);
+}
+
+// Flush a byte range; mapped images only msync the touched pages
+void VirtualDisk::flushRange_nl(uint64_t offset, size_t length) {
+    if (ioMode == IOMode::Memory) return;
+    if (!mappedBase) {
+        flushFile_nl();
+        return;
+    }
+
+    if (offset >= mappedLength) return;
+    uint64_t end = (std::min<uint64_t>)(offset + length, mappedLength);
+
+    IOStats::Scope stats(ioStats, IOStats::Op::Fsync);
+#ifdef _WIN32
+    FlushViewOfFile(mappedBase + offset, static_cast<SIZE_T>(end - offset));
+    FlushFileBuffers(fileHandle);
+#elif __linux__
+    uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t start = offset - (offset % pageSize);
+    msync(mappedBase + start, static_cast<size_t>(end - start), MS_SYNC);
+#endif
+    stats.succeed(end - offset);
+}
+
+// Durable write: flush now (Strict / no scope) or leave it to the enclosing scope
+void VirtualDisk::requestFlush_nl(uint64_t offset, size_t length) {
+    if (!deferFlush_nl(offset, length)) {
+        flushRange_nl(offset, length);
+    }
+}
+
+// Hand a durable range to the enclosing scope's barrier; false if it must be flushed now
+bool VirtualDisk::deferFlush_nl(uint64_t offset, size_t length) {
+    auto state = flushScopes.find(this);
+    if (state == flushScopes.end() || state->second.depth == 0) return false;
+
+    std::lock_guard<std::mutex> lock(commitMutex);
+    if (flushPolicy == FlushPolicy::Strict) return false;
+
+    if (length > 0) {
+        pendingStart = (std::min)(pendingStart, offset);
+        pendingEnd = (std::max)(pendingEnd, offset + length);
+    }
+    state->second.pending = true;
+    return true;
+}
+
+// Make every pending durable write stable; concurrent callers share one flush under GroupCommit
+void VirtualDisk::barrier() {
+    std::unique_lock<std::mutex> lock(commitMutex);
+
+    auto flushPending = [this](std::unique_lock<std::mutex>& held) {
+        uint64_t start = pendingStart;
+        uint64_t end = pendingEnd;
+        pendingStart = UINT64_MAX;
+        pendingEnd = 0;
+        held.unlock();
+        {
+            // Bitmap changes made since the last flush point ride along with this barrier
+            std::unique_lock<std::shared_mutex> diskLock(diskMutex);
+            if (isOpen_nl() && blockBitmap.anyDirty()) {
+                saveBitmap_nl(false);
+                start = (std::min)(start, static_cast<uint64_t>(blockSize));
+                end = (std::max)(end, bitmapEndBlock_nl() * blockSize);
+            }
+            if (isOpen_nl() && saveChecksums_nl()) {
+                start = (std::min)(start, static_cast<uint64_t>(checksumArea.startBlock) * blockSize);
+                end = (std::max)(end, (static_cast<uint64_t>(checksumArea.startBlock) + checksumArea.blockCount) * blockSize);
+            }
+        }
+        {
+            std::shared_lock<std::shared_mutex> diskLock(diskMutex);
+            if (isOpen_nl() && end > start) flushRange_nl(start, static_cast<size_t>(end - start));
+        }
+        held.lock();
+        };
+
+    if (flushPolicy != FlushPolicy::GroupCommit) {
+        // A flush already running may have taken this thread's range: wait for it to finish,
+        // then flush whatever is still pending (possibly nothing) on our own
+        commitDone.wait(lock, [this] { return !barrierRunning; });
+        barrierRunning = true;
+        flushPending(lock);
+        barrierRunning = false;
+        commitDone.notify_all();
+        return;
+    }
+
+    // Leader/follower: whoever finds no flush running becomes the leader and flushes
+    // on behalf of everyone who asked before it started
+    uint64_t ticket = ++barriersRequested;
+    while (barriersCompleted < ticket) {
+        if (barrierRunning) {
+            commitDone.wait(lock);
+            continue;
+        }
+
+        barrierRunning = true;
+        if (groupCommitWindow.count() > 0) {
+            commitDone.wait_for(lock, groupCommitWindow);
+        }
+        uint64_t covered = barriersRequested;
+        flushPending(lock);
+        barriersCompleted = covered;
+        barrierRunning = false;
+        commitDone.notify_all();
+    }
+}
+
+// Change the flush policy
+void VirtualDisk::setFlushPolicy(FlushPolicy policy, std::chrono::milliseconds window) {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    flushPolicy = policy;
+    groupCommitWindow = window;
+}
+
+// Current flush policy
+VirtualDisk::FlushPolicy VirtualDisk::getFlushPolicy() const {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    return flushPolicy;
+}
+
+// Enter a flush scope
+VirtualDisk::FlushScope::FlushScope(VirtualDisk& disk) : disk(disk) {
+    flushScopes[&disk].depth++;
+}
+
+// Leave a flush scope; the outermost one issues the barrier
+VirtualDisk::FlushScope::~FlushScope() {
+    auto state = flushScopes.find(&disk);
+    if (state == flushScopes.end() || --state->second.depth > 0) return;
+
+    bool pending = state->second.pending;
+    flushScopes.erase(state);
+    if (!pending) return;
+
+    try {
+        disk.barrier();
+    }
+    catch (...) {
+        // destructors must not throw; a failed flush surfaces on the next syncToDisk
+    }
+}
+
+// Map the whole image read/write; the file is extended first if it is short
+void VirtualDisk::mapImage_nl(uint64_t imageBytes) {
+    if (imageBytes == 0) return;
+
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    size.QuadPart = static_cast<LONGLONG>(imageBytes);
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
+    if (mappingHandle == NULL) {
+        throw VirtualDiskException("Failed to map disk image (Windows error: " + std::to_string(GetLastError()) + ")");
+    }
+
+    mappedBase = static_cast<char*>(MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, static_cast<SIZE_T>(imageBytes)));
+    if (mappedBase == nullptr) {
+        DWORD errorCode = GetLastError();
+        CloseHandle(mappingHandle);
+        mappingHandle = NULL;
+        throw VirtualDiskException("Failed to map disk image view (Windows error: " + std::to_string(errorCode) + ")");
+    }
+#elif __linux__
+    // hugetlbfs mappings cover whole huge pages
+    imageBytes = memoryPageRound(imageBytes);
+
+    struct stat st;
+    if (fstat(fileDescriptor, &st) != 0) {
+        throw VirtualDiskException("Failed to stat disk file: " + std::string(strerror(errno)));
+    }
+    if (static_cast<uint64_t>(st.st_size) < imageBytes && ftruncate(fileDescriptor, static_cast<off_t>(imageBytes)) != 0) {
+        throw VirtualDiskException("Failed to size disk file for mapping: " + std::string(strerror(errno)));
+    }
+
+    void* base = mmap(nullptr, static_cast<size_t>(imageBytes), PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    if (base == MAP_FAILED) {
+        throw VirtualDiskException("Failed to map disk image: " + std::string(strerror(errno)));
+    }
+    mappedBase = static_cast<char*>(base);
+#endif
+
+    mappedLength = static_cast<size_t>(imageBytes);
+}
+
+// Drop the mapping, writing back dirty pages first
+void VirtualDisk::unmapImage_nl() {
+    if (!mappedBase) return;
+
+    flushRange_nl(0, mappedLength);
+
+#ifdef _WIN32
+    UnmapViewOfFile(mappedBase);
+    CloseHandle(mappingHandle);
+    mappingHandle = NULL;
+#elif __linux__
+    munmap(mappedBase, mappedLength);
+#endif
+
+    mappedBase = nullptr;
+    mappedLength = 0;
+}
+
+// Create an empty RAM image of imageBytes and map it
+void VirtualDisk::openMemory_nl(uint64_t imageBytes) {
+    memoryPageBytes = 0;
+    memoryImageBytes = 0;
+
+#ifdef _WIN32
+    // A temporary, delete-on-close file stays in the cache manager unless memory runs short
+    char directory[MAX_PATH + 1];
+    char file[MAX_PATH + 1];
+    if (GetTempPathA(sizeof(directory), directory) == 0 || GetTempFileNameA(directory, "vd", 0, file) == 0) {
+        throw VirtualDiskException("Failed to name memory disk backing file (Windows error: " + std::to_string(GetLastError()) + ")");
+    }
+    fileHandle = CreateFileA(file, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        throw VirtualDiskException("Failed to create memory disk (Windows error: " + std::to_string(GetLastError()) + ")");
+    }
+
+    resizeImage_nl(imageBytes);
+    mapImage_nl(imageBytes);
+#elif __linux__ && defined(MFD_CLOEXEC)
+#ifdef MFD_HUGETLB
+    // Huge pages only exist if the administrator reserved them; any failure falls back to normal pages
+    const size_t hugePage = hugePageBytes();
+    if (hugePage != 0 && imageBytes >= hugePage) {
+        int fd = memfd_create("virtualdisk", MFD_CLOEXEC | MFD_HUGETLB);
+        if (fd >= 0) {
+            fileDescriptor = fd;
+            memoryPageBytes = hugePage;
+            try {
+                resizeImage_nl(imageBytes);
+                mapImage_nl(imageBytes);
+                return;
+            }
+            catch (const VirtualDiskException&) {
+                close(fd);
+                fileDescriptor = -1;
+                memoryPageBytes = 0;
+                memoryImageBytes = 0;
+            }
+        }
+    }
+#endif
+
+    fileDescriptor = memfd_create("virtualdisk", MFD_CLOEXEC);
+    if (fileDescriptor < 0) {
+        throw VirtualDiskException("Failed to create memory disk: " + std::string(strerror(errno)));
+    }
+
+    resizeImage_nl(imageBytes);
+    mapImage_nl(imageBytes);
+
+#ifdef MADV_HUGEPAGE
+    // Transparent huge pages for shmem, where the system allows them
+    if (mappedBase) madvise(mappedBase, mappedLength, MADV_HUGEPAGE);
+#endif
+#else
+    (void)imageBytes;
+    throw VirtualDiskException("Memory-backed disks are not supported on this platform");
+#endif
+}
+
+// Default huge page size from /proc/meminfo; 0 if there is none
+size_t VirtualDisk::hugePageBytes() {
+#ifdef __linux__
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        if (line.compare(0, 13, "Hugepagesize:") == 0) {
+            return static_cast<size_t>(std::strtoull(line.c_str() + 13, nullptr, 10)) * 1024;
+        }
+    }
+#endif
+    return 0;
+}
+
+// Copy a snapshot file into a fresh RAM image; zero blocks are skipped so they stay unallocated
+void VirtualDisk::loadSnapshot_nl() {
+    std::ifstream snapshot(diskPath, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!snapshot.is_open()) {
+        throw VirtualDiskException("Failed to open disk snapshot");
+    }
+    const uint64_t bytes = static_cast<uint64_t>(snapshot.tellg());
+    snapshot.seekg(0);
+
+    openMemory_nl(bytes);
+
+    // Copies go through the mapping: hugetlbfs files do not support write(2)
+    const size_t chunk = (std::max<size_t>)(blockSize, ioBufferCacheBytes / 8);
+    AlignedBufferPool::Buffer buffer = ioBuffers.acquire(chunk);
+    for (uint64_t done = 0; done < bytes;) {
+        size_t piece = static_cast<size_t>((std::min<uint64_t>)(chunk, bytes - done));
+        if (!snapshot.read(buffer.data(), static_cast<std::streamsize>(piece))) {
+            throw VirtualDiskException("Failed to read disk snapshot");
+        }
+        for (size_t offset = 0; offset < piece; offset += blockSize) {
+            size_t length = (std::min<size_t>)(blockSize, piece - offset);
+            if (!isZeroBlock(buffer.data() + offset, length)) {
+                std::memcpy(mappedBase + done + offset, buffer.data() + offset, length);
+            }
+        }
+        done += piece;
+    }
+}
+
+// Write the RAM image to its snapshot file; known-zero and all-zero blocks are left as holes.
+// The image goes to a temporary file that replaces the snapshot only once it is durable,
+// so a failed or interrupted save leaves the previous snapshot intact
+void VirtualDisk::saveSnapshot_nl() {
+    const std::string tempPath = snapshotPath + ".tmp";
+    try {
+        std::ofstream snapshot(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!snapshot.is_open()) {
+            throw VirtualDiskException("Failed to create disk snapshot");
+        }
+
+        const uint64_t bytes = (std::min<uint64_t>)(memoryImageBytes, mappedLength);
+        const uint64_t blocks = (bytes + blockSize - 1) / blockSize;
+        bool tailWritten = false;
+        {
+            std::lock_guard<std::mutex> guard(zeroMutex);
+            for (uint64_t block = 0; block < blocks; ++block) {
+                if (block < knownZero.size() && knownZero.test(static_cast<size_t>(block))) continue;
+
+                const uint64_t offset = block * blockSize;
+                const size_t length = static_cast<size_t>((std::min<uint64_t>)(blockSize, bytes - offset));
+                if (isZeroBlock(mappedBase + offset, length)) continue;
+
+                snapshot.seekp(static_cast<std::streamoff>(offset));
+                snapshot.write(mappedBase + offset, static_cast<std::streamsize>(length));
+                tailWritten = block + 1 == blocks;
+            }
+        }
+
+        // Skipped blocks past the last write would otherwise shorten the file
+        if (bytes > 0 && !tailWritten) {
+            snapshot.seekp(static_cast<std::streamoff>(bytes - 1));
+            snapshot.put('\0');
+        }
+        snapshot.close();
+        if (snapshot.fail()) {
+            throw VirtualDiskException("Failed to write disk snapshot");
+        }
+
+#ifdef _WIN32
+        HANDLE handle = CreateFileA(tempPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        bool synced = handle != INVALID_HANDLE_VALUE && FlushFileBuffers(handle);
+        if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+        if (!synced) {
+            throw VirtualDiskException("Failed to sync disk snapshot");
+        }
+
+        if (!MoveFileExA(tempPath.c_str(), snapshotPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+            throw VirtualDiskException("Failed to replace disk snapshot");
+        }
+#elif __linux__
+        int fd = open(tempPath.c_str(), O_RDWR);
+        bool synced = fd >= 0 && fsync(fd) == 0;
+        if (fd >= 0) close(fd);
+        if (!synced) {
+            throw VirtualDiskException("Failed to sync disk snapshot");
+        }
+
+        if (rename(tempPath.c_str(), snapshotPath.c_str()) != 0) {
+            throw VirtualDiskException("Failed to replace disk snapshot");
+        }
+
+        // The rename itself is durable once the directory is synced
+        size_t slash = snapshotPath.find_last_of('/');
+        std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : snapshotPath.substr(0, slash));
+        int dirFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            close(dirFd);
+        }
+#else
+        if (std::rename(tempPath.c_str(), snapshotPath.c_str()) != 0) {
+            throw VirtualDiskException("Failed to replace disk snapshot");
+        }
+#endif
+    }
+    catch (...) {
+        std::remove(tempPath.c_str());
+        throw;
+    }
+}
+
+// Close Disk
+void VirtualDisk::Close() {
+    stopReadAhead();
+    std::unique_lock<std::shared_mutex> lock(diskMutex);
+
+    if (cache) {
+        cache->flush();
+        cache.reset();
+    }
+
+    // The close-time sync below makes the checksum table durable; a reopen attaches it again
+    if (isOpen_nl()) saveChecksums_nl();
+    {
+        std::lock_guard<std::mutex> guard(checksumMutex);
+        blockChecksums.clear();
+        checksumDirty.clear();
+        checksumDirtyCount = 0;
+    }
+
+    // A RAM image only survives through its snapshot, written before the memory is released
+    if (ioMode == IOMode::Memory && !snapshotPath.empty() && mappedBase) {
+        try {
+            saveBitmap_nl(false);
+            saveSnapshot_nl();
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Failed to save memory disk snapshot (previous snapshot kept): " << e.what() << std::endl;
+        }
+    }
+    snapshotPath.clear();
+
+    closeDirect_nl();
+
+#ifdef _WIN32
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        try {
+            saveBitmap_nl(false); // the close-time sync below makes it durable
+            unmapImage_nl();
+            FlushFileBuffers(fileHandle);
+            CloseHandle(fileHandle);
+            fileHandle = INVALID_HANDLE_VALUE;
+        }
+        catch (...) {
+            if (mappedBase) {
+                UnmapViewOfFile(mappedBase);
+                CloseHandle(mappingHandle);
+                mappingHandle = NULL;
+                mappedBase = nullptr;
+                mappedLength = 0;
+            }
+            if (fileHandle != INVALID_HANDLE_VALUE) {
+                CloseHandle(fileHandle);
+                fileHandle = INVALID_HANDLE_VALUE;
+            }
+            throw;
+        }
+    }
+#elif __linux__
+    if (fileDescriptor >= 0) {
+        try {
+            saveBitmap_nl(false); // the close-time sync below makes it durable
+            unmapImage_nl();
+            fsync(fileDescriptor);
+            close(fileDescriptor);
+            fileDescriptor = -1;
+        }
+        catch (...) {
+            if (mappedBase) {
+                munmap(mappedBase, mappedLength);
+                mappedBase = nullptr;
+                mappedLength = 0;
+            }
+            if (fileDescriptor >= 0) {
+                close(fileDescriptor);
+                fileDescriptor = -1;
+            }
+            throw;
+        }
+    }
+#else
+    if (diskFile.is_open()) {
+        try {
+            saveBitmap_nl(false); // the close-time sync below makes it durable
+            diskFile.flush();
+            diskFile.close();
+        }
+        catch (...) {
+            if (diskFile.is_open()) {
+                diskFile.close();
+            }
+            throw;
+        }
+    }
+#endif
+
+    closeStripes_nl();
+    memoryImageBytes = 0;
+    memoryPageBytes = 0;
+}
+
+// Print Bit map
+void VirtualDisk::printBitmap() {
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+
+    ensureOpen_unlocked();
+
+    const size_t blocksPerRow = 32;
+    const size_t totalBlocks = blockBitmap.size();
+    const size_t usedBlocks = totalBlocks - freeBlocksCount_nl();
+    const float usedPercent = (totalBlocks == 0) ? 0.0f : (static_cast<float>(usedBlocks) / totalBlocks) * 100.0f;
+
+    std::cout << "\n";
+    std::cout << "=========================================================\n";
+    std::cout << "|              VIRTUAL DISK BITMAP                     |\n";
+    std::cout << "=========================================================\n";
+    std::cout << "| Total Blocks: " << std::setw(10) << totalBlocks
+        << " | Free: " << std::setw(5) << freeBlocksCount_nl()
+        << " | Used: " << std::setw(6) << usedBlocks << " |\n";
+    std::cout << "| Usage: " << std::setw(4) << std::fixed << std::setprecision(1)
+        << usedPercent << "%"
+        << std::string(42, ' ') << "|\n";
+    std::cout << "| Legend: [ ] = Free, [X] = Used"
+        << std::string(24, ' ') << "|\n";
+    std::cout << "=========================================================\n\n";
+
+    std::cout << "Block  +";
+    for (size_t col = 0; col < blocksPerRow; ++col) {
+        std::cout << "--";
+    }
+    std::cout << "+\n";
+
+    std::cout << "       |";
+    for (size_t col = 0; col < blocksPerRow; ++col) {
+        std::cout << std::setw(2) << col % 10;
+    }
+    std::cout << "|\n";
+    std::cout << "-------+";
+    for (size_t col = 0; col < blocksPerRow; ++col) {
+        std::cout << "--";
+    }
+    std::cout << "+\n";
+
+    for (size_t i = 0; i < totalBlocks; i++) {
+        if (i % blocksPerRow == 0) {
             if (i != 0) {
                 std::cout << "|\n";
             }
@@ -578,168 +2258,669 @@ void VirtualDisk::printBitmap() {
 
 //Save BitMap Status in Disk with lock
 void VirtualDisk::saveBitmap(bool forceFlush) {
+    FlushScope flush(*this);
     std::unique_lock<std::shared_mutex> lock(diskMutex);
     saveBitmap_nl(forceFlush);
 }
 
 //Save BitMap Status in Disk without lock
 void VirtualDisk::saveBitmap_nl(bool forceFlush) {
+    IOStats::Scope stats(ioStats, IOStats::Op::BitmapSave);
     if (!ensureOpen_unlocked()) return;
 
-    size_t bitmapSize = blockBitmap.size();
-    size_t byteSize = (bitmapSize + 7) / 8;
-    size_t totalAvailableBytes = systemBlock * blockSize;
+    // Bitmap lives in blocks [1, systemBlock) plus any growth segments; write only the
+    // dirty bitmap blocks, in runs that are contiguous on disk
+    const size_t chunks = blockBitmap.chunkCount();
+    AlignedBufferPool::Buffer buffer;
+    uint64_t writtenStart = UINT64_MAX;
+    uint64_t writtenEnd = 0;
+    uint64_t writtenBytes = 0;
+    bool ok = true;
+
+    for (size_t chunk = 0; chunk < chunks;) {
+        if (!blockBitmap.isDirty(chunk)) {
+            ++chunk;
+            continue;
+        }
 
-    if (byteSize > totalAvailableBytes) {
-        std::cerr << "Error: SYSTEM_BLOCKS too small to hold bitmap.\n";
-        return;
+        const uint64_t block = bitmapChunkBlock_nl(chunk);
+        if (block == 0) {
+            std::cerr << "Error: SYSTEM_BLOCKS too small to hold bitmap.\n";
+            return;
+        }
+
+        size_t first = chunk;
+        while (++chunk < chunks && blockBitmap.isDirty(chunk) && bitmapChunkBlock_nl(chunk) == block + (chunk - first)) {}
+
+        size_t length = (chunk - first) * blockSize;
+        if (buffer.size() < length) buffer = ioBuffers.acquire(length);
+        blockBitmap.toBytes(buffer.data(), first * blockSize, length);
+
+        uint64_t offset = block * blockSize;
+        const uint64_t ioStarted = IOStats::clock();
+        size_t written = writeAt_nl(offset, buffer.data(), length);
+        stats.addIo(IOStats::clock() - ioStarted);
+        if (written != length) {
+            ok = false;
+            continue; // stays dirty for the next save
+        }
+
+        blockBitmap.clearDirty(first, chunk - first);
+        writtenStart = (std::min)(writtenStart, offset);
+        writtenEnd = (std::max)(writtenEnd, offset + length);
+        writtenBytes += length;
+    }
+
+    if (forceFlush && writtenEnd > writtenStart) {
+        requestFlush_nl(writtenStart, static_cast<size_t>(writtenEnd - writtenStart));
     }
+    if (ok) stats.succeed(writtenBytes);
+}
+
+//Load BitMap Status From Disk with lock
+void VirtualDisk::loadBitmap() {
+    std::unique_lock<std::shared_mutex> lock(diskMutex);
+    loadBitmap_nl();
+}
+
+//Load BitMap Status From Disk without lock
+void VirtualDisk::loadBitmap_nl() {
+    if (!ensureOpen_unlocked()) return;
+
+    const size_t byteSize = blockBitmap.byteSize();
+    const size_t chunks = (byteSize + blockSize - 1) / blockSize;
+    std::vector<char> bitmap(chunks * blockSize, 0);
+
+    // Read the bitmap blocks in runs that are contiguous on disk
+    for (size_t chunk = 0; chunk < chunks;) {
+        const uint64_t block = bitmapChunkBlock_nl(chunk);
+        if (block == 0) {
+            std::cerr << "Error: SYSTEM_BLOCKS too small to load bitmap.\n";
+            return;
+        }
+
+        size_t first = chunk;
+        while (++chunk < chunks && bitmapChunkBlock_nl(chunk) == block + (chunk - first)) {}
 
-    std::vector<char> bitmap(byteSize, 0);
-    for (size_t i = 0; i < bitmapSize; ++i) {
-        if (blockBitmap[i]) {
-            bitmap[i / 8] |= (1 << (i % 8));
+        size_t length = (chunk - first) * blockSize;
+        if (readAt_nl(block * blockSize, bitmap.data() + first * blockSize, length) != length) {
+            std::cerr << "Failed to read bitmap block at offset " << block * blockSize << "\n";
+            return;
         }
     }
 
-    size_t bytesRemaining = byteSize;
-    size_t offset = 0;
+    blockBitmap.fromBytes(bitmap.data(), byteSize);
+    freeExtentsStale = true;
+}
+
+//Disk block holding a bitmap chunk (0 = no room for it)
+uint64_t VirtualDisk::bitmapChunkBlock_nl(size_t chunk) const {
+    if (chunk + 1 < systemBlock) return 1 + chunk;
+
+    uint64_t index = chunk - (systemBlock > 0 ? systemBlock - 1 : 0);
+    for (const BitmapSegment& segment : bitmapSegments) {
+        if (index < segment.count) return segment.start + index;
+        index -= segment.count;
+    }
+    return 0;
+}
+
+//One past the last block the bitmap may occupy
+uint64_t VirtualDisk::bitmapEndBlock_nl() const {
+    uint64_t end = systemBlock;
+    for (const BitmapSegment& segment : bitmapSegments) {
+        end = (std::max)(end, segment.start + segment.count);
+    }
+    return end;
+}
 
-    for (size_t block = 1; block < systemBlock && bytesRemaining > 0; ++block) {
-        size_t chunkSize = (std::min)(static_cast<size_t>(blockSize), bytesRemaining);
-        size_t blockOffset = block * blockSize;
+//Current length of the image file
+uint64_t VirtualDisk::imageBytes_nl() {
+    if (ioMode == IOMode::Memory) return memoryImageBytes;
 
 #ifdef _WIN32
-        LARGE_INTEGER li;
-        li.QuadPart = static_cast<LONGLONG>(blockOffset);
-        SetFilePointerEx(fileHandle, li, NULL, FILE_BEGIN);
-        DWORD written;
-        WriteFile(fileHandle, &bitmap[offset], (DWORD)chunkSize, &written, NULL);
-        if (chunkSize < blockSize) {
-            std::vector<char> padding(blockSize - chunkSize, 0);
-            WriteFile(fileHandle, padding.data(), (DWORD)padding.size(), &written, NULL);
-        }
+    LARGE_INTEGER size;
+    uint64_t bytes = GetFileSizeEx(fileHandle, &size) ? static_cast<uint64_t>(size.QuadPart) : 0;
+    for (HANDLE member : stripeHandles) {
+        bytes += GetFileSizeEx(member, &size) ? static_cast<uint64_t>(size.QuadPart) : 0;
+    }
+    return bytes;
 #elif __linux__
-        lseek(fileDescriptor, blockOffset, SEEK_SET);
-        write(fileDescriptor, &bitmap[offset], chunkSize);
-        if (chunkSize < blockSize) {
-            std::vector<char> padding(blockSize - chunkSize, 0);
-            write(fileDescriptor, padding.data(), padding.size());
-        }
+    struct stat st;
+    uint64_t bytes = fstat(fileDescriptor, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+    for (int member : stripeDescriptors) {
+        bytes += fstat(member, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+    }
+    return bytes;
 #else
-
-        // C++ standard implementation
-        diskFile.seekp(blockOffset);
-        diskFile.write(&bitmap[offset], chunkSize);
-        if (chunkSize < blockSize) {
-            std::vector<char> padding(blockSize - chunkSize, 0);
-            diskFile.write(padding.data(), padding.size());
-        }
+    std::lock_guard<std::mutex> streamLock(streamMutex);
+    diskFile.seekg(0, std::ios::end);
+    std::streamoff end = diskFile.tellg();
+    diskFile.clear();
+    return end > 0 ? static_cast<uint64_t>(end) : 0;
 #endif
+}
 
-        offset += chunkSize;
-        bytesRemaining -= chunkSize;
+//Set the image file length (the added range stays sparse where the file system allows)
+void VirtualDisk::resizeImage_nl(uint64_t imageBytes) {
+    if (ioMode == IOMode::Memory) {
+        // hugetlbfs files grow in whole huge pages; the logical length is kept separately
+        memoryImageBytes = imageBytes;
+        imageBytes = memoryPageRound(imageBytes);
     }
 
-    if (forceFlush) {
 #ifdef _WIN32
-        FlushFileBuffers(fileHandle);
+    for (uint32_t m = 0; m < stripeWidth; ++m) {
+        HANDLE handle = m == 0 ? fileHandle : stripeHandles[m - 1];
+        LARGE_INTEGER size;
+        size.QuadPart = static_cast<LONGLONG>(stripeMemberBytes(m, imageBytes));
+        if (!SetFilePointerEx(handle, size, NULL, FILE_BEGIN) || !SetEndOfFile(handle)) {
+            throw VirtualDiskException("Failed to resize disk file (Windows error: " + std::to_string(GetLastError()) + ")");
+        }
+    }
 #elif __linux__
-        fsync(fileDescriptor);
+    for (uint32_t m = 0; m < stripeWidth; ++m) {
+        int fd = m == 0 ? fileDescriptor : stripeDescriptors[m - 1];
+        if (ftruncate(fd, static_cast<off_t>(stripeMemberBytes(m, imageBytes))) != 0) {
+            throw VirtualDiskException("Failed to resize disk file: " + std::string(strerror(errno)));
+        }
+    }
 #else
-        diskFile.flush();
+    std::lock_guard<std::mutex> streamLock(streamMutex);
+    diskFile.seekp(static_cast<std::streamoff>(imageBytes - 1));
+    diskFile.put('\0');
+    diskFile.flush();
+    if (!diskFile.good()) {
+        diskFile.clear();
+        throw VirtualDiskException("Failed to resize disk file");
+    }
 #endif
+}
+
+//Read the geometry label of a grown or striped image; false (nothing changed) if there is none
+bool VirtualDisk::loadGeometry_nl() {
+    const uint64_t fileBytes = imageBytes_nl();
+    if (fileBytes < 2ULL * blockSize || fileBytes % blockSize != 0) return false;
+
+    const uint64_t lastBlock = fileBytes / blockSize - 1;
+    std::vector<char> label(blockSize);
+    if (readAt_nl(lastBlock * blockSize, label.data(), blockSize) != blockSize) return false;
+
+    GeometryHeader header;
+    std::memcpy(&header, label.data(), sizeof(header));
+    if (std::memcmp(header.magic, geometryMagic, sizeof(geometryMagic)) != 0 ||
+        header.version != geometryVersion || header.blockSize != blockSize ||
+        header.totalBlocks != lastBlock + 1 || header.systemBlock < 2 || header.systemBlock >= header.totalBlocks ||
+        sizeof(header) + static_cast<uint64_t>(header.segmentCount) * sizeof(BitmapSegment) > blockSize) {
+        return false;
+    }
+
+    const size_t labelBytes = sizeof(header) + header.segmentCount * sizeof(BitmapSegment);
+    const uint64_t checksum = header.checksum;
+    std::memset(label.data() + offsetof(GeometryHeader, checksum), 0, sizeof(header.checksum));
+    if (geometryChecksum(label.data(), labelBytes) != checksum) return false;
+
+    if (header.stripeWidth != stripeWidth || (stripeWidth > 1 && header.stripeUnit != stripeUnit)) {
+        throw VirtualDiskException("Stripe members do not match the image layout");
+    }
+
+    bitmapSegments.resize(header.segmentCount);
+    if (header.segmentCount > 0) {
+        std::memcpy(bitmapSegments.data(), label.data() + sizeof(header), header.segmentCount * sizeof(BitmapSegment));
     }
+    systemBlock = header.systemBlock;
+    initialBlockCount = header.initialBlocks;
+    labelBlock = lastBlock;
+    diskSize = (header.totalBlocks * blockSize) / (1024 * 1024);
+
+    blockBitmap.assign(header.totalBlocks, false);
+    blockBitmap.setChunkSize(blockSize);
+    freeExtentsStale = true;
+    knownZero.assign(header.totalBlocks, false);
+    return true;
 }
 
-//Load BitMap Status From Disk with lock
-void VirtualDisk::loadBitmap() {
+//Write the geometry label into labelBlock
+void VirtualDisk::saveGeometry_nl() {
+    GeometryHeader header = {};
+    std::memcpy(header.magic, geometryMagic, sizeof(geometryMagic));
+    header.version = geometryVersion;
+    header.blockSize = blockSize;
+    header.totalBlocks = blockBitmap.size();
+    header.initialBlocks = initialBlockCount;
+    header.systemBlock = systemBlock;
+    header.segmentCount = static_cast<uint32_t>(bitmapSegments.size());
+    header.stripeWidth = stripeWidth;
+    header.stripeUnit = stripeWidth > 1 ? stripeUnit : 0;
+
+    std::vector<char> label(blockSize, 0);
+    const size_t segmentBytes = bitmapSegments.size() * sizeof(BitmapSegment);
+    std::memcpy(label.data(), &header, sizeof(header));
+    if (segmentBytes > 0) {
+        std::memcpy(label.data() + sizeof(header), bitmapSegments.data(), segmentBytes);
+    }
+
+    header.checksum = geometryChecksum(label.data(), sizeof(header) + segmentBytes);
+    std::memcpy(label.data() + offsetof(GeometryHeader, checksum), &header.checksum, sizeof(header.checksum));
+
+    if (writeAt_nl(labelBlock * blockSize, label.data(), blockSize) != blockSize) {
+        throw VirtualDiskException("Failed to write disk geometry label");
+    }
+}
+
+//Grow the image in place
+void VirtualDisk::grow(uint64_t newSizeMB) {
+    FlushScope flush(*this);
     std::unique_lock<std::shared_mutex> lock(diskMutex);
-    loadBitmap_nl();
+
+    if (!isOpen_nl()) {
+        throw VirtualDiskException("Disk not open");
+    }
+
+    const uint64_t oldBlocks = blockBitmap.size();
+    const uint64_t newBlocks = (newSizeMB * 1024 * 1024) / blockSize;
+    if (newBlocks <= oldBlocks) {
+        throw VirtualDiskException("New disk size must be larger than the current size");
+    }
+    if (newBlocks > UINT32_MAX) {
+        throw VirtualDiskException("New disk size exceeds the addressable block range");
+    }
+    if (systemBlock < 2) {
+        throw VirtualDiskException("Disk too small to grow");
+    }
+
+    // Bitmap blocks the system area and earlier segments cannot hold go to a new segment
+    // at the start of the added range; the label takes the last block
+    const uint64_t chunksNeeded = ((newBlocks + 7) / 8 + blockSize - 1) / blockSize;
+    uint64_t chunkCapacity = systemBlock - 1;
+    for (const BitmapSegment& segment : bitmapSegments) {
+        chunkCapacity += segment.count;
+    }
+    const uint64_t extraChunks = chunksNeeded > chunkCapacity ? chunksNeeded - chunkCapacity : 0;
+
+    if (oldBlocks + extraChunks + 1 > newBlocks) {
+        throw VirtualDiskException("Growth too small to hold the enlarged bitmap");
+    }
+    if (sizeof(GeometryHeader) + (bitmapSegments.size() + 1) * sizeof(BitmapSegment) > blockSize) {
+        throw VirtualDiskException("Geometry label full - too many growth steps");
+    }
+
+    // Extend the file; a mapped image is remapped at the new length
+    const uint64_t imageBytes = newBlocks * blockSize;
+    unmapImage_nl();
+    resizeImage_nl(imageBytes);
+    if (mapsImage()) {
+        mapImage_nl(imageBytes);
+    }
+
+    const uint64_t oldLabel = labelBlock;
+    blockBitmap.grow(newBlocks);
+    freeExtentsStale = true;
+    knownZero.grow(newBlocks);
+    knownZero.setRange(oldBlocks, newBlocks - oldBlocks, true);
+    if (extraChunks > 0) {
+        bitmapSegments.push_back({ oldBlocks, extraChunks });
+        setBlocks_nl(oldBlocks, extraChunks, true);
+        knownZero.setRange(oldBlocks, extraChunks, false);
+    }
+    labelBlock = newBlocks - 1;
+    setBlocks_nl(labelBlock, 1, true);
+    knownZero.set(labelBlock, false);
+    if (oldLabel != 0) {
+        setBlocks_nl(oldLabel, 1, false);
+    }
+    diskSize = newSizeMB;
+
+    // The enlarged bitmap must be stable before the label that makes it reachable
+    saveBitmap_nl(false);
+    flushRange_nl(blockSize, static_cast<size_t>((bitmapEndBlock_nl() - 1) * blockSize));
+    saveGeometry_nl();
+    requestFlush_nl(labelBlock * blockSize, blockSize);
 }
 
-//Load BitMap Status From Disk without lock
-void VirtualDisk::loadBitmap_nl() {
+// Load the checksum table from its area and keep it current from now on
+void VirtualDisk::attachChecksums(const Extent& area) {
+    std::unique_lock<std::shared_mutex> lock(diskMutex);
     if (!ensureOpen_unlocked()) return;
 
-    size_t bitmapSize = blockBitmap.size();
-    size_t byteSize = (bitmapSize + 7) / 8;
-    size_t totalAvailableBytes = systemBlock * blockSize;
+    if (area.blockCount == 0 || static_cast<uint64_t>(area.startBlock) + area.blockCount > blockBitmap.size()) {
+        throw std::invalid_argument("Checksum area is outside the disk");
+    }
 
-    if (byteSize > totalAvailableBytes) {
-        std::cerr << "Error: SYSTEM_BLOCKS too small to load bitmap.\n";
-        return;
+    const size_t perBlock = blockSize / sizeof(uint32_t);
+    std::vector<uint32_t> table(static_cast<size_t>(area.blockCount) * perBlock, 0);
+    const size_t bytes = table.size() * sizeof(uint32_t);
+    if (readRange_nl(static_cast<uint64_t>(area.startBlock) * blockSize, reinterpret_cast<char*>(table.data()), bytes) != bytes) {
+        throw VirtualDiskException("Failed to read the checksum area");
     }
+    table.resize((std::min)(table.size(), blockBitmap.size()));
 
-    std::vector<char> bitmap(byteSize, 0);
-    size_t bytesRemaining = byteSize;
-    size_t offset = 0;
+    std::lock_guard<std::mutex> guard(checksumMutex);
+    checksumArea = area;
+    blockChecksums = std::move(table);
+    checksumDirty.assign(area.blockCount, 0);
+    checksumDirtyCount = 0;
+}
 
-    for (size_t block = 1; block < systemBlock && bytesRemaining > 0; ++block) {
-        size_t chunkSize = (std::min)(static_cast<size_t>(blockSize), bytesRemaining);
-        size_t blockOffset = block * blockSize;
+// Read an extent back and check it against the stored checksums
+bool VirtualDisk::verifyBlocks(const Extent& extent) {
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
+    if (!ensureOpen_unlocked()) return false;
 
-#ifdef _WIN32
-        LARGE_INTEGER li;
-        li.QuadPart = static_cast<LONGLONG>(blockOffset);
-        SetFilePointerEx(fileHandle, li, NULL, FILE_BEGIN);
-        DWORD readBytes;
-        BOOL success = ReadFile(fileHandle, &bitmap[offset], (DWORD)chunkSize, &readBytes, NULL);
-        if (!success || readBytes != chunkSize) {
-            std::cerr << "Failed to read bitmap block at offset " << blockOffset << "\n";
-            return;
+    const uint64_t end = (std::min<uint64_t>)(static_cast<uint64_t>(extent.startBlock) + extent.blockCount, blockChecksums.size());
+    if (extent.startBlock >= end) return true;
+
+    // Large extents are checked a megabyte at a time through one pooled buffer
+    const uint32_t step = static_cast<uint32_t>((std::max<size_t>)(1, directChunkBytes / blockSize));
+    auto buffer = ioBuffers.acquire(static_cast<size_t>((std::min<uint64_t>)(step, end - extent.startBlock)) * blockSize);
+    bool ok = true;
+
+    for (uint64_t block = extent.startBlock; block < end; block += step) {
+        Extent piece(static_cast<uint32_t>(block), static_cast<uint32_t>((std::min<uint64_t>)(step, end - block)));
+        ExtentGuard range(extentLocks, piece, false);
+        if (readBlocks_nl(piece, buffer.data()) != piece.size(blockSize)) return false;
+        ok = verifyChecksums_nl(piece, buffer.data()) && ok;
+    }
+    return ok;
+}
+
+// Blocks that failed verification so far
+uint64_t VirtualDisk::checksumFailures() const {
+    std::lock_guard<std::mutex> guard(checksumMutex);
+    return checksumMismatches;
+}
+
+// Record the checksums of blocks just written from src (caller holds the extent lock)
+void VirtualDisk::updateChecksums_nl(const Extent& extent, const char* src) {
+    const uint64_t end = (std::min<uint64_t>)(static_cast<uint64_t>(extent.startBlock) + extent.blockCount, blockChecksums.size());
+    if (extent.startBlock >= end) return;
+    const size_t count = static_cast<size_t>(end - extent.startBlock);
+
+    // Hash outside the table lock so writers to different blocks do not serialize on it
+    thread_local std::vector<uint32_t> sums;
+    sums.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        sums[i] = Crc32c::compute(src + i * blockSize, blockSize);
+    }
+
+    const size_t perBlock = blockSize / sizeof(uint32_t);
+    std::lock_guard<std::mutex> guard(checksumMutex);
+    std::memcpy(&blockChecksums[extent.startBlock], sums.data(), count * sizeof(uint32_t));
+    for (size_t chunk = extent.startBlock / perBlock; chunk <= (end - 1) / perBlock; ++chunk) {
+        if (!checksumDirty[chunk]) {
+            checksumDirty[chunk] = 1;
+            checksumDirtyCount++;
         }
-#elif __linux__
-        lseek(fileDescriptor, blockOffset, SEEK_SET);
-        ssize_t readBytes = read(fileDescriptor, &bitmap[offset], chunkSize);
-        if (readBytes != (ssize_t)chunkSize) {
-            std::cerr << "Failed to read bitmap block at offset " << blockOffset << "\n";
-            return;
+    }
+}
+
+// Compare blocks read into data with their stored checksums (caller holds the extent lock)
+bool VirtualDisk::verifyChecksums_nl(const Extent& extent, const char* data) {
+    const uint64_t end = (std::min<uint64_t>)(static_cast<uint64_t>(extent.startBlock) + extent.blockCount, blockChecksums.size());
+    if (extent.startBlock >= end) return true;
+    const size_t count = static_cast<size_t>(end - extent.startBlock);
+
+    thread_local std::vector<uint32_t> expected;
+    expected.resize(count);
+    {
+        std::lock_guard<std::mutex> guard(checksumMutex);
+        std::memcpy(expected.data(), &blockChecksums[extent.startBlock], count * sizeof(uint32_t));
+    }
+
+    uint64_t mismatches = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (expected[i] == 0) continue;
+        if (Crc32c::compute(data + i * blockSize, blockSize) != expected[i]) {
+            std::cerr << "Checksum mismatch in block " << (extent.startBlock + i) << "\n";
+            mismatches++;
         }
-#else
-        // C++ standard implementation
-        diskFile.seekg(blockOffset);
-        diskFile.read(&bitmap[offset], chunkSize);
-        if (diskFile.gcount() != (std::streamsize)chunkSize) {
-            std::cerr << "Failed to read bitmap block at offset " << blockOffset << "\n";
-            return;
+    }
+    if (mismatches == 0) return true;
+
+    std::lock_guard<std::mutex> guard(checksumMutex);
+    checksumMismatches += mismatches;
+    return false;
+}
+
+// Store one checksum value for every block of an extent
+void VirtualDisk::fillChecksums_nl(const Extent& extent, uint32_t value) {
+    const uint64_t end = (std::min<uint64_t>)(static_cast<uint64_t>(extent.startBlock) + extent.blockCount, blockChecksums.size());
+    if (extent.startBlock >= end) return;
+
+    const size_t perBlock = blockSize / sizeof(uint32_t);
+    std::lock_guard<std::mutex> guard(checksumMutex);
+    std::fill(blockChecksums.begin() + extent.startBlock, blockChecksums.begin() + static_cast<size_t>(end), value);
+    for (size_t chunk = extent.startBlock / perBlock; chunk <= (end - 1) / perBlock; ++chunk) {
+        if (!checksumDirty[chunk]) {
+            checksumDirty[chunk] = 1;
+            checksumDirtyCount++;
         }
-#endif
+    }
+}
+
+// Write the dirty blocks of the checksum table; true if anything was written
+bool VirtualDisk::saveChecksums_nl() {
+    std::lock_guard<std::mutex> guard(checksumMutex);
+    if (checksumDirtyCount == 0) return false;
 
-        offset += chunkSize;
-        bytesRemaining -= chunkSize;
+    const size_t perBlock = blockSize / sizeof(uint32_t);
+    auto buffer = ioBuffers.acquire(blockSize);
+    bool wrote = false;
+
+    for (size_t chunk = 0; chunk < checksumDirty.size(); ++chunk) {
+        if (!checksumDirty[chunk]) continue;
+
+        const size_t first = chunk * perBlock;
+        const size_t count = (std::min)(perBlock, blockChecksums.size() - first);
+        std::memset(buffer.data(), 0, blockSize);
+        std::memcpy(buffer.data(), &blockChecksums[first], count * sizeof(uint32_t));
+
+        uint64_t offset = (static_cast<uint64_t>(checksumArea.startBlock) + chunk) * blockSize;
+        noteWritten_nl(Extent(static_cast<uint32_t>(checksumArea.startBlock + chunk), 1));
+        if (writeAt_nl(offset, buffer.data(), blockSize) != blockSize) continue; // stays dirty for the next save
+
+        checksumDirty[chunk] = 0;
+        checksumDirtyCount--;
+        wrote = true;
     }
+    return wrote;
+}
+
+// Zero an extent, punching holes where possible
+bool VirtualDisk::zeroBlocks(const Extent& extent, bool flushImmediately) {
+    FlushScope flush(*this);
+    std::shared_lock<std::shared_mutex> lock(diskMutex);
 
-    for (size_t i = 0; i < bitmapSize; ++i) {
-        blockBitmap[i] = (bitmap[i / 8] >> (i % 8)) & 1;
+    if (!ensureOpen_unlocked()) return false;
+    if (extent.blockCount == 0) return true;
+    if (static_cast<uint64_t>(extent.startBlock) + extent.blockCount > blockBitmap.size()) {
+        throw std::out_of_range("Extent exceeds disk bounds");
     }
+
+    ExtentGuard range(extentLocks, extent, true);
+    return zeroBlocks_nl(extent, flushImmediately, true);
 }
 
-//Get Free Blocks
-uint32_t VirtualDisk::findContiguousBlocks(uint32_t count) {
-    if (count == 0) return UINT32_MAX;
+// Zero the blocks of an extent not already known to be zero. Without writeFallback, blocks
+// the file system cannot punch are left as they are (and stay unknown).
+bool VirtualDisk::zeroBlocks_nl(const Extent& extent, bool flushImmediately, bool writeFallback) {
+    const uint64_t end = (std::min<uint64_t>)(static_cast<uint64_t>(extent.startBlock) + extent.blockCount, knownZero.size());
+
+    std::vector<Extent> runs;
+    {
+        std::lock_guard<std::mutex> guard(zeroMutex);
+        uint64_t block = extent.startBlock;
+        while (block < end) {
+            size_t first = knownZero.nextFree(static_cast<size_t>(block));
+            if (first == BlockBitmap::npos || first >= end) break;
+            size_t last = knownZero.nextUsed(first, static_cast<size_t>(end));
+            runs.push_back(Extent(static_cast<uint32_t>(first), static_cast<uint32_t>(last - first)));
+            block = last;
+        }
+    }
+    if (runs.empty()) return true;
 
-    uint32_t currentStart = UINT32_MAX;
-    uint32_t currentLength = 0;
+    bool ok = true;
+    AlignedBufferPool::Buffer zeros;
+    uint32_t zeroChecksum = 0;
 
-    for (uint32_t i = 0; i < blockBitmap.size(); ++i) {
-        if (!blockBitmap[i]) {
-            if (currentLength == 0) {
-                currentStart = i;
-            }
+    for (const Extent& run : runs) {
+        if (cache) cache->invalidate(run.startBlock, run.blockCount);
+
+        const uint64_t offset = static_cast<uint64_t>(run.startBlock) * blockSize;
+        const uint64_t length = static_cast<uint64_t>(run.blockCount) * blockSize;
+        bool zeroed = punchRange_nl(offset, length);
 
-            ++currentLength;
+        if (!zeroed && writeFallback) {
+            // No hole punching here: write zeros a chunk at a time
+            const size_t chunk = static_cast<size_t>((std::min<uint64_t>)(length, directChunkBytes));
+            if (zeros.size() < chunk) {
+                zeros = ioBuffers.acquire(chunk);
+                std::memset(zeros.data(), 0, zeros.size());
+            }
+            zeroed = true;
+            for (uint64_t done = 0; done < length && zeroed;) {
+                size_t piece = static_cast<size_t>((std::min<uint64_t>)(length - done, chunk));
+                zeroed = writeRange_nl(offset + done, zeros.data(), piece) == piece;
+                done += piece;
+            }
+        }
+        if (!zeroed) {
+            ok = false;
+            continue;
+        }
 
-            if (currentLength == count) {
-                return currentStart;
+        {
+            std::lock_guard<std::mutex> guard(zeroMutex);
+            knownZero.setRange(run.startBlock, run.blockCount, true);
+        }
+        if (!blockChecksums.empty()) {
+            if (zeroChecksum == 0) {
+                auto block = ioBuffers.acquire(blockSize);
+                std::memset(block.data(), 0, blockSize);
+                zeroChecksum = Crc32c::compute(block.data(), blockSize);
             }
+            fillChecksums_nl(run, zeroChecksum);
         }
-        else {
-            currentLength = 0;
+    }
+
+    if (flushImmediately) {
+        requestFlush_nl(static_cast<uint64_t>(extent.startBlock) * blockSize, extent.size(blockSize));
+    }
+    return ok;
+}
+
+// Deallocate a byte range of the image; false if the file system cannot
+bool VirtualDisk::punchRange_nl(uint64_t offset, uint64_t length) {
+    if (!punchSupported.load(std::memory_order_relaxed)) return false;
+    if (stripeWidth == 1) return punchMember_nl(0, offset, length);
+
+    // Striped: one punch per member run, stripe units that are adjacent on a member merged
+    struct MemberRun {
+        uint64_t start;
+        uint64_t end;
+    };
+    std::vector<std::vector<MemberRun>> plan(stripeWidth);
+    for (uint64_t position = offset; position < offset + length;) {
+        const uint64_t unit = position / stripeUnit;
+        const uint64_t within = position % stripeUnit;
+        const uint32_t member = static_cast<uint32_t>(unit % stripeWidth);
+        const uint64_t fileOffset = (unit / stripeWidth) * stripeUnit + within;
+        const uint64_t piece = (std::min<uint64_t>)(offset + length - position, stripeUnit - within);
+
+        std::vector<MemberRun>& runs = plan[member];
+        if (runs.empty() || runs.back().end != fileOffset) {
+            runs.push_back(MemberRun{ fileOffset, fileOffset });
+        }
+        runs.back().end += piece;
+        position += piece;
+    }
+
+    for (uint32_t member = 0; member < stripeWidth; ++member) {
+        for (const MemberRun& run : plan[member]) {
+            if (!punchMember_nl(member, run.start, run.end - run.start)) return false;
+        }
+    }
+    return true;
+}
+
+// Punch one range of one image file (member 0 is the main handle)
+bool VirtualDisk::punchMember_nl(uint32_t member, uint64_t offset, uint64_t length) {
+#ifdef _WIN32
+    HANDLE handle = member == 0 ? fileHandle : stripeHandles[member - 1];
+
+    // Zeroing a sparse range deallocates it
+    FILE_ZERO_DATA_INFORMATION range;
+    range.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+    range.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(offset + length);
+    DWORD returned = 0;
+    if (DeviceIoControl(handle, FSCTL_SET_ZERO_DATA, &range, sizeof(range), NULL, 0, &returned, NULL)) return true;
+
+    DWORD error = GetLastError();
+    if (error == ERROR_INVALID_FUNCTION || error == ERROR_NOT_SUPPORTED) punchSupported = false;
+    return false;
+#elif __linux__ && defined(FALLOC_FL_PUNCH_HOLE)
+    int fd = member == 0 ? fileDescriptor : stripeDescriptors[member - 1];
+    while (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(length)) != 0) {
+        if (errno == EINTR) continue;
+        if (errno == EOPNOTSUPP || errno == ENOSYS) punchSupported = false;
+        return false;
+    }
+    return true;
+#else
+    (void)member;
+    (void)offset;
+    (void)length;
+    punchSupported = false;
+    return false;
+#endif
+}
+
+// Blocks about to be written are no longer known to be zero
+void VirtualDisk::noteWritten_nl(const Extent& extent) {
+    std::lock_guard<std::mutex> guard(zeroMutex);
+    knownZero.setRange(extent.startBlock, extent.blockCount, false);
+}
+
+//Get Free Blocks
+uint32_t VirtualDisk::findContiguousBlocks(uint32_t count) {
+    std::unique_lock<std::shared_mutex> lock(diskMutex);
+    ensureFreeExtents_nl();
+    uint64_t start = freeExtents.find(count, AllocationPolicy::FirstFit);
+    return start == FreeExtentIndex::npos ? UINT32_MAX : static_cast<uint32_t>(start);
+}
+
+//Acquire a shared or exclusive lock over blocks [start, start + count)
+void VirtualDisk::ExtentLockTable::lock(uint64_t start, uint64_t count, bool exclusive) {
+    uint64_t end = start + (std::max<uint64_t>)(count, 1);
+    std::unique_lock<std::mutex> guard(tableMutex);
+    released.wait(guard, [&] { return !conflicts(start, end, exclusive); });
+    held.push_back({ start, end, exclusive });
+}
+
+//Release a range previously taken with lock()
+void VirtualDisk::ExtentLockTable::unlock(uint64_t start, uint64_t count, bool exclusive) {
+    uint64_t end = start + (std::max<uint64_t>)(count, 1);
+    {
+        std::lock_guard<std::mutex> guard(tableMutex);
+        for (auto it = held.begin(); it != held.end(); ++it) {
+            if (it->start == start && it->end == end && it->exclusive == exclusive) {
+                held.erase(it);
+                break;
+            }
         }
     }
+    released.notify_all();
+}
 
-    return UINT32_MAX;
+//Overlapping ranges conflict unless both are shared
+bool VirtualDisk::ExtentLockTable::conflicts(uint64_t start, uint64_t end, bool exclusive) const {
+    for (const auto& range : held) {
+        if (range.start < end && start < range.end && (exclusive || range.exclusive)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 //Check if Disk is open or not with lock
@@ -748,6 +2929,17 @@ bool VirtualDisk::ensureOpen() {
     return ensureOpen_unlocked();
 }
 
+//Check if Disk is open without throwing
+bool VirtualDisk::isOpen_nl() const {
+#ifdef _WIN32
+    return fileHandle != INVALID_HANDLE_VALUE;
+#elif __linux__
+    return fileDescriptor >= 0;
+#else
+    return diskFile.is_open();
+#endif
+}
+
 //Check if Disk is open or not without lock
 bool VirtualDisk::ensureOpen_unlocked() const {
 #ifdef _WIN32
@@ -8,22 +8,41 @@
 #include <cstdint>
 #include <memory>
 #include <shared_mutex>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+#include <deque>
+#include <thread>
+#include <future>
+#include <functional>
+#include <chrono>
 #include <algorithm>
 #include <iostream>
+#include <atomic>
 
 #ifdef _WIN32
 #include <windows.h>
 #include <io.h>
 #elif __linux__
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/sysinfo.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 
 #else
 #include <fsteram>
 #endif
 
 #include "CryptoUtils.h"
+#include "IoUring.h"
+#include "BlockCache.h"
+#include "BlockBitmap.h"
+#include "FreeExtentIndex.h"
+#include "AlignedBufferPool.h"
+#include "Crc32c.h"
+#include "IOStats.h"
 
 class VirtualDisk {
 public:
@@ -53,9 +72,59 @@ public:
         }
     };
 
+    // Backend used for block I/O, chosen at Initialize time
+    enum class IOMode {
+        Standard,      // positional read/write on the image file
+        MemoryMapped,  // image mapped into the address space, msync for durability
+        Direct,        // large transfers bypass the host page cache (O_DIRECT / FILE_FLAG_NO_BUFFERING)
+        Striped,       // blocks spread RAID-0 style over several image files (see setStriping)
+        Memory         // image lives in RAM (huge pages where available); path, if not empty, is a
+                       // snapshot loaded by Initialize and rewritten by Close
+    };
+
+    // One extent of a batched request; buffer holds extent.blockCount * blockSize bytes
+    struct BatchRequest {
+        Extent extent;
+        char* buffer = nullptr;
+        bool write = false;
+        bool ok = false;
+    };
+
+    using BatchCallback = std::function<void(const BatchRequest&)>;
+
+    // When durable writes (flushImmediately / forced bitmap saves) reach stable storage
+    enum class FlushPolicy {
+        Strict,        // every durable write is flushed before it returns
+        PerOperation,  // one flush when the outermost FlushScope of the thread ends
+        GroupCommit    // per operation, and concurrent operations share a single flush
+    };
+
+    // Durable writes inside the scope are flushed once, when the outermost scope ends
+    class FlushScope {
+    public:
+        explicit FlushScope(VirtualDisk& disk);
+        ~FlushScope();
+        FlushScope(const FlushScope&) = delete;
+        FlushScope& operator=(const FlushScope&) = delete;
+
+    private:
+        VirtualDisk& disk;
+    };
+
     uint32_t blockSize;
 
     static constexpr uint32_t extraSystemBlocks = 2;
+    static constexpr unsigned batchQueueDepth = 64;
+    static constexpr size_t defaultCacheBudget = 16 * 1024 * 1024; // 16MB
+    static constexpr size_t directMinBytes = 128 * 1024;           // smaller transfers stay buffered in Direct mode
+    static constexpr size_t directChunkBytes = 1024 * 1024;        // bounce-buffer size for unaligned callers
+    static constexpr uint32_t defaultStripeUnit = 64 * 1024;       // bytes per member before moving to the next
+    static constexpr size_t stripeParallelBytes = 256 * 1024;      // smaller striped transfers run on one thread
+    static constexpr size_t readAheadMinBytes = 128 * 1024;        // first read-ahead window of a stream
+    static constexpr size_t defaultReadAheadBytes = 2 * 1024 * 1024; // largest window (also capped at a quarter of the cache)
+    static constexpr size_t readAheadStreams = 8;                  // sequential streams tracked at once
+    static constexpr size_t ioBufferAlignment = 4096;              // pooled buffers also satisfy Direct mode
+    static constexpr size_t ioBufferCacheBytes = 8 * 1024 * 1024;  // idle pooled buffers kept for reuse
     static const uint32_t toleranceBlocks = 4;
     static const uint32_t defaultSizeDisk = 50;
 
@@ -66,23 +135,100 @@ public:
     ~VirtualDisk();
 
     // Public API
-    void Initialize(const std::string& path, uint64_t diskSizeMB = defaultSizeDisk);
+    void Initialize(const std::string& path, uint64_t diskSizeMB = defaultSizeDisk, IOMode mode = IOMode::Standard);
     bool IsNew() { return isNewDisk; }
+    IOMode getIOMode() const { return ioMode; }
     void Close();
 
     uint32_t getSystemBlocks() const { return systemBlock; }
     Extent allocateBlocks(uint32_t blocksNeeded);
     void freeBlocks(const Extent& extent);
+    bool reserveBlocks(const Extent& extent);       // claim a specific extent; false if any block is in use
+    uint32_t findContiguousBlocks(uint32_t count);  // start of a free run (UINT32_MAX if none), nothing reserved
     size_t totalBlocks() { std::shared_lock<std::shared_mutex> g(diskMutex); return blockBitmap.size(); }
+    size_t initialBlocks() { std::shared_lock<std::shared_mutex> g(diskMutex); return initialBlockCount; } // size the system area was laid out for
     uint64_t freeBlocksCount();
     void createNewDisk(uint64_t totalBlocks);
     void loadExistingDisk(uint64_t expectedBlocks);
     std::vector<bool> getBitmap();
+    std::vector<Extent> getFreeRuns(uint32_t fromBlock, uint32_t endBlock); // free runs of [fromBlock, endBlock) in block order
     void setBitmap(int index, bool state);
+    bool isBlockUsed(uint32_t index);
 
     bool writeData(const std::vector<char>& data, const Extent& extent, const std::string& password = "", bool flushImmediately = false);
     std::vector<char> readData(const Extent& extent, const std::string& password = "");
 
+    // Copy exactly length raw bytes, starting byteOffset bytes into the extent, into out.
+    // No allocation, no trailing-zero trimming, no decryption. Returns the bytes copied.
+    size_t readInto(const Extent& extent, size_t byteOffset, size_t length, char* out);
+
+    // Write extent.blockCount * blockSize raw bytes from src. No copy, no padding, no encryption.
+    bool writeFrom(const Extent& extent, const char* src, bool flushImmediately = false);
+
+    // Make an extent read back as zeros. Holes are punched in the image where the file system
+    // supports it (zeros are written otherwise), and blocks already known to be zero are skipped.
+    bool zeroBlocks(const Extent& extent, bool flushImmediately = false);
+
+    // Reusable page-aligned scratch buffer of at least bytes, returned to the pool when the lease
+    // ends. Contents are undefined unless zeroed is set.
+    AlignedBufferPool::Buffer acquireBuffer(size_t bytes, bool zeroed = false);
+
+    // Batched raw block I/O (no encryption). Uses io_uring on Linux when the kernel allows it.
+    // submitBatch runs asynchronously; requests and their buffers must outlive the future.
+    bool runBatch(std::vector<BatchRequest>& requests, bool flushImmediately = false, const BatchCallback& onComplete = nullptr);
+    std::future<bool> submitBatch(std::vector<BatchRequest>& requests, bool flushImmediately = false, BatchCallback onComplete = nullptr);
+
+    // Scatter/gather over several extents; buffers[i] holds extents[i].blockCount * blockSize bytes.
+    // Adjacent extents are merged into one vectored call (preadv/pwritev).
+    bool readExtents(const std::vector<Extent>& extents, const std::vector<char*>& buffers);
+    bool writeExtents(const std::vector<Extent>& extents, const std::vector<const char*>& buffers, bool flushImmediately = false);
+
+    // Block cache in front of the image (write-back, 2Q eviction). A budget of 0 disables it.
+    void setCacheBudget(size_t budgetBytes);
+    BlockCache::Stats getCacheStats() const;
+
+    // I/O statistics: per-operation counts, bytes, latency histograms, crypto vs raw I/O time
+    IOStats::Snapshot getIOStats() const;
+    std::vector<std::pair<uint64_t, uint64_t>> getLatencyHistogram(IOStats::Op op) const;
+    void resetIOStats();
+    void printIOStats() const;
+    void pinBlocks(const Extent& extent);
+    void unpinBlocks(const Extent& extent);
+
+    // Sequential read-ahead into the block cache. Reads (readData/readInto) that continue where an
+    // earlier one ended are prefetched in the background; the window doubles while the stream keeps
+    // going and halves when prefetched blocks are evicted unread. maxBytes caps it; 0 disables.
+    void setReadAhead(size_t maxBytes);
+
+    // Striping (IOMode::Striped): the block space is laid out over the Initialize path followed by
+    // memberPaths, stripeUnitBytes (a multiple of blockSize) on each member in turn. Transfers that
+    // span several members run on all of them in parallel. Call before Initialize; an existing
+    // image must be reopened with the same members and stripe unit.
+    void setStriping(const std::vector<std::string>& memberPaths, uint32_t stripeUnitBytes = defaultStripeUnit);
+
+    // Online growth. Existing blocks never move and the system area keeps its size: bitmap blocks
+    // that no longer fit there are reserved at the start of the added range, and a geometry label
+    // in the last block lets the next Initialize find the new size.
+    void grow(uint64_t newSizeMB);
+
+    // Per-block CRC32C checksums, 4 bytes per block in area (reserved by the caller, read at
+    // attach time and written back at flush points). Writes through the public API update them;
+    // readData, readInto and batch reads fail on a block that does not match. Blocks past the
+    // area, and blocks not written since the area was created, are not checked.
+    void attachChecksums(const Extent& area);
+    bool verifyBlocks(const Extent& extent); // false if any checked block does not match
+    uint64_t checksumFailures() const;
+
+    // Flush policy; the window only applies to GroupCommit (how long a leader waits for followers)
+    void setFlushPolicy(FlushPolicy policy, std::chrono::milliseconds window = std::chrono::milliseconds(0));
+    FlushPolicy getFlushPolicy() const;
+
+    // Where allocateBlocks places new extents. FirstFit (the default) keeps the layout compact
+    // at the front of the disk; BestFit limits fragmentation; NextFit spreads writes out.
+    using AllocationPolicy = FreeExtentIndex::Policy;
+    void setAllocationPolicy(AllocationPolicy policy);
+    AllocationPolicy getAllocationPolicy() const;
+
     void printBitmap();
 
     // Helpers
@@ -113,30 +259,252 @@ private:
     int fileDescriptor = -1;
 #else
     std::fstream diskFile;
+    std::mutex streamMutex; // streams have a single shared position
+#endif
+
+    // memory-mapped view of the image (IOMode::MemoryMapped)
+#ifdef _WIN32
+    HANDLE mappingHandle = NULL;
+#endif
+    char* mappedBase = nullptr;
+    size_t mappedLength = 0;
+
+    // RAM-backed image (IOMode::Memory): a memfd (Linux) or delete-on-close temporary file (Windows)
+    // mapped like a MemoryMapped image
+    uint64_t memoryImageBytes = 0;
+    size_t memoryPageBytes = 0;  // huge page size when the image is on hugetlbfs, else 0
+    std::string snapshotPath;    // set once Initialize succeeds; Close writes the image here
+
+    // unbuffered second handle on the image (IOMode::Direct)
+#ifdef _WIN32
+    HANDLE directHandle = INVALID_HANDLE_VALUE;
+#elif __linux__
+    int directDescriptor = -1;
+#endif
+    size_t directAlignment = 0;
+    std::unique_ptr<AlignedBufferPool> alignedBuffers;
+
+    // block and multi-block scratch buffers shared by the write path and the file system
+    AlignedBufferPool ioBuffers{ ioBufferAlignment, ioBufferCacheBytes };
+
+    // per-operation counters and latency histograms
+    IOStats ioStats;
+
+    // stripe members after the first (IOMode::Striped); member 0 is the main handle
+#ifdef _WIN32
+    std::vector<HANDLE> stripeHandles;
+#elif __linux__
+    std::vector<int> stripeDescriptors;
 #endif
+    std::vector<std::string> stripePaths;
+    uint32_t stripeUnit = defaultStripeUnit;
+    uint32_t stripeWidth = 1; // members open, 1 = not striped
 
+    IOMode ioMode = IOMode::Standard;
     bool isNewDisk;
     uint32_t systemBlock;
     std::string diskPath;
-    std::vector<bool> blockBitmap;
+    BlockBitmap blockBitmap;
+
+    // free runs of blockBitmap past the system area; rebuilt lazily after bulk bitmap changes
+    FreeExtentIndex freeExtents;
+    bool freeExtentsStale = true;
+    AllocationPolicy allocationPolicy = AllocationPolicy::FirstFit;
 
     // mutex
     mutable std::shared_mutex diskMutex;
 
+    // Range locks over block extents so disjoint reads/writes run in parallel
+    class ExtentLockTable {
+    public:
+        void lock(uint64_t start, uint64_t count, bool exclusive);
+        void unlock(uint64_t start, uint64_t count, bool exclusive);
+
+    private:
+        struct Range {
+            uint64_t start;
+            uint64_t end;
+            bool exclusive;
+        };
+
+        std::mutex tableMutex;
+        std::condition_variable released;
+        std::list<Range> held;
+
+        bool conflicts(uint64_t start, uint64_t end, bool exclusive) const;
+    };
+
+    class ExtentGuard {
+    public:
+        ExtentGuard(ExtentLockTable& table, const Extent& extent, bool exclusive)
+            : table(table), start(extent.startBlock), count(extent.blockCount), exclusive(exclusive) {
+            table.lock(start, count, exclusive);
+        }
+        ~ExtentGuard() { table.unlock(start, count, exclusive); }
+        ExtentGuard(const ExtentGuard&) = delete;
+        ExtentGuard& operator=(const ExtentGuard&) = delete;
+
+    private:
+        ExtentLockTable& table;
+        uint64_t start;
+        uint64_t count;
+        bool exclusive;
+    };
+
+    ExtentLockTable extentLocks;
+
+    // block cache (not used for memory-mapped images)
+    std::unique_ptr<BlockCache> cache;
+    size_t cacheBudget = defaultCacheBudget;
+
+    // sequential read-ahead, filled by a background thread started on first use
+    struct ReadStream {
+        uint64_t next = 0;           // block a sequential read would start at
+        uint64_t prefetchedEnd = 0;  // read-ahead queued up to here
+        uint64_t window = 0;         // blocks
+        uint64_t lastUse = 0;
+    };
+    std::mutex readAheadMutex;
+    std::condition_variable readAheadWake;
+    std::vector<ReadStream> readStreams;
+    std::deque<Extent> readAheadQueue;
+    std::thread readAheadThread;
+    bool readAheadStop = false;
+    uint64_t readAheadClock = 0;
+    uint64_t readAheadWasted = 0;    // cache's prefetchWasted when last looked at
+    size_t readAheadMaxBytes = defaultReadAheadBytes;
+
+    // durability barriers (see FlushPolicy)
+    FlushPolicy flushPolicy = FlushPolicy::GroupCommit;
+    std::chrono::milliseconds groupCommitWindow{ 0 };
+    mutable std::mutex commitMutex;
+    std::condition_variable commitDone;
+    uint64_t barriersRequested = 0;
+    uint64_t barriersCompleted = 0;
+    bool barrierRunning = false;
+    uint64_t pendingStart = UINT64_MAX;  // byte range waiting for the next barrier
+    uint64_t pendingEnd = 0;
+
+    // geometry of a grown image
+    struct BitmapSegment {
+        uint64_t start;  // first disk block
+        uint64_t count;  // bitmap chunks held (one block each)
+    };
+    uint64_t initialBlockCount = 0;
+    std::vector<BitmapSegment> bitmapSegments; // bitmap blocks past the system area, in chunk order
+    uint64_t labelBlock = 0;                   // block holding the geometry label (grown or striped images), 0 = none
+
+    // per-block checksums (attachChecksums); 0 = not known
+    mutable std::mutex checksumMutex;
+    Extent checksumArea;
+    std::vector<uint32_t> blockChecksums;
+    std::vector<uint8_t> checksumDirty; // one flag per area block
+    size_t checksumDirtyCount = 0;
+    uint64_t checksumMismatches = 0;
+
+    // blocks known to read back as zero (fresh, grown or punched, not written since); not persisted
+    std::mutex zeroMutex;
+    BlockBitmap knownZero;
+    std::atomic<bool> punchSupported{ true };
+
+    // io_uring ring for batched I/O, created on first use
+    std::unique_ptr<IoUring> ring;
+    std::mutex ringMutex;
+
     // original implementations
     void saveBitmap(bool forceFlush = false);
     void loadBitmap();
-    uint32_t findContiguousBlocks(uint32_t count);
 
     // helpers
     size_t determineSmartBufferSize();
 
+    // positional I/O (never moves a shared file offset)
+    size_t readAt_nl(uint64_t offset, char* dst, size_t length);
+    size_t writeAt_nl(uint64_t offset, const char* src, size_t length);
+
+    // vectored positional I/O over consecutive file bytes
+    struct IoSlice {
+        char* buffer;
+        size_t length;
+    };
+    size_t transferv_nl(bool write, uint64_t offset, const std::vector<IoSlice>& slices);
+
+    // striped transfers (IOMode::Striped)
+    void openStripes_nl(bool create, uint64_t imageBytes);
+    void closeStripes_nl();
+    uint64_t stripeMemberBytes(uint32_t member, uint64_t imageBytes) const;
+    size_t transferStriped_nl(bool write, uint64_t offset, const std::vector<IoSlice>& slices);
+    size_t transferMember_nl(uint32_t member, bool write, uint64_t fileOffset, const std::vector<IoSlice>& pieces);
+
+    // unbuffered transfers (IOMode::Direct), falling back to readAt_nl/writeAt_nl
+    void openDirect_nl();
+    void closeDirect_nl();
+    bool useDirect_nl(uint64_t offset, size_t length) const;
+    size_t transferDirect_nl(bool write, uint64_t offset, char* data, size_t length);
+    size_t readRange_nl(uint64_t offset, char* dst, size_t length);
+    size_t writeRange_nl(uint64_t offset, const char* src, size_t length);
+    void flushFile_nl();
+    void flushRange_nl(uint64_t offset, size_t length);
+
+    // durable write bookkeeping
+    void requestFlush_nl(uint64_t offset, size_t length);
+    bool deferFlush_nl(uint64_t offset, size_t length);
+    void barrier();
+
+    // block I/O through the cache
+    size_t readBlocks_nl(const Extent& extent, char* dst);
+    size_t writeBlocks_nl(const Extent& extent, const char* src, bool flushImmediately);
+    void createCache_nl();
+
+    // read-ahead
+    void noteRead_nl(const Extent& extent);
+    void readAheadLoop();
+    void prefetchBlocks(const Extent& extent, std::vector<char>& buffer);
+    void stopReadAhead();
+
+    // per-block checksums
+    void updateChecksums_nl(const Extent& extent, const char* src);
+    bool verifyChecksums_nl(const Extent& extent, const char* data);
+    bool saveChecksums_nl();
+    void fillChecksums_nl(const Extent& extent, uint32_t value);
+
+    // hole punching and known-zero tracking
+    bool zeroBlocks_nl(const Extent& extent, bool flushImmediately, bool writeFallback);
+    bool punchRange_nl(uint64_t offset, uint64_t length);
+    bool punchMember_nl(uint32_t member, uint64_t offset, uint64_t length);
+    void noteWritten_nl(const Extent& extent);
+
+    // memory mapping
+    void mapImage_nl(uint64_t imageBytes);
+    void unmapImage_nl();
+    bool mapsImage() const { return ioMode == IOMode::MemoryMapped || ioMode == IOMode::Memory; }
+
+    // RAM-backed images
+    void openMemory_nl(uint64_t imageBytes);
+    void loadSnapshot_nl();
+    void saveSnapshot_nl();
+    static size_t hugePageBytes();
+    uint64_t memoryPageRound(uint64_t bytes) const {
+        return memoryPageBytes ? (bytes + memoryPageBytes - 1) / memoryPageBytes * memoryPageBytes : bytes;
+    }
+
+    // grown-image geometry
+    uint64_t bitmapChunkBlock_nl(size_t chunk) const;
+    uint64_t bitmapEndBlock_nl() const;
+    uint64_t imageBytes_nl();
+    void resizeImage_nl(uint64_t imageBytes);
+    bool loadGeometry_nl();
+    void saveGeometry_nl();
+
     void createNewDisk_nl(uint64_t totalBlocks);
     void loadExistingDisk_nl(uint64_t expectedBlocks);
     void saveBitmap_nl(bool forceFlush = false);
     void loadBitmap_nl();
     uint64_t freeBlocksCount_nl() const;
+    void setBlocks_nl(uint64_t start, uint64_t count, bool used);
+    void ensureFreeExtents_nl();
     bool ensureOpen_unlocked() const;
+    bool isOpen_nl() const;
 
   
 };
@@ -74,6 +74,7 @@ int main() {
     }
        
     mini.Mount(); // inodePercentage, btreePercentage, inodeSize
+    mini.StartFlusher(); // metadata is written back in the background from here on
     
     MiniHSFSAI fsAI(mini);  // تهيئة نظام الذكاء الاصطناعي
 